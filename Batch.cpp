@@ -0,0 +1,284 @@
+#include "Batch.hpp"
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "Raster.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace svg
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        double seconds_since(Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        //! a queue with a maximum size: push waits while it is full, pop waits while it is empty
+        //! after close(), pop returns false once the queue is empty
+        template <class T>
+        class BoundedQueue
+        {
+        public:
+            explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+            void push(T item) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_full_.wait(lock, [&] {return items_.size() < capacity_;});
+                items_.push_back(std::move(item));
+                not_empty_.notify_one();
+            }
+
+            bool pop(T &item) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_empty_.wait(lock, [&] {return !items_.empty() || closed_;});
+                if (items_.empty()) {
+                    return false;
+                }
+                item = std::move(items_.front());
+                items_.pop_front();
+                not_full_.notify_one();
+                return true;
+            }
+
+            void close() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_ = true;
+                not_empty_.notify_all();
+            }
+
+        private:
+            size_t capacity_;
+            bool closed_ = false;
+            std::deque<T> items_;
+            std::mutex mutex_;
+            std::condition_variable not_full_;
+            std::condition_variable not_empty_;
+        };
+
+        //! images waiting to be reused, the most recently given back last
+        //! they take at most max_bytes: giving back one more drops the oldest ones, so a batch of many
+        //! different sizes does not keep one image of each
+        class ImagePool
+        {
+        public:
+            ImagePool(const Color &background, size_t max_bytes) : background_(background), max_bytes_(max_bytes) {}
+
+            std::unique_ptr<PNGImage> get(int width, int height) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (auto it = free_.rbegin(); it != free_.rend(); ++it) {
+                        if ((*it)->width() == width && (*it)->height() == height) {
+                            std::unique_ptr<PNGImage> img = std::move(*it);
+                            free_.erase(std::next(it).base());
+                            bytes_ -= image_bytes(*img);
+                            fill_rect(*img, image_box(*img), background_, image_box(*img));
+                            return img;
+                        }
+                    }
+                    allocated_++;
+                }
+                return std::make_unique<PNGImage>(width, height);
+            }
+
+            void put(std::unique_ptr<PNGImage> img) {
+                std::vector<std::unique_ptr<PNGImage>> dropped; //! freed after the lock is released
+                std::lock_guard<std::mutex> lock(mutex_);
+                size_t bytes = image_bytes(*img);
+                if (bytes > max_bytes_) {
+                    dropped.push_back(std::move(img));
+                    return;
+                }
+                bytes_ += bytes;
+                free_.push_back(std::move(img));
+                while (bytes_ > max_bytes_) {
+                    bytes_ -= image_bytes(*free_.front());
+                    dropped.push_back(std::move(free_.front()));
+                    free_.pop_front();
+                }
+            }
+
+            size_t allocated() const {return allocated_;}
+
+        private:
+            static size_t image_bytes(const PNGImage &img) {
+                return static_cast<size_t>(img.width()) * img.height() * sizeof(Color);
+            }
+
+            Color background_;
+            size_t max_bytes_;
+            std::mutex mutex_;
+            std::deque<std::unique_ptr<PNGImage>> free_;
+            size_t bytes_ = 0;
+            size_t allocated_ = 0;
+        };
+
+        struct ParsedJob
+        {
+            size_t job;
+            std::unique_ptr<Scene> scene;
+        };
+
+        struct RenderedJob
+        {
+            size_t job;
+            int size; //! which of the sizes of the job it is
+            std::unique_ptr<PNGImage> img;
+        };
+
+        //! the stats of one stage, updated by its threads
+        struct StageCounter
+        {
+            std::atomic<size_t> items{0};
+            std::atomic<int64_t> busy_ns{0};
+
+            void add(Clock::time_point start) {
+                items++;
+                busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            }
+
+            StageStats stats(unsigned threads) const {
+                StageStats s;
+                s.items = items;
+                s.busy_seconds = busy_ns * 1e-9;
+                s.threads = threads;
+                return s;
+            }
+        };
+
+        //! runs count threads of body and returns them
+        template <class F>
+        std::vector<std::thread> start(unsigned count, F body) {
+            std::vector<std::thread> threads;
+            for (unsigned i = 0; i < count; i++) {
+                threads.emplace_back(body);
+            }
+            return threads;
+        }
+
+        void join(std::vector<std::thread> &threads) {
+            for (std::thread &t : threads) {
+                t.join();
+            }
+        }
+    }
+
+    BatchStats convert_batch(const std::vector<std::pair<std::string, std::string>> &jobs,
+                             const BatchOptions &options) {
+        Clock::time_point batch_start = Clock::now();
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        unsigned parsers = std::max(1u, options.parsers);
+        unsigned renderers = options.renderers == 0 ? cores : options.renderers;
+        unsigned encoders = options.encoders == 0 ? cores : options.encoders;
+
+        BoundedQueue<ParsedJob> parsed(options.queue_size);
+        BoundedQueue<RenderedJob> rendered(options.queue_size);
+        ImagePool images(options.background, options.pool_bytes);
+        StageCounter parse_counter, render_counter, encode_counter;
+        std::mutex failures_mutex;
+        BatchStats stats;
+        auto fail = [&](size_t job, const std::exception &e) {
+            std::lock_guard<std::mutex> lock(failures_mutex);
+            stats.failures.push_back({jobs[job].first, e.what()});
+        };
+
+        std::vector<int> sizes = options.sizes.empty() ? std::vector<int>{0} : options.sizes;
+        //! the element list is drawn directly only for a single output of whole pixels
+        bool compiled = sizes.size() > 1 || sizes[0] != 0 || options.subpixel_bits != 0;
+
+        std::atomic<size_t> next_job(0);
+        std::vector<std::thread> parse_threads = start(parsers, [&] {
+            StatsScope scope(options.stats);
+            size_t job;
+            while ((job = next_job++) < jobs.size()) {
+                Clock::time_point t = Clock::now();
+                try {
+                    auto scene = std::make_unique<Scene>();
+                    scene->subpixel_bits = options.subpixel_bits;
+                    readSVG(jobs[job].first, *scene);
+                    parse_counter.add(t);
+                    parsed.push({job, std::move(scene)});
+                } catch (const std::exception &e) {
+                    fail(job, e);
+                }
+            }
+        });
+
+        std::vector<std::thread> render_threads = start(renderers, [&] {
+            StatsScope scope(options.stats);
+            ParsedJob item;
+            while (parsed.pop(item)) {
+                Clock::time_point t = Clock::now();
+                try {
+                    if (!compiled) {
+                        std::unique_ptr<PNGImage> img = images.get(item.scene->dimensions.x, item.scene->dimensions.y);
+                        item.scene->draw(*img);
+                        item.scene.reset(); //! the scene is not needed anymore, free it before waiting on the queue
+                        render_counter.add(t);
+                        rendered.push({item.job, 0, std::move(img)});
+                        continue;
+                    }
+                    //! one compile for all the sizes, each is drawn from a scaled copy
+                    CompiledScene scene = compile(item.scene->elements, item.scene->dimensions, options.subpixel_bits);
+                    Point dimensions = item.scene->dimensions;
+                    item.scene.reset();
+                    std::vector<RenderedJob> outputs;
+                    for (int size : sizes) {
+                        double factor = size_factor(dimensions, size);
+                        CompiledScene copy;
+                        if (factor != 1) {
+                            copy = scene.scaled(factor);
+                        }
+                        const CompiledScene &sized = factor != 1 ? copy : scene;
+                        std::unique_ptr<PNGImage> img = images.get(sized.dimensions.x, sized.dimensions.y);
+                        sized.draw(*img);
+                        outputs.push_back({item.job, size, std::move(img)});
+                    }
+                    render_counter.add(t);
+                    for (RenderedJob &output : outputs) {
+                        rendered.push(std::move(output));
+                    }
+                } catch (const std::exception &e) {
+                    fail(item.job, e);
+                }
+            }
+        });
+
+        std::vector<std::thread> encode_threads = start(encoders, [&] {
+            StatsScope scope(options.stats);
+            RenderedJob item;
+            while (rendered.pop(item)) {
+                Clock::time_point t = Clock::now();
+                try {
+                    PNGWriter writer(item.img->width(), item.img->height(), sized_file(jobs[item.job].second, item.size),
+                                     options.png);
+                    write_png(*item.img, writer);
+                    encode_counter.add(t);
+                } catch (const std::exception &e) {
+                    fail(item.job, e);
+                }
+                images.put(std::move(item.img));
+            }
+        });
+
+        //! each stage is closed when the one before it has finished
+        join(parse_threads);
+        parsed.close();
+        join(render_threads);
+        rendered.close();
+        join(encode_threads);
+
+        stats.parse = parse_counter.stats(parsers);
+        stats.render = render_counter.stats(renderers);
+        stats.encode = encode_counter.stats(encoders);
+        stats.images_allocated = images.allocated();
+        stats.wall_seconds = seconds_since(batch_start);
+        return stats;
+    }
+}
@@ -0,0 +1,62 @@
+//! @file Batch.hpp
+#ifndef __svg_Batch_hpp__
+#define __svg_Batch_hpp__
+
+#include "PNGWriter.hpp"
+#include "Color.hpp"
+#include "Stats.hpp"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace svg
+{
+    //! how many threads each stage of convert_batch uses and how much work can wait between stages
+    struct BatchOptions
+    {
+        unsigned parsers = 1;    //! threads running readSVG
+        unsigned renderers = 0;  //! threads drawing, 0 means one per core
+        unsigned encoders = 0;   //! threads writing the PNGs, 0 means one per core
+        size_t queue_size = 16;  //! the most jobs waiting between two stages, a full queue stalls the stage before it
+        PNGOptions png;          //! compression of the output files (threads is per file, 1 is best here)
+        Color background = {255, 255, 255}; //! what a reused image is cleared to (a new PNGImage is white)
+        size_t pool_bytes = 64 << 20;       //! the most memory the images waiting to be reused can take
+        //! the outputs of every job, as in convert_sizes (largest side in pixels, 0 for the size of the document,
+        //! written to sized_file of the png file); empty is the same as {0}
+        //! the scene is parsed and compiled once, and each size is drawn from a scaled copy of it
+        std::vector<int> sizes;
+        int subpixel_bits = 0; //! 0: whole pixels, otherwise read and drawn anti-aliased (see Scene::subpixel_bits)
+        //! if not null, every thread of the batch is attached to it, so it gets the stages and counters
+        //! of Stats.hpp summed over all the jobs
+        StatsCollector *stats = nullptr;
+    };
+
+    //! the time spent by one stage
+    struct StageStats
+    {
+        size_t items = 0;          //! jobs that went through the stage (images, for the encoders)
+        double busy_seconds = 0;   //! time spent working, summed over the threads of the stage
+        unsigned threads = 0;
+        //! jobs per second the stage could do if it never waited
+        double throughput() const {return busy_seconds > 0 ? items / busy_seconds * threads : 0;}
+    };
+
+    struct BatchStats
+    {
+        StageStats parse;
+        StageStats render;
+        StageStats encode;
+        double wall_seconds = 0;
+        size_t images_allocated = 0; //! images created, the others were reused
+        std::vector<std::pair<std::string, std::string>> failures; //! input file and error message
+    };
+
+    //! converts every (svg file, png file) pair of jobs with a pipeline of three stages:
+    //! parsers (readSVG) -> renderers (draw) -> encoders (PNG), connected by bounded queues
+    //! the images are given back to a pool after encoding and reused for the next job of the same size,
+    //! the pool drops the oldest ones beyond options.pool_bytes
+    //! a job that fails is recorded in the stats and the others go on
+    BatchStats convert_batch(const std::vector<std::pair<std::string, std::string>> &jobs,
+                             const BatchOptions &options = BatchOptions());
+}
+#endif
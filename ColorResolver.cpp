@@ -0,0 +1,414 @@
+#include "ColorResolver.hpp"
+#include "SVGAttributes.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <string>
+
+namespace svg
+{
+    namespace
+    {
+        struct NamedColor
+        {
+            std::string_view name;
+            unsigned char red, green, blue;
+        };
+
+        constexpr NamedColor NAMED_COLORS[] = {
+            {"aliceblue", 0xf0, 0xf8, 0xff},
+            {"antiquewhite", 0xfa, 0xeb, 0xd7},
+            {"aqua", 0x00, 0xff, 0xff},
+            {"aquamarine", 0x7f, 0xff, 0xd4},
+            {"azure", 0xf0, 0xff, 0xff},
+            {"beige", 0xf5, 0xf5, 0xdc},
+            {"bisque", 0xff, 0xe4, 0xc4},
+            {"black", 0x00, 0x00, 0x00},
+            {"blanchedalmond", 0xff, 0xeb, 0xcd},
+            {"blue", 0x00, 0x00, 0xff},
+            {"blueviolet", 0x8a, 0x2b, 0xe2},
+            {"brown", 0xa5, 0x2a, 0x2a},
+            {"burlywood", 0xde, 0xb8, 0x87},
+            {"cadetblue", 0x5f, 0x9e, 0xa0},
+            {"chartreuse", 0x7f, 0xff, 0x00},
+            {"chocolate", 0xd2, 0x69, 0x1e},
+            {"coral", 0xff, 0x7f, 0x50},
+            {"cornflowerblue", 0x64, 0x95, 0xed},
+            {"cornsilk", 0xff, 0xf8, 0xdc},
+            {"crimson", 0xdc, 0x14, 0x3c},
+            {"cyan", 0x00, 0xff, 0xff},
+            {"darkblue", 0x00, 0x00, 0x8b},
+            {"darkcyan", 0x00, 0x8b, 0x8b},
+            {"darkgoldenrod", 0xb8, 0x86, 0x0b},
+            {"darkgray", 0xa9, 0xa9, 0xa9},
+            {"darkgreen", 0x00, 0x64, 0x00},
+            {"darkgrey", 0xa9, 0xa9, 0xa9},
+            {"darkkhaki", 0xbd, 0xb7, 0x6b},
+            {"darkmagenta", 0x8b, 0x00, 0x8b},
+            {"darkolivegreen", 0x55, 0x6b, 0x2f},
+            {"darkorange", 0xff, 0x8c, 0x00},
+            {"darkorchid", 0x99, 0x32, 0xcc},
+            {"darkred", 0x8b, 0x00, 0x00},
+            {"darksalmon", 0xe9, 0x96, 0x7a},
+            {"darkseagreen", 0x8f, 0xbc, 0x8f},
+            {"darkslateblue", 0x48, 0x3d, 0x8b},
+            {"darkslategray", 0x2f, 0x4f, 0x4f},
+            {"darkslategrey", 0x2f, 0x4f, 0x4f},
+            {"darkturquoise", 0x00, 0xce, 0xd1},
+            {"darkviolet", 0x94, 0x00, 0xd3},
+            {"deeppink", 0xff, 0x14, 0x93},
+            {"deepskyblue", 0x00, 0xbf, 0xff},
+            {"dimgray", 0x69, 0x69, 0x69},
+            {"dimgrey", 0x69, 0x69, 0x69},
+            {"dodgerblue", 0x1e, 0x90, 0xff},
+            {"firebrick", 0xb2, 0x22, 0x22},
+            {"floralwhite", 0xff, 0xfa, 0xf0},
+            {"forestgreen", 0x22, 0x8b, 0x22},
+            {"fuchsia", 0xff, 0x00, 0xff},
+            {"gainsboro", 0xdc, 0xdc, 0xdc},
+            {"ghostwhite", 0xf8, 0xf8, 0xff},
+            {"gold", 0xff, 0xd7, 0x00},
+            {"goldenrod", 0xda, 0xa5, 0x20},
+            {"gray", 0x80, 0x80, 0x80},
+            {"grey", 0x80, 0x80, 0x80},
+            {"green", 0x00, 0x80, 0x00},
+            {"greenyellow", 0xad, 0xff, 0x2f},
+            {"honeydew", 0xf0, 0xff, 0xf0},
+            {"hotpink", 0xff, 0x69, 0xb4},
+            {"indianred", 0xcd, 0x5c, 0x5c},
+            {"indigo", 0x4b, 0x00, 0x82},
+            {"ivory", 0xff, 0xff, 0xf0},
+            {"khaki", 0xf0, 0xe6, 0x8c},
+            {"lavender", 0xe6, 0xe6, 0xfa},
+            {"lavenderblush", 0xff, 0xf0, 0xf5},
+            {"lawngreen", 0x7c, 0xfc, 0x00},
+            {"lemonchiffon", 0xff, 0xfa, 0xcd},
+            {"lightblue", 0xad, 0xd8, 0xe6},
+            {"lightcoral", 0xf0, 0x80, 0x80},
+            {"lightcyan", 0xe0, 0xff, 0xff},
+            {"lightgoldenrodyellow", 0xfa, 0xfa, 0xd2},
+            {"lightgray", 0xd3, 0xd3, 0xd3},
+            {"lightgreen", 0x90, 0xee, 0x90},
+            {"lightgrey", 0xd3, 0xd3, 0xd3},
+            {"lightpink", 0xff, 0xb6, 0xc1},
+            {"lightsalmon", 0xff, 0xa0, 0x7a},
+            {"lightseagreen", 0x20, 0xb2, 0xaa},
+            {"lightskyblue", 0x87, 0xce, 0xfa},
+            {"lightslategray", 0x77, 0x88, 0x99},
+            {"lightslategrey", 0x77, 0x88, 0x99},
+            {"lightsteelblue", 0xb0, 0xc4, 0xde},
+            {"lightyellow", 0xff, 0xff, 0xe0},
+            {"lime", 0x00, 0xff, 0x00},
+            {"limegreen", 0x32, 0xcd, 0x32},
+            {"linen", 0xfa, 0xf0, 0xe6},
+            {"magenta", 0xff, 0x00, 0xff},
+            {"maroon", 0x80, 0x00, 0x00},
+            {"mediumaquamarine", 0x66, 0xcd, 0xaa},
+            {"mediumblue", 0x00, 0x00, 0xcd},
+            {"mediumorchid", 0xba, 0x55, 0xd3},
+            {"mediumpurple", 0x93, 0x70, 0xdb},
+            {"mediumseagreen", 0x3c, 0xb3, 0x71},
+            {"mediumslateblue", 0x7b, 0x68, 0xee},
+            {"mediumspringgreen", 0x00, 0xfa, 0x9a},
+            {"mediumturquoise", 0x48, 0xd1, 0xcc},
+            {"mediumvioletred", 0xc7, 0x15, 0x85},
+            {"midnightblue", 0x19, 0x19, 0x70},
+            {"mintcream", 0xf5, 0xff, 0xfa},
+            {"mistyrose", 0xff, 0xe4, 0xe1},
+            {"moccasin", 0xff, 0xe4, 0xb5},
+            {"navajowhite", 0xff, 0xde, 0xad},
+            {"navy", 0x00, 0x00, 0x80},
+            {"oldlace", 0xfd, 0xf5, 0xe6},
+            {"olive", 0x80, 0x80, 0x00},
+            {"olivedrab", 0x6b, 0x8e, 0x23},
+            {"orange", 0xff, 0xa5, 0x00},
+            {"orangered", 0xff, 0x45, 0x00},
+            {"orchid", 0xda, 0x70, 0xd6},
+            {"palegoldenrod", 0xee, 0xe8, 0xaa},
+            {"palegreen", 0x98, 0xfb, 0x98},
+            {"paleturquoise", 0xaf, 0xee, 0xee},
+            {"palevioletred", 0xdb, 0x70, 0x93},
+            {"papayawhip", 0xff, 0xef, 0xd5},
+            {"peachpuff", 0xff, 0xda, 0xb9},
+            {"peru", 0xcd, 0x85, 0x3f},
+            {"pink", 0xff, 0xc0, 0xcb},
+            {"plum", 0xdd, 0xa0, 0xdd},
+            {"powderblue", 0xb0, 0xe0, 0xe6},
+            {"purple", 0x80, 0x00, 0x80},
+            {"rebeccapurple", 0x66, 0x33, 0x99},
+            {"red", 0xff, 0x00, 0x00},
+            {"rosybrown", 0xbc, 0x8f, 0x8f},
+            {"royalblue", 0x41, 0x69, 0xe1},
+            {"saddlebrown", 0x8b, 0x45, 0x13},
+            {"salmon", 0xfa, 0x80, 0x72},
+            {"sandybrown", 0xf4, 0xa4, 0x60},
+            {"seagreen", 0x2e, 0x8b, 0x57},
+            {"seashell", 0xff, 0xf5, 0xee},
+            {"sienna", 0xa0, 0x52, 0x2d},
+            {"silver", 0xc0, 0xc0, 0xc0},
+            {"skyblue", 0x87, 0xce, 0xeb},
+            {"slateblue", 0x6a, 0x5a, 0xcd},
+            {"slategray", 0x70, 0x80, 0x90},
+            {"slategrey", 0x70, 0x80, 0x90},
+            {"snow", 0xff, 0xfa, 0xfa},
+            {"springgreen", 0x00, 0xff, 0x7f},
+            {"steelblue", 0x46, 0x82, 0xb4},
+            {"tan", 0xd2, 0xb4, 0x8c},
+            {"teal", 0x00, 0x80, 0x80},
+            {"thistle", 0xd8, 0xbf, 0xd8},
+            {"tomato", 0xff, 0x63, 0x47},
+            {"turquoise", 0x40, 0xe0, 0xd0},
+            {"violet", 0xee, 0x82, 0xee},
+            {"wheat", 0xf5, 0xde, 0xb3},
+            {"white", 0xff, 0xff, 0xff},
+            {"whitesmoke", 0xf5, 0xf5, 0xf5},
+            {"yellow", 0xff, 0xff, 0x00},
+            {"yellowgreen", 0x9a, 0xcd, 0x32},
+        };
+        constexpr size_t NAMED_COUNT = sizeof(NAMED_COLORS) / sizeof(NAMED_COLORS[0]);
+
+        //! perfect hash of the keywords: FNV-1a started from a seed that was searched so that the 148 names
+        //! land in different slots of a 1024 slot table (the static_assert below checks it)
+        constexpr uint32_t NAME_SEED = 55265;
+        constexpr size_t NAME_SLOTS = 1024;
+
+        constexpr size_t name_hash(std::string_view name) {
+            uint32_t h = NAME_SEED;
+            for (char c : name) {
+                h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+            }
+            h ^= h >> 15;
+            return h % NAME_SLOTS;
+        }
+
+        struct NameTable
+        {
+            uint8_t slots[NAME_SLOTS] = {}; //! index + 1 in NAMED_COLORS, 0 for an empty slot
+            bool collision = false;
+        };
+
+        constexpr NameTable make_name_table() {
+            NameTable table;
+            for (size_t i = 0; i < NAMED_COUNT; i++) {
+                uint8_t &slot = table.slots[name_hash(NAMED_COLORS[i].name)];
+                table.collision = table.collision || slot != 0;
+                slot = static_cast<uint8_t>(i + 1);
+            }
+            return table;
+        }
+
+        constexpr NameTable NAME_TABLE = make_name_table();
+        static_assert(NAMED_COUNT < 255, "the slots store the index in a byte");
+        static_assert(!NAME_TABLE.collision, "two color names have the same name_hash, search another NAME_SEED");
+
+        std::string_view trim(std::string_view s) {
+            while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) {
+                s.remove_prefix(1);
+            }
+            while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) {
+                s.remove_suffix(1);
+            }
+            return s;
+        }
+
+        int hex_digit(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        unsigned char clamp_byte(double v) {
+            return static_cast<unsigned char>(std::lround(std::clamp(v, 0.0, 255.0)));
+        }
+
+        //! reads the next component of a functional color, e.g. "255", "50%" or "120deg"
+        //! the separators can be commas, whitespace or the "/" before the alpha of the CSS4 syntax
+        bool next_component(std::string_view &s, double &value, bool &percent) {
+            skip_separators(s);
+            if (!s.empty() && s.front() == '/') {
+                s.remove_prefix(1);
+            }
+            if (!next_number(s, value)) {
+                return false;
+            }
+            percent = !s.empty() && s.front() == '%';
+            if (percent) {
+                s.remove_prefix(1);
+            }
+            else if (s.size() >= 3 && s.substr(0, 3) == "deg") {
+                s.remove_prefix(3);
+            }
+            return true;
+        }
+
+        //! the arguments of name(...), false if text isn't a call of name
+        bool arguments(std::string_view text, std::string_view name, std::string_view &args) {
+            if (text.size() < name.size() + 2 || text.back() != ')') {
+                return false;
+            }
+            for (size_t i = 0; i < name.size(); i++) {
+                if (std::tolower(static_cast<unsigned char>(text[i])) != name[i]) {
+                    return false;
+                }
+            }
+            std::string_view rest = trim(text.substr(name.size()));
+            if (rest.empty() || rest.front() != '(') {
+                return false;
+            }
+            args = rest.substr(1, rest.size() - 2);
+            return true;
+        }
+
+        bool parse_hex(std::string_view hex, Color &color) {
+            int d[6];
+            if (hex.size() != 3 && hex.size() != 6) {
+                return false;
+            }
+            for (size_t i = 0; i < hex.size(); i++) {
+                if ((d[i] = hex_digit(hex[i])) < 0) {
+                    return false;
+                }
+            }
+            if (hex.size() == 3) {
+                //! #rgb is #rrggbb with every digit repeated
+                color.red = static_cast<unsigned char>(d[0] * 17);
+                color.green = static_cast<unsigned char>(d[1] * 17);
+                color.blue = static_cast<unsigned char>(d[2] * 17);
+            } else {
+                color.red = static_cast<unsigned char>(d[0] * 16 + d[1]);
+                color.green = static_cast<unsigned char>(d[2] * 16 + d[3]);
+                color.blue = static_cast<unsigned char>(d[4] * 16 + d[5]);
+            }
+            return true;
+        }
+
+        //! the optional fourth component, a number in [0, 1] or a percentage
+        bool parse_alpha(std::string_view &args, double &alpha) {
+            double value;
+            bool percent;
+            if (!next_component(args, value, percent)) {
+                return true; //! no alpha
+            }
+            alpha = std::clamp(percent ? value / 100 : value, 0.0, 1.0);
+            skip_separators(args);
+            return args.empty();
+        }
+
+        bool parse_rgb(std::string_view args, Color &color, double &alpha) {
+            double c[3];
+            for (double &v : c) {
+                bool percent;
+                if (!next_component(args, v, percent)) {
+                    return false;
+                }
+                if (percent) {
+                    v = v * 255 / 100;
+                }
+            }
+            color.red = clamp_byte(c[0]);
+            color.green = clamp_byte(c[1]);
+            color.blue = clamp_byte(c[2]);
+            return parse_alpha(args, alpha);
+        }
+
+        double hue_to_rgb(double p, double q, double t) {
+            if (t < 0) t += 1;
+            if (t > 1) t -= 1;
+            if (t < 1.0 / 6) return p + (q - p) * 6 * t;
+            if (t < 1.0 / 2) return q;
+            if (t < 2.0 / 3) return p + (q - p) * (2.0 / 3 - t) * 6;
+            return p;
+        }
+
+        bool parse_hsl(std::string_view args, Color &color, double &alpha) {
+            double h, s, l;
+            bool percent;
+            if (!next_component(args, h, percent) || !next_component(args, s, percent)
+                || !next_component(args, l, percent)) {
+                return false;
+            }
+            h = std::fmod(std::fmod(h, 360) + 360, 360) / 360;
+            s = std::clamp(s / 100, 0.0, 1.0);
+            l = std::clamp(l / 100, 0.0, 1.0);
+            double q = l < 0.5 ? l * (1 + s) : l + s - l * s;
+            double p = 2 * l - q;
+            color.red = clamp_byte(255 * hue_to_rgb(p, q, h + 1.0 / 3));
+            color.green = clamp_byte(255 * hue_to_rgb(p, q, h));
+            color.blue = clamp_byte(255 * hue_to_rgb(p, q, h - 1.0 / 3));
+            return parse_alpha(args, alpha);
+        }
+    }
+
+    bool named_color(std::string_view name, Color &color) {
+        char lower[24];
+        if (name.empty() || name.size() > sizeof(lower)) {
+            return false;
+        }
+        for (size_t i = 0; i < name.size(); i++) {
+            lower[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(name[i])));
+        }
+        std::string_view key(lower, name.size());
+        uint8_t slot = NAME_TABLE.slots[name_hash(key)];
+        if (slot == 0 || NAMED_COLORS[slot - 1].name != key) {
+            return false;
+        }
+        const NamedColor &named = NAMED_COLORS[slot - 1];
+        color.red = named.red;
+        color.green = named.green;
+        color.blue = named.blue;
+        return true;
+    }
+
+    bool parse_color_value(std::string_view text, Color &color, double &alpha) {
+        text = trim(text);
+        alpha = 1;
+        if (text.empty()) {
+            return false;
+        }
+        if (text.front() == '#') {
+            return parse_hex(text.substr(1), color);
+        }
+        std::string_view args;
+        if (arguments(text, "rgba", args) || arguments(text, "rgb", args)) {
+            return parse_rgb(args, color, alpha);
+        }
+        if (arguments(text, "hsla", args) || arguments(text, "hsl", args)) {
+            return parse_hsl(args, color, alpha);
+        }
+        return named_color(text, color);
+    }
+
+    Color ColorCache::resolve(std::string_view text) {
+        double alpha;
+        return resolve(text, alpha);
+    }
+
+    Color ColorCache::resolve(std::string_view text, double &alpha) {
+        Slot *slot = nullptr;
+        if (text.size() <= MAX_KEY) {
+            size_t h = 0;
+            for (char c : text) {
+                h = h * 31 + static_cast<unsigned char>(c);
+            }
+            slot = &slots_[h % SLOTS];
+            if (slot->size == text.size() && std::string_view(slot->key, slot->size) == text) {
+                alpha = slot->alpha;
+                return slot->color;
+            }
+        }
+        Color color;
+        if (!parse_color_value(text, color, alpha)) {
+            //! whatever parse_color does with it (e.g. "none" or a missing attribute)
+            color = parse_color(std::string(text));
+            alpha = 1;
+        }
+        if (slot != nullptr) {
+            slot->size = static_cast<uint8_t>(text.size());
+            std::copy(text.begin(), text.end(), slot->key); //! text.data() is null for a missing attribute
+            slot->color = color;
+            slot->alpha = alpha;
+        }
+        return color;
+    }
+}
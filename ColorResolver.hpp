@@ -0,0 +1,45 @@
+//! @file ColorResolver.hpp
+#ifndef __svg_ColorResolver_hpp__
+#define __svg_ColorResolver_hpp__
+
+#include "Color.hpp"
+#include <cstdint>
+#include <string_view>
+
+namespace svg
+{
+    //! looks up one of the 148 SVG/CSS color keywords (case insensitive), returns false if name isn't one
+    bool named_color(std::string_view name, Color &color);
+
+    //! parses an SVG color: a keyword, #rgb, #rrggbb, rgb(), rgba(), hsl() or hsla()
+    //! (rgb() components can be numbers or percentages); alpha is 1 unless the syntax has one
+    //! returns false for anything else, including "none"
+    bool parse_color_value(std::string_view text, Color &color, double &alpha);
+
+    //! parse_color_value with a small memo in front of it, from the attribute text to the result
+    //! documents repeat the same few colors thousands of times, so almost every lookup is a hit
+    //! the cache is direct mapped (one slot per hash, a miss replaces the slot) and not thread safe:
+    //! each parse has its own
+    class ColorCache
+    {
+    public:
+        //! the color of text; if it isn't a color we know, it is left to parse_color (from Color.hpp)
+        Color resolve(std::string_view text);
+        //! same thing, also giving the alpha of rgba() and hsla()
+        Color resolve(std::string_view text, double &alpha);
+
+    private:
+        static const size_t SLOTS = 64;
+        static const size_t MAX_KEY = 23; //! longer texts are not cached, they are rare
+
+        struct Slot
+        {
+            uint8_t size = 0xff; //! 0xff: empty
+            char key[MAX_KEY];
+            Color color;
+            double alpha;
+        };
+        Slot slots_[SLOTS];
+    };
+}
+#endif
@@ -0,0 +1,436 @@
+#include "CompiledScene.hpp"
+#include "Stats.hpp"
+#include <cmath>
+#include <utility>
+
+namespace svg
+{
+    //! extends the last run if it has the same kind, otherwise starts a new one
+    void CompiledScene::push(Kind kind, size_t index) {
+        uint32_t i = static_cast<uint32_t>(index);
+        if (!order.empty() && order.back().kind == kind && order.back().end == i) {
+            order.back().end = i + 1;
+        } else {
+            order.push_back({kind, i, i + 1});
+        }
+    }
+
+    void CompiledScene::add_ellipse(const Point &center, const Point &radius, double angle, const Color &fill,
+                                    uint8_t alpha) {
+        ellipse_center.push_back(center);
+        ellipse_radius.push_back(radius);
+        ellipse_angle.push_back(angle);
+        ellipse_color.push_back(fill);
+        ellipse_alpha.push_back(alpha);
+        push(ELLIPSE, ellipse_color.size() - 1);
+    }
+
+    void CompiledScene::add_line(const Point &start, const Point &end, const Color &stroke, uint8_t alpha,
+                                 const StrokeStyle &style) {
+        line_start.push_back(start);
+        line_end.push_back(end);
+        line_color.push_back(stroke);
+        line_alpha.push_back(alpha);
+        line_style.push_back(style);
+        push(LINE, line_color.size() - 1);
+    }
+
+    void CompiledScene::add_polyline(const std::vector<Point> &points, const Color &stroke, uint8_t alpha,
+                                     const StrokeStyle &style, bool closed) {
+        polyline_begin.push_back(static_cast<uint32_t>(vertices.size()));
+        vertices.insert(vertices.end(), points.begin(), points.end());
+        polyline_end.push_back(static_cast<uint32_t>(vertices.size()));
+        polyline_color.push_back(stroke);
+        polyline_alpha.push_back(alpha);
+        polyline_style.push_back(style);
+        polyline_closed.push_back(closed);
+        push(POLYLINE, polyline_color.size() - 1);
+    }
+
+    void CompiledScene::add_polygon(const std::vector<Point> &points, const Color &fill, FillRule rule,
+                                    uint8_t alpha) {
+        polygon_begin.push_back(static_cast<uint32_t>(vertices.size()));
+        vertices.insert(vertices.end(), points.begin(), points.end());
+        polygon_end.push_back(static_cast<uint32_t>(vertices.size()));
+        polygon_color.push_back(fill);
+        polygon_alpha.push_back(alpha);
+        polygon_rule.push_back(rule);
+        push(POLYGON, polygon_color.size() - 1);
+    }
+
+    void CompiledScene::add_path(const std::vector<Point> &points, const std::vector<uint32_t> &ends,
+                                 const std::vector<uint8_t> &closed, const Color &fill, FillRule rule, uint8_t fill_alpha,
+                                 const Color &stroke, uint8_t stroke_alpha, const StrokeStyle &style) {
+        path_begin.push_back(static_cast<uint32_t>(vertices.size()));
+        vertices.insert(vertices.end(), points.begin(), points.end());
+        path_end.push_back(static_cast<uint32_t>(vertices.size()));
+        path_contours_begin.push_back(static_cast<uint32_t>(contour_end.size()));
+        contour_end.insert(contour_end.end(), ends.begin(), ends.end());
+        contour_closed.insert(contour_closed.end(), closed.begin(), closed.end());
+        path_contours_end.push_back(static_cast<uint32_t>(contour_end.size()));
+        path_color.push_back(fill);
+        path_alpha.push_back(fill_alpha);
+        path_rule.push_back(rule);
+        path_stroke_color.push_back(stroke);
+        path_stroke_alpha.push_back(stroke_alpha);
+        path_style.push_back(style);
+        push(PATH, path_color.size() - 1);
+    }
+
+    void CompiledScene::add_rect(const Point &corner, const Point &size, const Color &fill, uint8_t alpha) {
+        rect_corner.push_back(corner);
+        rect_size.push_back(size);
+        rect_color.push_back(fill);
+        rect_alpha.push_back(alpha);
+        push(RECT, rect_color.size() - 1);
+    }
+
+    void CompiledScene::add_layer(CompiledScene content, uint8_t alpha, const Point &offset) {
+        Box box = content.unit_bounds();
+        int unit = 1 << subpixel_bits;
+        layer_bounds.push_back({box.x0 + offset.x * unit, box.y0 + offset.y * unit,
+                                box.x1 + offset.x * unit, box.y1 + offset.y * unit});
+        layer_scene.push_back(std::move(content));
+        layer_alpha.push_back(alpha);
+        layer_offset.push_back(offset);
+        push(LAYER, layer_alpha.size() - 1);
+    }
+
+    size_t CompiledScene::size() const {
+        size_t n = ellipse_color.size() + line_color.size() + rect_color.size() + polyline_color.size()
+            + polygon_color.size() + path_color.size();
+        for (const CompiledScene &content : layer_scene) {
+            n += content.size();
+        }
+        return n;
+    }
+
+    //! every coordinate and length is multiplied, the rest of the arrays (colors, runs...) is copied as it is
+    //! a uniform scale keeps rectangles axis aligned and ellipses at the same angle
+    CompiledScene CompiledScene::scaled(double factor) const {
+        CompiledScene out = *this;
+        auto scale = [factor](int v) {return static_cast<int>(std::lround(v * factor));};
+        auto scale_points = [&](std::vector<Point> &points) {
+            for (Point &p : points) {
+                p = {scale(p.x), scale(p.y)};
+            }
+        };
+        auto scale_widths = [factor](std::vector<StrokeStyle> &styles) {
+            for (StrokeStyle &style : styles) {
+                style.width *= factor;
+            }
+        };
+        out.dimensions = {std::max(1, scale(dimensions.x)), std::max(1, scale(dimensions.y))};
+        scale_points(out.ellipse_center);
+        scale_points(out.ellipse_radius);
+        scale_points(out.line_start);
+        scale_points(out.line_end);
+        scale_points(out.vertices);
+        scale_widths(out.line_style);
+        scale_widths(out.polyline_style);
+        scale_widths(out.path_style);
+        //! the far corner is scaled and not the size, so rectangles that touch still touch
+        for (size_t i = 0; i < rect_corner.size(); i++) {
+            const Point &p = rect_corner[i];
+            const Point &size = rect_size[i];
+            out.rect_corner[i] = {scale(p.x), scale(p.y)};
+            out.rect_size[i] = {scale(p.x + size.x) - out.rect_corner[i].x, scale(p.y + size.y) - out.rect_corner[i].y};
+        }
+        int unit = 1 << subpixel_bits;
+        for (size_t i = 0; i < layer_scene.size(); i++) {
+            out.layer_scene[i] = layer_scene[i].scaled(factor);
+            Point offset = {scale(layer_offset[i].x), scale(layer_offset[i].y)};
+            Box box = out.layer_scene[i].unit_bounds();
+            out.layer_offset[i] = offset;
+            out.layer_bounds[i] = {box.x0 + offset.x * unit, box.y0 + offset.y * unit,
+                                   box.x1 + offset.x * unit, box.y1 + offset.y * unit};
+        }
+        return out;
+    }
+
+    void CompiledScene::draw(PNGImage &img) const {
+        draw(img, image_box(img));
+    }
+
+    //! one loop per kind of element, the switch is done once per run and not once per element
+    void CompiledScene::draw(PNGImage &img, const Box &clip) const {
+        StageTimer timer(Stage::raster);
+        if (subpixel_bits != 0) {
+            for (const Run &run : order) {
+                for (uint32_t i = run.begin; i < run.end; i++) {
+                    draw_element(run.kind, i, img, clip);
+                }
+            }
+            return;
+        }
+        for (const Run &run : order) {
+            switch (run.kind) {
+                case ELLIPSE:
+                    for (uint32_t i = run.begin; i < run.end; i++) {
+                        fill_ellipse(img, ellipse_center[i], ellipse_radius[i], ellipse_angle[i], ellipse_color[i], clip, ellipse_alpha[i]);
+                    }
+                    break;
+                case LINE:
+                case POLYLINE:
+                    for (uint32_t i = run.begin; i < run.end; i++) {
+                        draw_stroke(run.kind, i, img, clip, {0, 0});
+                    }
+                    break;
+                case POLYGON:
+                    for (uint32_t i = run.begin; i < run.end; i++) {
+                        fill_polygon(img, vertices.data() + polygon_begin[i], polygon_end[i] - polygon_begin[i],
+                                     polygon_color[i], polygon_rule[i], clip, polygon_alpha[i]);
+                    }
+                    break;
+                case RECT:
+                    for (uint32_t i = run.begin; i < run.end; i++) {
+                        const Point &p = rect_corner[i];
+                        const Point &s = rect_size[i];
+                        fill_rect(img, {p.x, p.y, p.x + s.x, p.y + s.y}, rect_color[i], clip, rect_alpha[i]);
+                    }
+                    break;
+                case PATH:
+                    for (uint32_t i = run.begin; i < run.end; i++) {
+                        draw_path(i, img, clip, {0, 0});
+                    }
+                    break;
+                case LAYER:
+                    for (uint32_t i = run.begin; i < run.end; i++) {
+                        draw_layer(i, img, clip, {0, 0});
+                    }
+                    break;
+            }
+        }
+    }
+
+    //! lines and polylines go through the same stroker, a line is a polyline of two points
+    void CompiledScene::draw_stroke(Kind kind, uint32_t i, PNGImage &img, const Box &clip, const Point &shift) const {
+        if (kind == LINE) {
+            Point ends[2] = {line_start[i], line_end[i]};
+            svg::draw_stroke(img, moved_points(ends, 2, shift), 2, false, line_style[i], line_color[i], clip, line_alpha[i],
+                             subpixel_bits);
+        } else {
+            size_t n = polyline_end[i] - polyline_begin[i];
+            svg::draw_stroke(img, moved_points(vertices.data() + polyline_begin[i], n, shift), n,
+                             polyline_closed[i] != 0, polyline_style[i], polyline_color[i], clip, polyline_alpha[i],
+                             subpixel_bits);
+        }
+    }
+
+    //! the fill of all the contours in one pass, and then their stroke in another
+    void CompiledScene::draw_path(uint32_t i, PNGImage &img, const Box &clip, const Point &shift) const {
+        const Point *points = moved_points(vertices.data() + path_begin[i], path_end[i] - path_begin[i], shift);
+        const uint32_t *ends = contour_end.data() + path_contours_begin[i];
+        size_t n = path_contours_end[i] - path_contours_begin[i];
+        if (path_alpha[i] == 0) {
+            //! fill="none"
+        } else if (subpixel_bits != 0) {
+            fill_contours_aa(img, points, ends, n, subpixel_bits, path_color[i], path_rule[i], clip, path_alpha[i]);
+        } else {
+            fill_contours(img, points, ends, n, 0, path_color[i], path_rule[i], clip, path_alpha[i]);
+        }
+        svg::draw_stroke(img, points, ends, contour_closed.data() + path_contours_begin[i], n, path_style[i],
+                         path_stroke_color[i], clip, path_stroke_alpha[i], subpixel_bits);
+    }
+
+    //! the anti-aliased version of draw_element, for scenes with subpixel coordinates
+    void CompiledScene::draw_element_aa(Kind kind, uint32_t i, PNGImage &img, const Box &clip, const Point &shift) const {
+        int bits = subpixel_bits;
+        switch (kind) {
+            case ELLIPSE: {
+                Point center = {ellipse_center[i].x - shift.x, ellipse_center[i].y - shift.y};
+                fill_ellipse_aa(img, center, ellipse_radius[i], ellipse_angle[i], bits, ellipse_color[i], clip, ellipse_alpha[i]);
+                break;
+            }
+            case LINE:
+            case POLYLINE:
+                draw_stroke(kind, i, img, clip, shift);
+                break;
+            case POLYGON: {
+                size_t n = polygon_end[i] - polygon_begin[i];
+                fill_polygon_aa(img, moved_points(vertices.data() + polygon_begin[i], n, shift), n, bits,
+                                polygon_color[i], polygon_rule[i], clip, polygon_alpha[i]);
+                break;
+            }
+            case RECT: {
+                Point p = {rect_corner[i].x - shift.x, rect_corner[i].y - shift.y};
+                const Point &s = rect_size[i];
+                Point corners[4] = {p, {p.x + s.x, p.y}, {p.x + s.x, p.y + s.y}, {p.x, p.y + s.y}};
+                fill_polygon_aa(img, corners, 4, bits, rect_color[i], FillRule::nonzero, clip, rect_alpha[i]);
+                break;
+            }
+            case PATH:
+                draw_path(i, img, clip, shift);
+                break;
+            case LAYER:
+                break; //! see draw_element
+        }
+    }
+
+    void CompiledScene::draw_element(Kind kind, uint32_t i, PNGImage &img, const Box &clip) const {
+        draw_element(kind, i, img, clip, {0, 0});
+    }
+
+    void CompiledScene::draw_element(Kind kind, uint32_t i, PNGImage &img, const Box &clip, const Point &origin) const {
+        if (kind == LAYER) {
+            draw_layer(i, img, clip, origin);
+            return;
+        }
+        if (subpixel_bits != 0) {
+            int unit = 1 << subpixel_bits;
+            draw_element_aa(kind, i, img, clip, {origin.x * unit, origin.y * unit});
+            return;
+        }
+        switch (kind) {
+            case ELLIPSE: {
+                Point center = {ellipse_center[i].x - origin.x, ellipse_center[i].y - origin.y};
+                fill_ellipse(img, center, ellipse_radius[i], ellipse_angle[i], ellipse_color[i], clip, ellipse_alpha[i]);
+                break;
+            }
+            case LINE:
+            case POLYLINE:
+                draw_stroke(kind, i, img, clip, origin);
+                break;
+            case POLYGON: {
+                size_t n = polygon_end[i] - polygon_begin[i];
+                fill_polygon(img, moved_points(vertices.data() + polygon_begin[i], n, origin), n,
+                             polygon_color[i], polygon_rule[i], clip, polygon_alpha[i]);
+                break;
+            }
+            case RECT: {
+                const Point &p = rect_corner[i];
+                const Point &s = rect_size[i];
+                Box box = {p.x - origin.x, p.y - origin.y, p.x + s.x - origin.x, p.y + s.y - origin.y};
+                fill_rect(img, box, rect_color[i], clip, rect_alpha[i]);
+                break;
+            }
+            case PATH:
+                draw_path(i, img, clip, origin);
+                break;
+            case LAYER:
+                break;
+        }
+    }
+
+    //! the layer is drawn only where it is visible, over black and over white in images of the size of that
+    //! part, and composited: the same as Group::draw and Symbol, and whatever the clip is, since the content
+    //! draws the same pixels in any part of it
+    void CompiledScene::draw_layer(uint32_t i, PNGImage &img, const Box &clip, const Point &origin) const {
+        Box b = bounds(LAYER, i);
+        Box box = Box{b.x0 - origin.x, b.y0 - origin.y, b.x1 - origin.x, b.y1 - origin.y}.intersect(clip).intersect(image_box(img));
+        if (box.empty() || layer_alpha[i] == 0) {
+            return;
+        }
+        int width = box.x1 - box.x0;
+        int height = box.y1 - box.y0;
+        PNGImage black(width, height);
+        PNGImage white(width, height);
+        fill_rect(black, image_box(black), {0, 0, 0}, image_box(black));
+        fill_rect(white, image_box(white), {255, 255, 255}, image_box(white));
+        //! the pixel (0, 0) of the two images is the pixel (box.x0, box.y0) of img, moved back to the content
+        Point corner = {box.x0 + origin.x - layer_offset[i].x, box.y0 + origin.y - layer_offset[i].y};
+        layer_scene[i].draw_content(black, corner);
+        layer_scene[i].draw_content(white, corner);
+        Layer layer;
+        layer.box = box;
+        layer.capture(black, white);
+        layer.composite(img, {0, 0}, layer_alpha[i]);
+    }
+
+    void CompiledScene::draw_content(PNGImage &img, const Point &origin) const {
+        Box clip = image_box(img);
+        Box visible = {origin.x, origin.y, origin.x + clip.x1, origin.y + clip.y1};
+        for (const Run &run : order) {
+            for (uint32_t i = run.begin; i < run.end; i++) {
+                if (bounds(run.kind, i).intersects(visible)) {
+                    draw_element(run.kind, i, img, clip, origin);
+                }
+            }
+        }
+    }
+
+    //! the box around the vertices [begin, end) of the pool
+    static Box vertex_bounds(const std::vector<Point> &vertices, uint32_t begin, uint32_t end) {
+        Box b = {0, 0, 0, 0};
+        if (begin == end) {
+            return b;
+        }
+        b = {vertices[begin].x, vertices[begin].y, vertices[begin].x + 1, vertices[begin].y + 1};
+        for (uint32_t v = begin + 1; v < end; v++) {
+            b.x0 = std::min(b.x0, vertices[v].x);
+            b.y0 = std::min(b.y0, vertices[v].y);
+            b.x1 = std::max(b.x1, vertices[v].x + 1);
+            b.y1 = std::max(b.y1, vertices[v].y + 1);
+        }
+        return b;
+    }
+
+    Box CompiledScene::bounds(Kind kind, uint32_t i) const {
+        if (subpixel_bits != 0) {
+            //! in pixels, with one more on each side for the rounding of the outlines
+            Box b = pixel_box(unit_bounds(kind, i), subpixel_bits);
+            return {b.x0 - 1, b.y0 - 1, b.x1 + 1, b.y1 + 1};
+        }
+        return unit_bounds(kind, i);
+    }
+
+    //! b with room for a stroke that goes reach units away from the points
+    static Box grow(const Box &b, double reach) {
+        int r = static_cast<int>(std::ceil(reach));
+        return {b.x0 - r, b.y0 - r, b.x1 + r, b.y1 + r};
+    }
+
+    Box CompiledScene::unit_bounds(Kind kind, uint32_t i) const {
+        switch (kind) {
+            case ELLIPSE: {
+                //! the largest radius works for any orientation
+                const Point &c = ellipse_center[i];
+                int r = std::max(ellipse_radius[i].x, ellipse_radius[i].y) + 1;
+                return {c.x - r, c.y - r, c.x + r + 1, c.y + r + 1};
+            }
+            case LINE: {
+                const Point &a = line_start[i];
+                const Point &b = line_end[i];
+                Box box = {std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x) + 1, std::max(a.y, b.y) + 1};
+                return grow(box, line_style[i].reach());
+            }
+            case POLYLINE:
+                return grow(vertex_bounds(vertices, polyline_begin[i], polyline_end[i]), polyline_style[i].reach());
+            case POLYGON:
+                return vertex_bounds(vertices, polygon_begin[i], polygon_end[i]);
+            case RECT: {
+                const Point &p = rect_corner[i];
+                const Point &s = rect_size[i];
+                return {p.x, p.y, p.x + s.x, p.y + s.y};
+            }
+            case PATH: {
+                Box box = vertex_bounds(vertices, path_begin[i], path_end[i]);
+                return path_stroke_alpha[i] == 0 ? box : grow(box, path_style[i].reach());
+            }
+            case LAYER:
+                return layer_bounds[i];
+        }
+        return {0, 0, 0, 0};
+    }
+
+    Box CompiledScene::unit_bounds() const {
+        Box box = {0, 0, 0, 0};
+        for (const Run &run : order) {
+            for (uint32_t i = run.begin; i < run.end; i++) {
+                box = box.unite(unit_bounds(run.kind, i));
+            }
+        }
+        return box;
+    }
+
+    CompiledScene compile(const std::vector<SVGElement *> &elements, const Point &dimensions, int subpixel_bits) {
+        StageTimer timer(Stage::build);
+        CompiledScene scene;
+        scene.dimensions = dimensions;
+        scene.subpixel_bits = subpixel_bits;
+        for (const SVGElement *element : elements) {
+            element->compile(scene);
+        }
+        return scene;
+    }
+}
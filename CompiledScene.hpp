@@ -0,0 +1,150 @@
+//! @file CompiledScene.hpp
+#ifndef __svg_CompiledScene_hpp__
+#define __svg_CompiledScene_hpp__
+
+#include "SVGElements.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! a data oriented copy of a list of SVGElements, made for drawing big scenes fast
+    //! instead of one object per element, every kind of element has its own arrays (one per field),
+    //! polylines and polygons share one pool of vertices, and the draw order is kept as runs of
+    //! consecutive elements of the same kind, so draw() is a few tight loops with no virtual calls
+    //! opaque groups are flattened, their children are added in place of the group; a group with opacity
+    //! (and a <use> that is only moved) becomes a layer, a nested scene drawn offscreen and composited,
+    //! exactly like the elements draw themselves, so a scene of whole pixels draws the same pixels as
+    //! its elements
+    class CompiledScene
+    {
+    public:
+        enum Kind : uint8_t { ELLIPSE, LINE, POLYLINE, POLYGON, RECT, PATH, LAYER };
+
+        //! elements [begin, end) of the arrays of kind are drawn one after the other
+        struct Run
+        {
+            Kind kind;
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        //! alpha is the opacity of the element
+        void add_ellipse(const Point &center, const Point &radius, double angle, const Color &fill, uint8_t alpha = 255);
+        void add_line(const Point &start, const Point &end, const Color &stroke, uint8_t alpha = 255,
+                      const StrokeStyle &style = StrokeStyle());
+        //! closed: the outline of a polygon, stroked all the way around
+        void add_polyline(const std::vector<Point> &points, const Color &stroke, uint8_t alpha = 255,
+                          const StrokeStyle &style = StrokeStyle(), bool closed = false);
+        void add_polygon(const std::vector<Point> &points, const Color &fill, FillRule rule = FillRule::nonzero,
+                         uint8_t alpha = 255);
+        //! a path: contours ending at ends (filled together, like the subpaths of a path) and then stroked
+        //! together, the contours i with closed[i] != 0 all the way around; an alpha of 0 skips the fill or the stroke
+        void add_path(const std::vector<Point> &points, const std::vector<uint32_t> &ends, const std::vector<uint8_t> &closed,
+                      const Color &fill, FillRule rule, uint8_t fill_alpha,
+                      const Color &stroke, uint8_t stroke_alpha, const StrokeStyle &style);
+        //! an axis aligned rectangle, corner is the upper left pixel and corner + size - 1 the lower right
+        void add_rect(const Point &corner, const Point &size, const Color &fill, uint8_t alpha = 255);
+        //! content drawn on its own (over black and over white, see Layer) and composited with alpha,
+        //! moved by offset whole pixels; content has the same subpixel_bits as the scene
+        void add_layer(CompiledScene content, uint8_t alpha, const Point &offset = {0, 0});
+
+        //! draws the elements with the rasterizers of Raster.hpp, only touching the pixels inside clip
+        //! the pixels drawn inside clip are the same whatever the clip is, so a scene can be drawn in pieces;
+        //! with subpixel bits that holds for pieces as wide as the image (any rows), since the coverage of
+        //! an edge cut on the left or right of the clip is summed in another order and can round differently
+        void draw(PNGImage &img) const;
+        void draw(PNGImage &img, const Box &clip) const;
+        //! draws just the element index of the arrays of kind
+        void draw_element(Kind kind, uint32_t index, PNGImage &img, const Box &clip) const;
+        //! the pixels that element index of kind can touch
+        Box bounds(Kind kind, uint32_t index) const;
+        size_t size() const; //! the number of (non group) elements, the ones of the layers included
+        //! a copy of the scene made factor times bigger (or smaller), dimensions included, for drawing the same
+        //! document at another resolution without reading it again; the coordinates are rounded to the units,
+        //! so the copy is only as precise as subpixel_bits allows
+        CompiledScene scaled(double factor) const;
+
+        Point dimensions = {0, 0};
+        //! when it isn't 0 the coordinates are in 1/2^subpixel_bits of a pixel (see Scene::subpixel_bits)
+        //! and the elements are drawn anti-aliased with the coverage rasterizers of Raster.hpp
+        int subpixel_bits = 0;
+
+        //! ellipses and circles
+        std::vector<Point> ellipse_center;
+        std::vector<Point> ellipse_radius;
+        std::vector<double> ellipse_angle; //! the same precision as Ellipse, so both draw the same pixels
+        std::vector<Color> ellipse_color;
+        std::vector<uint8_t> ellipse_alpha;
+
+        //! lines
+        std::vector<Point> line_start;
+        std::vector<Point> line_end;
+        std::vector<Color> line_color;
+        std::vector<uint8_t> line_alpha;
+        std::vector<StrokeStyle> line_style;
+
+        //! axis aligned rectangles
+        std::vector<Point> rect_corner;
+        std::vector<Point> rect_size;
+        std::vector<Color> rect_color;
+        std::vector<uint8_t> rect_alpha;
+
+        //! polylines and polygons share one pool of vertices
+        //! polyline i uses vertices [polyline_begin[i], polyline_end[i]), and the same for polygons
+        std::vector<Point> vertices;
+        std::vector<uint32_t> polyline_begin;
+        std::vector<uint32_t> polyline_end;
+        std::vector<Color> polyline_color;
+        std::vector<uint8_t> polyline_alpha;
+        std::vector<StrokeStyle> polyline_style;
+        std::vector<uint8_t> polyline_closed;
+        std::vector<uint32_t> polygon_begin;
+        std::vector<uint32_t> polygon_end;
+        std::vector<Color> polygon_color;
+        std::vector<uint8_t> polygon_alpha;
+        std::vector<FillRule> polygon_rule;
+
+        //! paths also use the pool of vertices, and a pool of contours: path i has the contours
+        //! [path_contours_begin[i], path_contours_end[i]) of contour_end and contour_closed,
+        //! contour_end being relative to path_begin[i]
+        std::vector<uint32_t> path_begin;
+        std::vector<uint32_t> path_end;
+        std::vector<uint32_t> path_contours_begin;
+        std::vector<uint32_t> path_contours_end;
+        std::vector<uint32_t> contour_end;
+        std::vector<uint8_t> contour_closed;
+        std::vector<Color> path_color;
+        std::vector<uint8_t> path_alpha;
+        std::vector<FillRule> path_rule;
+        std::vector<Color> path_stroke_color;
+        std::vector<uint8_t> path_stroke_alpha;
+        std::vector<StrokeStyle> path_style;
+
+        //! layers: layer i is the scene layer_scene[i] moved by layer_offset[i] pixels, layer_bounds[i] is the
+        //! box of its elements (moved, in the units of the coordinates)
+        std::vector<CompiledScene> layer_scene;
+        std::vector<uint8_t> layer_alpha;
+        std::vector<Point> layer_offset;
+        std::vector<Box> layer_bounds;
+
+        std::vector<Run> order;
+
+    private:
+        void push(Kind kind, size_t index);
+        //! the elements are drawn with the pixel (x, y) of the scene at (x - origin.x, y - origin.y) of img
+        //! (shift is origin in the units of the coordinates), like SVGElement::draw
+        void draw_element(Kind kind, uint32_t index, PNGImage &img, const Box &clip, const Point &origin) const;
+        void draw_element_aa(Kind kind, uint32_t index, PNGImage &img, const Box &clip, const Point &shift) const;
+        void draw_stroke(Kind kind, uint32_t index, PNGImage &img, const Box &clip, const Point &shift) const; //! LINE or POLYLINE
+        void draw_path(uint32_t index, PNGImage &img, const Box &clip, const Point &shift) const;
+        void draw_layer(uint32_t index, PNGImage &img, const Box &clip, const Point &origin) const;
+        void draw_content(PNGImage &img, const Point &origin) const; //! every element, for the images of a layer
+        Box unit_bounds(Kind kind, uint32_t index) const; //! bounds() in the units of the coordinates
+        Box unit_bounds() const; //! the box of all the elements, in the units of the coordinates
+    };
+
+    //! builds the compiled form of elements, using their compile() functions
+    CompiledScene compile(const std::vector<SVGElement *> &elements, const Point &dimensions, int subpixel_bits = 0);
+}
+#endif
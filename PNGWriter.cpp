@@ -0,0 +1,540 @@
+#include "PNGWriter.hpp"
+#include "Stats.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace svg
+{
+    namespace
+    {
+        const uint32_t *crc_table() {
+            static uint32_t table[256];
+            static bool ready = false;
+            if (!ready) {
+                for (uint32_t n = 0; n < 256; n++) {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; k++) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    table[n] = c;
+                }
+                ready = true;
+            }
+            return table;
+        }
+
+        uint32_t crc32(uint32_t crc, const unsigned char *data, size_t size) {
+            static const uint32_t *table = crc_table();
+            crc = ~crc;
+            for (size_t i = 0; i < size; i++) {
+                crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+        void put32(unsigned char *p, uint32_t v) {
+            p[0] = static_cast<unsigned char>(v >> 24);
+            p[1] = static_cast<unsigned char>(v >> 16);
+            p[2] = static_cast<unsigned char>(v >> 8);
+            p[3] = static_cast<unsigned char>(v);
+        }
+
+        //! the biggest stored deflate block
+        const size_t MAX_STORED = 65535;
+        //! RGB
+        const size_t BPP = 3;
+
+        //! deflate writes bits starting from the least significant one of each byte
+        class BitWriter
+        {
+        public:
+            explicit BitWriter(std::vector<unsigned char> &out) : out_(out) {}
+            void put(uint32_t bits, int count) {
+                buffer_ |= static_cast<uint64_t>(bits) << used_;
+                used_ += count;
+                while (used_ >= 8) {
+                    out_.push_back(static_cast<unsigned char>(buffer_));
+                    buffer_ >>= 8;
+                    used_ -= 8;
+                }
+            }
+            //! Huffman codes are defined starting from the most significant bit
+            void put_code(uint32_t code, int count) {
+                uint32_t reversed = 0;
+                for (int i = 0; i < count; i++) {
+                    reversed = (reversed << 1) | ((code >> i) & 1);
+                }
+                put(reversed, count);
+            }
+            void align() {
+                if (used_ > 0) {
+                    put(0, 8 - used_);
+                }
+            }
+        private:
+            std::vector<unsigned char> &out_;
+            uint64_t buffer_ = 0;
+            int used_ = 0;
+        };
+
+        //! the fixed Huffman code of a literal or length symbol (RFC 1951, 3.2.6)
+        void put_symbol(BitWriter &bits, int symbol) {
+            if (symbol < 144) {
+                bits.put_code(0x30 + symbol, 8);
+            } else if (symbol < 256) {
+                bits.put_code(0x190 + symbol - 144, 9);
+            } else if (symbol < 280) {
+                bits.put_code(symbol - 256, 7);
+            } else {
+                bits.put_code(0xC0 + symbol - 280, 8);
+            }
+        }
+
+        const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        const int DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        const int DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        void put_match(BitWriter &bits, int length, int distance) {
+            int l = 28;
+            while (LENGTH_BASE[l] > length) {
+                l--;
+            }
+            put_symbol(bits, 257 + l);
+            bits.put(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+            int d = 29;
+            while (DIST_BASE[d] > distance) {
+                d--;
+            }
+            bits.put_code(d, 5);
+            bits.put(distance - DIST_BASE[d], DIST_EXTRA[d]);
+        }
+
+        const int MIN_MATCH = 3;
+        const int MAX_MATCH = 258;
+        const size_t WINDOW = 32768;
+
+        int match_length(const unsigned char *data, size_t size, size_t pos, size_t candidate) {
+            size_t max = std::min<size_t>(MAX_MATCH, size - pos);
+            size_t n = 0;
+            while (n < max && data[candidate + n] == data[pos + n]) {
+                n++;
+            }
+            return static_cast<int>(n);
+        }
+
+        //! level 1: only matches with the previous byte or the previous pixel
+        void deflate_rle(BitWriter &bits, const unsigned char *data, size_t size) {
+            size_t pos = 0;
+            while (pos < size) {
+                int best = 0, distance = 0;
+                for (size_t d : {size_t(1), BPP}) {
+                    if (pos >= d) {
+                        int n = match_length(data, size, pos, pos - d);
+                        if (n > best) {
+                            best = n;
+                            distance = static_cast<int>(d);
+                        }
+                    }
+                }
+                if (best >= MIN_MATCH) {
+                    put_match(bits, best, distance);
+                    pos += best;
+                } else {
+                    put_symbol(bits, data[pos++]);
+                }
+            }
+        }
+
+        //! levels 2 to 9: hash chains over the last 32K, the level decides how many candidates we try
+        void deflate_lz77(BitWriter &bits, const unsigned char *data, size_t size, int level) {
+            const int HASH_BITS = 15;
+            const int max_chain = 1 << (level - 1); //! 2 at level 2, 256 at level 9
+            std::vector<int32_t> head(1 << HASH_BITS, -1);
+            std::vector<int32_t> prev(size, -1);
+            auto hash = [&](size_t p) {
+                uint32_t h = (data[p] << 16) | (data[p + 1] << 8) | data[p + 2];
+                return (h * 2654435761u) >> (32 - HASH_BITS);
+            };
+            auto insert = [&](size_t p) {
+                if (p + MIN_MATCH <= size) {
+                    uint32_t h = hash(p);
+                    prev[p] = head[h];
+                    head[h] = static_cast<int32_t>(p);
+                }
+            };
+
+            size_t pos = 0;
+            while (pos < size) {
+                int best = 0, distance = 0;
+                if (pos + MIN_MATCH <= size) {
+                    int32_t candidate = head[hash(pos)];
+                    for (int chain = 0; candidate >= 0 && chain < max_chain; chain++) {
+                        if (pos - candidate > WINDOW) {
+                            break;
+                        }
+                        int n = match_length(data, size, pos, candidate);
+                        if (n > best) {
+                            best = n;
+                            distance = static_cast<int>(pos - candidate);
+                            if (n == MAX_MATCH) {
+                                break;
+                            }
+                        }
+                        candidate = prev[candidate];
+                    }
+                }
+                if (best >= MIN_MATCH) {
+                    put_match(bits, best, distance);
+                    for (int i = 0; i < best; i++) {
+                        insert(pos + i);
+                    }
+                    pos += best;
+                } else {
+                    insert(pos);
+                    put_symbol(bits, data[pos++]);
+                }
+            }
+        }
+
+        int paeth(int a, int b, int c) {
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc) return a;
+            if (pb <= pc) return b;
+            return c;
+        }
+
+        //! applies filter type to row (prev is the row above), out has the filter byte then the row
+        void apply_filter(int type, const unsigned char *row, const unsigned char *prev, size_t n, unsigned char *out) {
+            out[0] = static_cast<unsigned char>(type);
+            for (size_t i = 0; i < n; i++) {
+                int a = i >= BPP ? row[i - BPP] : 0;
+                int b = prev[i];
+                int c = i >= BPP ? prev[i - BPP] : 0;
+                int predictor = 0;
+                switch (type) {
+                    case 1: predictor = a; break;
+                    case 2: predictor = b; break;
+                    case 3: predictor = (a + b) / 2; break;
+                    case 4: predictor = paeth(a, b, c); break;
+                }
+                out[1 + i] = static_cast<unsigned char>(row[i] - predictor);
+            }
+        }
+
+        //! the usual heuristic: the filter whose output, read as signed bytes, has the smallest sum of absolute values
+        size_t filter_cost(const unsigned char *filtered, size_t n) {
+            size_t sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                sum += std::abs(static_cast<int>(static_cast<signed char>(filtered[i])));
+            }
+            return sum;
+        }
+    }
+
+    std::vector<unsigned char> deflate_chunk(const unsigned char *data, size_t size, int level) {
+        std::vector<unsigned char> out;
+        if (level <= 0) {
+            //! stored blocks
+            size_t offset = 0;
+            while (offset < size) {
+                size_t n = std::min(size - offset, MAX_STORED);
+                out.push_back(0);
+                out.push_back(static_cast<unsigned char>(n));
+                out.push_back(static_cast<unsigned char>(n >> 8));
+                out.push_back(static_cast<unsigned char>(~n));
+                out.push_back(static_cast<unsigned char>(~n >> 8));
+                out.insert(out.end(), data + offset, data + offset + n);
+                offset += n;
+            }
+            return out;
+        }
+        out.reserve(size / 2);
+        BitWriter bits(out);
+        bits.put(0, 1); //! not the final block
+        bits.put(1, 2); //! fixed Huffman codes
+        if (level == 1) {
+            deflate_rle(bits, data, size);
+        } else {
+            deflate_lz77(bits, data, size, std::min(level, 9));
+        }
+        put_symbol(bits, 256); //! end of block
+        //! an empty stored block brings us back to a byte boundary (what zlib calls a sync flush)
+        bits.put(0, 3);
+        bits.align();
+        out.insert(out.end(), {0x00, 0x00, 0xFF, 0xFF});
+        return out;
+    }
+
+    //! threads that live as long as the writer and compress the chunks of every flush, so a big image
+    //! does not start new threads for each batch of chunks
+    class PNGWriter::Workers
+    {
+    public:
+        explicit Workers(unsigned count) {
+            for (unsigned i = 0; i < count; i++) {
+                threads_.emplace_back([this] {loop();});
+            }
+        }
+
+        ~Workers() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            for (std::thread &t : threads_) {
+                t.join();
+            }
+        }
+
+        //! calls task(i) for every i < count, on the workers and on the calling thread, and returns
+        //! when they are all done; rethrows the first exception of a task
+        void run(size_t count, const std::function<void(size_t)> &task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                task_ = &task;
+                count_ = count;
+                next_ = 0;
+                pending_ = count;
+                error_ = nullptr;
+                generation_++;
+            }
+            wake_.notify_all();
+            work();
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [&] {return pending_ == 0;});
+            task_ = nullptr;
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+        }
+
+    private:
+        //! takes the indices of the current task until there are none left
+        void work() {
+            while (true) {
+                size_t i;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (task_ == nullptr || next_ >= count_) {
+                        return;
+                    }
+                    i = next_++;
+                }
+                std::exception_ptr error;
+                try {
+                    (*task_)(i);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (error && !error_) {
+                    error_ = error;
+                }
+                if (--pending_ == 0) {
+                    done_.notify_all();
+                }
+            }
+        }
+
+        void loop() {
+            uint64_t seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [&] {return stop_ || generation_ != seen;});
+                    if (stop_) {
+                        return;
+                    }
+                    seen = generation_;
+                }
+                work();
+            }
+        }
+
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        const std::function<void(size_t)> *task_ = nullptr;
+        size_t count_ = 0;
+        size_t next_ = 0;
+        size_t pending_ = 0;
+        uint64_t generation_ = 0;
+        std::exception_ptr error_;
+        bool stop_ = false;
+    };
+
+    PNGWriter::PNGWriter(int width, int height, Sink sink, const PNGOptions &options)
+        : width_(width), height_(height), sink_(std::move(sink)), options_(options) {
+        if (options_.threads == 0) {
+            options_.threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        size_t row_size = static_cast<size_t>(width) * BPP;
+        previous_.assign(row_size, 0);
+        filtered_.resize(5 * (row_size + 1));
+
+        static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        sink_(signature, sizeof(signature));
+        count(Counter::output_bytes, sizeof(signature));
+
+        unsigned char ihdr[13];
+        put32(ihdr, static_cast<uint32_t>(width));
+        put32(ihdr + 4, static_cast<uint32_t>(height));
+        ihdr[8] = 8;  //! bit depth
+        ihdr[9] = 2;  //! color type RGB
+        ihdr[10] = 0; //! compression
+        ihdr[11] = 0; //! filter method
+        ihdr[12] = 0; //! no interlace
+        write_chunk("IHDR", ihdr, sizeof(ihdr));
+
+        //! zlib header, deflate with a 32K window, no preset dictionary
+        static const unsigned char zlib_header[2] = {0x78, 0x01};
+        write_chunk("IDAT", zlib_header, sizeof(zlib_header));
+    }
+
+    PNGWriter::PNGWriter(int width, int height, const std::string &png_file, const PNGOptions &options)
+        : PNGWriter(width, height, file_sink(png_file), options) {
+    }
+
+    PNGWriter::~PNGWriter() = default;
+
+    PNGWriter::Sink PNGWriter::file_sink(const std::string &png_file) {
+        auto out = std::make_shared<std::ofstream>(png_file, std::ios::binary);
+        if (!*out) {
+            throw std::runtime_error("Unable to write " + png_file);
+        }
+        return [out, png_file](const unsigned char *data, size_t size) {
+            if (size == 0) {
+                out->close();
+            } else {
+                out->write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+            }
+            if (!*out) {
+                throw std::runtime_error("Unable to write " + png_file);
+            }
+        };
+    }
+
+    //! adler32 of the uncompressed stream, the sums are reduced every 5552 bytes,
+    //! the most that can be added before b could overflow 32 bits
+    void PNGWriter::update_adler(const unsigned char *data, size_t size) {
+        while (size > 0) {
+            size_t n = std::min<size_t>(size, 5552);
+            for (size_t i = 0; i < n; i++) {
+                adler_a_ += data[i];
+                adler_b_ += adler_a_;
+            }
+            adler_a_ %= 65521;
+            adler_b_ %= 65521;
+            data += n;
+            size -= n;
+        }
+    }
+
+    void PNGWriter::write_chunk(const char *type, const unsigned char *data, size_t size) {
+        unsigned char header[8];
+        put32(header, static_cast<uint32_t>(size));
+        for (int i = 0; i < 4; i++) {
+            header[4 + i] = static_cast<unsigned char>(type[i]);
+        }
+        uint32_t crc = crc32(0, header + 4, 4);
+        crc = crc32(crc, data, size);
+        unsigned char trailer[4];
+        put32(trailer, crc);
+        sink_(header, sizeof(header));
+        if (size > 0) {
+            sink_(data, size);
+        }
+        sink_(trailer, sizeof(trailer));
+        count(Counter::output_bytes, sizeof(header) + size + sizeof(trailer));
+    }
+
+    //! compresses the pending data in chunks, one per thread, and writes them in order
+    //! unless all is true, we wait until there is a full chunk for every thread
+    void PNGWriter::flush(bool all) {
+        size_t chunk = options_.chunk_size;
+        size_t batch = chunk * options_.threads;
+        while (pending_.size() >= batch || (all && !pending_.empty())) {
+            size_t size = std::min(batch, pending_.size());
+            size_t count = (size + chunk - 1) / chunk;
+            std::vector<std::vector<unsigned char>> out(count);
+            auto compress = [&](size_t i) {
+                size_t begin = i * chunk;
+                size_t n = std::min(chunk, size - begin);
+                out[i] = deflate_chunk(pending_.data() + begin, n, options_.level);
+            };
+            if (count == 1) {
+                compress(0);
+            } else {
+                if (!workers_) {
+                    workers_ = std::make_unique<Workers>(options_.threads - 1);
+                }
+                workers_->run(count, compress);
+            }
+            for (const std::vector<unsigned char> &data : out) {
+                write_chunk("IDAT", data.data(), data.size());
+            }
+            pending_.erase(pending_.begin(), pending_.begin() + size);
+        }
+    }
+
+    void PNGWriter::write_row(const unsigned char *rgb) {
+        if (rows_ >= height_) {
+            throw std::logic_error("PNGWriter: too many rows");
+        }
+        size_t n = static_cast<size_t>(width_) * BPP;
+        const unsigned char *best = nullptr;
+        if (options_.level <= 0) {
+            filtered_[0] = 0;
+            std::copy(rgb, rgb + n, filtered_.begin() + 1);
+            best = filtered_.data();
+        } else {
+            size_t best_cost = 0;
+            for (int type = 0; type < 5; type++) {
+                unsigned char *out = filtered_.data() + type * (n + 1);
+                apply_filter(type, rgb, previous_.data(), n, out);
+                size_t cost = filter_cost(out + 1, n);
+                if (best == nullptr || cost < best_cost) {
+                    best = out;
+                    best_cost = cost;
+                }
+            }
+        }
+        pending_.insert(pending_.end(), best, best + n + 1);
+        update_adler(best, n + 1);
+        std::copy(rgb, rgb + n, previous_.begin());
+        rows_++;
+        flush(false);
+    }
+
+    void PNGWriter::finish() {
+        if (finished_) {
+            return;
+        }
+        if (rows_ != height_) {
+            throw std::logic_error("PNGWriter: missing rows");
+        }
+        flush(true);
+        //! an empty final block with fixed codes, and then the adler32 that ends the zlib stream
+        unsigned char end[6] = {0x03, 0x00};
+        put32(end + 2, (adler_b_ << 16) | adler_a_);
+        write_chunk("IDAT", end, sizeof(end));
+        write_chunk("IEND", nullptr, 0);
+        finished_ = true;
+        sink_(nullptr, 0);
+    }
+}
@@ -0,0 +1,79 @@
+//! @file PNGWriter.hpp
+#ifndef __svg_PNGWriter_hpp__
+#define __svg_PNGWriter_hpp__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! how the PNG data is compressed
+    struct PNGOptions
+    {
+        //! 0: no compression at all (stored blocks), the fastest
+        //! 1: only runs of repeated bytes and pixels (RLE), very fast and good for flat images
+        //! 2 to 9: LZ77 with longer and longer searches, slower but smaller
+        int level = 6;
+        //! how many threads compress in parallel; the data is cut in chunks compressed independently
+        //! (like pigz), which costs a little in size since a chunk can't refer to the previous one
+        unsigned threads = 1;
+        size_t chunk_size = 256 * 1024; //! uncompressed bytes per chunk
+    };
+
+    //! writes an 8 bit RGB PNG one row at a time, the bytes are handed to a sink as soon as they are ready,
+    //! so the whole image never has to be in memory
+    //! every row is filtered with the PNG filter that makes it smallest (except at level 0, which uses none)
+    class PNGWriter
+    {
+    public:
+        //! receives the encoded bytes, in order; finish() ends with a call of size 0, where a sink that
+        //! buffers can flush and report a failure by throwing
+        using Sink = std::function<void(const unsigned char *data, size_t size)>;
+
+        PNGWriter(int width, int height, Sink sink, const PNGOptions &options = PNGOptions());
+        //! opens png_file and writes to it, throws if the file can't be opened
+        PNGWriter(int width, int height, const std::string &png_file, const PNGOptions &options = PNGOptions());
+        //! a sink that writes to png_file and closes it at the end of the data, it throws if a write
+        //! or the close fails
+        static Sink file_sink(const std::string &png_file);
+        ~PNGWriter();
+        PNGWriter(const PNGWriter &) = delete;
+        PNGWriter &operator=(const PNGWriter &) = delete;
+
+        //! rgb has width * 3 bytes, rows must be written from top to bottom
+        void write_row(const unsigned char *rgb);
+        //! writes the end of the file, must be called after the last row
+        void finish();
+
+        int width() const {return width_;}
+        int height() const {return height_;}
+
+    private:
+        class Workers;
+
+        void write_chunk(const char *type, const unsigned char *data, size_t size);
+        void flush(bool all);
+        void update_adler(const unsigned char *data, size_t size);
+
+        int width_;
+        int height_;
+        int rows_ = 0;
+        bool finished_ = false;
+        Sink sink_;
+        PNGOptions options_;
+        std::vector<unsigned char> pending_;  //! filtered rows not compressed yet
+        std::vector<unsigned char> previous_; //! the previous row, unfiltered, for the Up, Average and Paeth filters
+        std::vector<unsigned char> filtered_; //! scratch rows for trying the filters
+        uint32_t adler_a_ = 1, adler_b_ = 0; //! running adler32 of the uncompressed data
+        std::unique_ptr<Workers> workers_;   //! the threads that compress chunks with this one, started by the first flush that needs them
+    };
+
+    //! compresses data as a sequence of non final deflate blocks that ends on a byte boundary,
+    //! so the outputs of consecutive chunks can simply be concatenated
+    std::vector<unsigned char> deflate_chunk(const unsigned char *data, size_t size, int level);
+}
+#endif
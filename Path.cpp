@@ -0,0 +1,314 @@
+#include "Path.hpp"
+#include "SVGAttributes.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace svg
+{
+    namespace
+    {
+        //! the flags of an arc are one character, "a1 1 0 01 5 5" is valid so they can't be read as numbers
+        bool next_flag(std::string_view &s, bool &flag) {
+            skip_separators(s);
+            if (s.empty() || (s[0] != '0' && s[0] != '1')) {
+                return false;
+            }
+            flag = s[0] == '1';
+            s.remove_prefix(1);
+            return true;
+        }
+
+        bool next_point(std::string_view &s, const PathPoint &base, PathPoint &p) {
+            double x, y;
+            if (!next_number(s, x) || !next_number(s, y)) {
+                return false;
+            }
+            p = {base.x + x, base.y + y};
+            return true;
+        }
+
+        bool is_command(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        }
+
+        //! appends the verbs of a path, with its points multiplied by scale
+        struct PathWriter
+        {
+            PathData &out;
+            double scale;
+
+            void add(PathVerb verb, std::initializer_list<PathPoint> points) {
+                out.verbs.push_back(verb);
+                for (const PathPoint &p : points) {
+                    out.points.push_back({p.x * scale, p.y * scale});
+                }
+            }
+
+            //! the elliptical arc from the current point "from" to "to" as cubics of at most 90 degrees,
+            //! with the endpoint to center conversion of the SVG implementation notes (F.6.5)
+            void arc(PathPoint from, double rx, double ry, double degrees, bool large, bool sweep, PathPoint to) {
+                if (from.x == to.x && from.y == to.y) {
+                    return;
+                }
+                rx = std::fabs(rx);
+                ry = std::fabs(ry);
+                if (rx == 0 || ry == 0) {
+                    add(PathVerb::line, {to});
+                    return;
+                }
+                double phi = degrees * M_PI / 180;
+                double cos_phi = std::cos(phi), sin_phi = std::sin(phi);
+                double dx = (from.x - to.x) / 2, dy = (from.y - to.y) / 2;
+                double x1 = cos_phi * dx + sin_phi * dy;
+                double y1 = -sin_phi * dx + cos_phi * dy;
+                //! radii too small to reach the end point are scaled up just enough
+                double lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+                if (lambda > 1) {
+                    rx *= std::sqrt(lambda);
+                    ry *= std::sqrt(lambda);
+                }
+                double num = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+                double den = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+                double coef = std::sqrt(std::max(0.0, num / den)) * (large == sweep ? -1 : 1);
+                double cx1 = coef * rx * y1 / ry;
+                double cy1 = -coef * ry * x1 / rx;
+                double cx = cos_phi * cx1 - sin_phi * cy1 + (from.x + to.x) / 2;
+                double cy = sin_phi * cx1 + cos_phi * cy1 + (from.y + to.y) / 2;
+                double start = std::atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+                double delta = std::atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx) - start;
+                if (sweep && delta < 0) {
+                    delta += 2 * M_PI;
+                } else if (!sweep && delta > 0) {
+                    delta -= 2 * M_PI;
+                }
+                int n = std::max(1, static_cast<int>(std::ceil(std::fabs(delta) / (M_PI / 2) - 1e-9)));
+                double step = delta / n;
+                double k = 4.0 / 3.0 * std::tan(step / 4); //! the length of the handles of a cubic arc
+                //! a point of the unit circle, mapped to the ellipse
+                auto map = [&](double x, double y) {
+                    return PathPoint{cx + rx * x * cos_phi - ry * y * sin_phi, cy + rx * x * sin_phi + ry * y * cos_phi};
+                };
+                for (int i = 0; i < n; i++) {
+                    double t0 = start + step * i, t1 = t0 + step;
+                    double c0 = std::cos(t0), s0 = std::sin(t0), c1 = std::cos(t1), s1 = std::sin(t1);
+                    PathPoint end = i == n - 1 ? to : map(c1, s1);
+                    add(PathVerb::cubic, {map(c0 - k * s0, s0 + k * c0), map(c1 + k * s1, s1 - k * c1), end});
+                }
+            }
+        };
+
+        PathPoint lerp(const PathPoint &a, const PathPoint &b, double t) {
+            return {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t};
+        }
+
+        //! the length of the second difference p0 - 2 p1 + p2, which bounds how much a curve bends
+        double second_difference(const PathPoint &p0, const PathPoint &p1, const PathPoint &p2) {
+            return std::hypot(p0.x - 2 * p1.x + p2.x, p0.y - 2 * p1.y + p2.y);
+        }
+
+        //! Wang's formula: n segments keep a Bézier of degree d within tolerance when
+        //! n >= sqrt(d (d - 1) / 8 * M / tolerance), M being the largest second difference
+        int segments(double factor, double m, double tolerance) {
+            double n = std::ceil(std::sqrt(factor * m / tolerance));
+            return static_cast<int>(std::clamp(n, 1.0, 1024.0));
+        }
+    }
+
+    void PathData::transform(const Transform &m) {
+        for (PathPoint &p : points) {
+            p = {m.a * p.x + m.c * p.y + m.e, m.b * p.x + m.d * p.y + m.f};
+        }
+    }
+
+    //! one command (or one repetition of the last command) per turn of the loop; the state is
+    //! the current point, the start of the subpath and the control point that S and T reflect
+    void parse_path(std::string_view d, PathData &out, double scale) {
+        //! a command with its coordinates takes at least 4 characters ("L1 2" or "l1,2")
+        out.verbs.reserve(out.verbs.size() + d.size() / 4 + 1);
+        out.points.reserve(out.points.size() + d.size() / 3 + 1);
+        PathWriter writer = {out, scale};
+        PathPoint current = {0, 0}, start = {0, 0}, control = {0, 0};
+        char command = 0;
+        char last_curve = 0; //! 'C' or 'Q' when the last command left a control point to reflect
+        bool need_move = false; //! after z, a drawing command starts a new subpath at the same start point
+        while (true) {
+            skip_separators(d);
+            if (d.empty()) {
+                return;
+            }
+            if (is_command(d[0])) {
+                command = d[0];
+                d.remove_prefix(1);
+            } else if (command == 0 || command == 'z' || command == 'Z') {
+                return; //! a number where a command is needed
+            }
+            char upper = static_cast<char>(command & ~0x20);
+            PathPoint base = (command & 0x20) ? current : PathPoint{0, 0}; //! lower case: relative
+            if (upper == 'Z') {
+                if (need_move || out.empty()) {
+                    continue; //! nothing to close
+                }
+                writer.add(PathVerb::close, {});
+                current = start;
+                need_move = true;
+                last_curve = 0;
+                continue;
+            }
+            if (upper != 'M') {
+                if (out.empty()) {
+                    return; //! a path has to start with a moveto
+                }
+                if (need_move) {
+                    writer.add(PathVerb::move, {start});
+                    need_move = false;
+                }
+            }
+            char curve = 0;
+            switch (upper) {
+                case 'M': {
+                    PathPoint p;
+                    if (!next_point(d, base, p)) {
+                        return;
+                    }
+                    writer.add(PathVerb::move, {p});
+                    current = start = p;
+                    need_move = false;
+                    command = command == 'm' ? 'l' : 'L'; //! the next pairs of numbers are linetos
+                    break;
+                }
+                case 'L': {
+                    PathPoint p;
+                    if (!next_point(d, base, p)) {
+                        return;
+                    }
+                    writer.add(PathVerb::line, {p});
+                    current = p;
+                    break;
+                }
+                case 'H':
+                case 'V': {
+                    double v;
+                    if (!next_number(d, v)) {
+                        return;
+                    }
+                    PathPoint p = current;
+                    (upper == 'H' ? p.x : p.y) = v + (upper == 'H' ? base.x : base.y);
+                    writer.add(PathVerb::line, {p});
+                    current = p;
+                    break;
+                }
+                case 'C':
+                case 'S': {
+                    PathPoint c1, c2, p;
+                    if (upper == 'S') {
+                        c1 = last_curve == 'C' ? PathPoint{2 * current.x - control.x, 2 * current.y - control.y} : current;
+                    } else if (!next_point(d, base, c1)) {
+                        return;
+                    }
+                    if (!next_point(d, base, c2) || !next_point(d, base, p)) {
+                        return;
+                    }
+                    writer.add(PathVerb::cubic, {c1, c2, p});
+                    control = c2;
+                    current = p;
+                    curve = 'C';
+                    break;
+                }
+                case 'Q':
+                case 'T': {
+                    PathPoint c, p;
+                    if (upper == 'T') {
+                        c = last_curve == 'Q' ? PathPoint{2 * current.x - control.x, 2 * current.y - control.y} : current;
+                    } else if (!next_point(d, base, c)) {
+                        return;
+                    }
+                    if (!next_point(d, base, p)) {
+                        return;
+                    }
+                    writer.add(PathVerb::quad, {c, p});
+                    control = c;
+                    current = p;
+                    curve = 'Q';
+                    break;
+                }
+                case 'A': {
+                    double rx, ry, angle;
+                    bool large, sweep;
+                    PathPoint p;
+                    if (!next_number(d, rx) || !next_number(d, ry) || !next_number(d, angle)
+                        || !next_flag(d, large) || !next_flag(d, sweep) || !next_point(d, base, p)) {
+                        return;
+                    }
+                    writer.arc(current, rx, ry, angle, large, sweep, p);
+                    current = p;
+                    break;
+                }
+                default:
+                    return; //! not a path command
+            }
+            last_curve = curve;
+        }
+    }
+
+    void flatten_path(const PathData &data, double tolerance, FlatPath &out) {
+        const PathPoint *p = data.points.data();
+        PathPoint current = {0, 0};
+        //! ends the contour being built, if it has any point
+        auto end_contour = [&](bool closed) {
+            uint32_t begin = out.ends.empty() ? 0 : out.ends.back();
+            if (out.points.size() > begin) {
+                out.ends.push_back(static_cast<uint32_t>(out.points.size()));
+                out.closed.push_back(closed);
+            }
+        };
+        for (PathVerb verb : data.verbs) {
+            switch (verb) {
+                case PathVerb::move:
+                    end_contour(false);
+                    out.points.push_back(*p);
+                    current = *p++;
+                    break;
+                case PathVerb::line:
+                    out.points.push_back(*p);
+                    current = *p++;
+                    break;
+                case PathVerb::quad: {
+                    int n = segments(0.25, second_difference(current, p[0], p[1]), tolerance);
+                    for (int i = 1; i < n; i++) {
+                        double t = static_cast<double>(i) / n;
+                        out.points.push_back(lerp(lerp(current, p[0], t), lerp(p[0], p[1], t), t));
+                    }
+                    out.points.push_back(p[1]);
+                    current = p[1];
+                    p += 2;
+                    break;
+                }
+                case PathVerb::cubic: {
+                    double m = std::max(second_difference(current, p[0], p[1]), second_difference(p[0], p[1], p[2]));
+                    int n = segments(0.75, m, tolerance);
+                    for (int i = 1; i < n; i++) {
+                        double t = static_cast<double>(i) / n;
+                        double u = 1 - t;
+                        double a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t, e = t * t * t;
+                        out.points.push_back({a * current.x + b * p[0].x + c * p[1].x + e * p[2].x,
+                                              a * current.y + b * p[0].y + c * p[1].y + e * p[2].y});
+                    }
+                    out.points.push_back(p[2]);
+                    current = p[2];
+                    p += 3;
+                    break;
+                }
+                case PathVerb::close:
+                    end_contour(true);
+                    break;
+            }
+        }
+        end_contour(false);
+    }
+
+    double max_stretch(const Transform &m) {
+        double s = m.a * m.a + m.b * m.b + m.c * m.c + m.d * m.d;
+        double det = m.a * m.d - m.b * m.c;
+        return std::sqrt((s + std::sqrt(std::max(0.0, s * s - 4 * det * det))) / 2);
+    }
+}
@@ -0,0 +1,66 @@
+//! @file Path.hpp
+#ifndef __svg_Path_hpp__
+#define __svg_Path_hpp__
+
+#include "Point.hpp"
+#include "Transform.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace svg
+{
+    //! a point of a path, in doubles so that the control points survive any number of transformations
+    struct PathPoint
+    {
+        double x, y;
+    };
+
+    //! what a path is made of once parsed: every command of the d attribute becomes one of these
+    //! (H and V are lines, S and T are curves with their reflected control point, arcs are cubics)
+    enum class PathVerb : uint8_t
+    {
+        move,  //! 1 point, starts a subpath
+        line,  //! 1 point
+        quad,  //! 2 points, the control point and the end
+        cubic, //! 3 points, the two control points and the end
+        close  //! no point, back to the start of the subpath
+    };
+
+    //! the geometry of a path: the verbs, and their points one after the other
+    struct PathData
+    {
+        std::vector<PathVerb> verbs;
+        std::vector<PathPoint> points;
+
+        bool empty() const {return verbs.empty();}
+        void transform(const Transform &m); //! applies m to every point, Béziers stay exact
+    };
+
+    //! parses the d attribute of a path, coordinates are multiplied by scale (see parse_points)
+    //! the text is read in place, with no token strings and no allocation besides the two vectors of out,
+    //! which are reserved once from the length of d
+    //! like the SVG error handling, everything up to the first error is kept
+    void parse_path(std::string_view d, PathData &out, double scale = 1);
+
+    //! the polylines of a path: the contours of the flattened subpaths, stored one after the other
+    struct FlatPath
+    {
+        std::vector<PathPoint> points;
+        std::vector<uint32_t> ends;   //! contour i ends at ends[i] (exclusive)
+        std::vector<uint8_t> closed;  //! 1 if contour i was closed by z
+
+        void clear() {points.clear(); ends.clear(); closed.clear();}
+    };
+
+    //! replaces the curves of data by segments, no point of a segment is further than tolerance
+    //! from the curve (in the units of the points)
+    //! the number of segments of each curve comes from its control points (Wang's formula), so flat
+    //! curves get one or two segments and tight ones as many as they need
+    void flatten_path(const PathData &data, double tolerance, FlatPath &out);
+
+    //! how much m can stretch a length (the largest singular value of its 2x2 part)
+    double max_stretch(const Transform &m);
+}
+#endif
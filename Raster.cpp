@@ -0,0 +1,742 @@
+#include "Raster.hpp"
+#include "Stats.hpp"
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SVG_RASTER_X86
+#endif
+
+namespace svg
+{
+    Box image_box(const PNGImage &img) {
+        return {0, 0, img.width(), img.height()};
+    }
+
+    const Point *moved_points(const Point *points, size_t count, const Point &origin) {
+        if (origin.x == 0 && origin.y == 0) {
+            return points;
+        }
+        thread_local std::vector<Point> buffer;
+        buffer.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            buffer[i] = {points[i].x - origin.x, points[i].y - origin.y};
+        }
+        return buffer.data();
+    }
+
+    //! x / 255 rounded to the nearest integer, for x up to 255 * 255
+    static inline unsigned div255(unsigned x) {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    void blend_pixel(Color &dst, const Color &color, uint8_t alpha) {
+        unsigned a = alpha;
+        unsigned b = 255 - a;
+        dst.red = static_cast<unsigned char>(div255(color.red * a + dst.red * b));
+        dst.green = static_cast<unsigned char>(div255(color.green * a + dst.green * b));
+        dst.blue = static_cast<unsigned char>(div255(color.blue * a + dst.blue * b));
+    }
+
+    uint8_t multiply_alpha(uint8_t a, uint8_t b) {
+        return static_cast<uint8_t>(div255(static_cast<unsigned>(a) * b));
+    }
+
+    //! the blend kernels work on the bytes of a span as one array (r, g, b, r, g, b, ...), every byte
+    //! becomes div255(source * alpha + byte * (255 - alpha)); the source repeats every 3 bytes, so the
+    //! kernels keep 3 vectors of it and do 3 vectors of bytes (16 or 32 pixels) per iteration
+    static void blend_bytes_scalar(unsigned char *p, size_t n, const unsigned char *source, unsigned alpha) {
+        unsigned keep = 255 - alpha;
+        for (size_t i = 0; i < n; i++) {
+            p[i] = static_cast<unsigned char>(div255(source[i % 3] * alpha + p[i] * keep));
+        }
+    }
+
+#ifdef SVG_RASTER_X86
+    //! div255 of eight 16 bit lanes
+    static inline __m128i div255_sse2(__m128i x) {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    static void blend_bytes_sse2(unsigned char *p, size_t n, const unsigned char *source, unsigned alpha) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i keep = _mm_set1_epi16(static_cast<short>(255 - alpha));
+        //! source * alpha, for the low and high half of each of the 3 vectors of the pattern
+        __m128i premultiplied[3][2];
+        for (int k = 0; k < 3; k++) {
+            unsigned char pattern[16];
+            for (int i = 0; i < 16; i++) {
+                pattern[i] = source[(16 * k + i) % 3];
+            }
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+            __m128i a = _mm_set1_epi16(static_cast<short>(alpha));
+            premultiplied[k][0] = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), a);
+            premultiplied[k][1] = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), a);
+        }
+        size_t i = 0;
+        for (; i + 48 <= n; i += 48) {
+            for (int k = 0; k < 3; k++) {
+                __m128i *q = reinterpret_cast<__m128i *>(p + i + 16 * k);
+                __m128i d = _mm_loadu_si128(q);
+                __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), keep), premultiplied[k][0]);
+                __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), keep), premultiplied[k][1]);
+                _mm_storeu_si128(q, _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi)));
+            }
+        }
+        blend_bytes_scalar(p + i, n - i, source, alpha);
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256i div255_avx2(__m256i x) {
+        x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    }
+
+    //! the unpacks and the pack work inside each 128 bit half, but they are applied the same way to the
+    //! pattern and to the pixels, so every byte still meets its own source byte
+    __attribute__((target("avx2")))
+    static void blend_bytes_avx2(unsigned char *p, size_t n, const unsigned char *source, unsigned alpha) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i keep = _mm256_set1_epi16(static_cast<short>(255 - alpha));
+        __m256i premultiplied[3][2];
+        for (int k = 0; k < 3; k++) {
+            unsigned char pattern[32];
+            for (int i = 0; i < 32; i++) {
+                pattern[i] = source[(32 * k + i) % 3];
+            }
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern));
+            __m256i a = _mm256_set1_epi16(static_cast<short>(alpha));
+            premultiplied[k][0] = _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), a);
+            premultiplied[k][1] = _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), a);
+        }
+        size_t i = 0;
+        for (; i + 96 <= n; i += 96) {
+            for (int k = 0; k < 3; k++) {
+                __m256i *q = reinterpret_cast<__m256i *>(p + i + 32 * k);
+                __m256i d = _mm256_loadu_si256(q);
+                __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), keep), premultiplied[k][0]);
+                __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), keep), premultiplied[k][1]);
+                _mm256_storeu_si256(q, _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi)));
+            }
+        }
+        blend_bytes_sse2(p + i, n - i, source, alpha);
+    }
+#endif
+
+    using BlendKernel = void (*)(unsigned char *, size_t, const unsigned char *, unsigned);
+
+    static BlendKernel select_blend_kernel() {
+#ifdef SVG_RASTER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return blend_bytes_avx2;
+        }
+        return blend_bytes_sse2;
+#else
+        return blend_bytes_scalar;
+#endif
+    }
+
+    //! the pixels of a row are contiguous in the image, so a span is a single fill (or a single blend)
+    void fill_span(PNGImage &img, int y, int x0, int x1, const Color &color, uint8_t alpha) {
+        if (x0 >= x1 || alpha == 0) {
+            return;
+        }
+        count(Counter::pixels, static_cast<uint64_t>(x1 - x0));
+        Color *row = &img.at(x0, y);
+        if (alpha == 255) {
+            std::fill(row, row + (x1 - x0), color);
+            return;
+        }
+        if constexpr (sizeof(Color) == 3) {
+            static const BlendKernel kernel = select_blend_kernel();
+            const unsigned char source[3] = {color.red, color.green, color.blue};
+            kernel(reinterpret_cast<unsigned char *>(row), 3 * static_cast<size_t>(x1 - x0), source, alpha);
+        } else {
+            for (Color *p = row; p != row + (x1 - x0); ++p) {
+                blend_pixel(*p, color, alpha);
+            }
+        }
+    }
+
+    void fill_rect(PNGImage &img, const Box &rect, const Color &color, const Box &clip, uint8_t alpha) {
+        Box r = rect.intersect(clip);
+        if (r.empty()) {
+            return;
+        }
+        for (int y = r.y0; y < r.y1; y++) {
+            fill_span(img, y, r.x0, r.x1, color, alpha);
+        }
+    }
+
+    namespace
+    {
+        //! a non horizontal edge, going down from row first to row last (exclusive)
+        struct Edge
+        {
+            int first;
+            int last;
+            int64_t x;     //! x where the edge crosses the center of the current row, 16.16 fixed point
+            int64_t slope; //! how much x changes from one row to the next, 16.16
+            int winding;   //! +1 if the edge goes down in the contour, -1 if it goes up
+        };
+
+        const int64_t ONE = 1 << 16;
+
+        //! the points are in 1/2^bits of a pixel (bits <= 16)
+        void add_edges(std::vector<Edge> &edges, const Point *points, size_t count, int bits = 0) {
+            int shift = 16 - bits;
+            svg::count(Counter::vertices, count);
+            for (size_t i = 0; i < count; i++) {
+                Point a = points[i];
+                Point b = points[(i + 1) % count];
+                int winding = 1;
+                if (a.y == b.y) {
+                    continue; //! horizontal edges never cross a row center
+                }
+                if (a.y > b.y) {
+                    std::swap(a, b);
+                    winding = -1;
+                }
+                int64_t ax = static_cast<int64_t>(a.x) * (1 << shift), ay = static_cast<int64_t>(a.y) * (1 << shift);
+                int64_t bx = static_cast<int64_t>(b.x) * (1 << shift), by = static_cast<int64_t>(b.y) * (1 << shift);
+                //! the row centers are at y + 0.5, the edge crosses the rows whose center is in [a.y, b.y)
+                //! (for whole pixels, rows a.y to b.y - 1)
+                Edge e;
+                e.first = static_cast<int>((ay - ONE / 2 + ONE - 1) >> 16);
+                e.last = static_cast<int>((by - ONE / 2 + ONE - 1) >> 16);
+                if (e.first >= e.last) {
+                    continue;
+                }
+                e.slope = ((bx - ax) * ONE) / (by - ay);
+                e.x = ax + e.slope * (static_cast<int64_t>(e.first) * ONE + ONE / 2 - ay) / ONE;
+                e.winding = winding;
+                edges.push_back(e);
+            }
+        }
+
+        //! the first pixel whose center is at or after the fixed point x
+        int first_pixel(int64_t x) {
+            return static_cast<int>((x - ONE / 2 + ONE - 1) >> 16);
+        }
+    }
+
+    //! fills the polygon made of edges (the edge table, not sorted yet)
+    static void fill_edges(PNGImage &img, std::vector<Edge> &edges,
+                           const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        if (edges.empty() || clip.empty()) {
+            return;
+        }
+        std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {return a.first < b.first;});
+
+        int y = std::max(edges.front().first, clip.y0);
+        size_t next = 0;
+        std::vector<Edge> active;
+        while (y < clip.y1 && (next < edges.size() || !active.empty())) {
+            //! edges that started above the clip are moved to the current row
+            while (next < edges.size() && edges[next].first <= y) {
+                Edge e = edges[next++];
+                if (e.last > y) {
+                    e.x += e.slope * (y - e.first);
+                    active.push_back(e);
+                }
+            }
+            if (active.empty()) {
+                if (next >= edges.size()) {
+                    break;
+                }
+                y = std::max(edges[next].first, clip.y0); //! skip the empty rows
+                continue;
+            }
+
+            //! the list stays almost sorted from one row to the next, so insertion sort is linear in practice
+            for (size_t i = 1; i < active.size(); i++) {
+                Edge e = active[i];
+                size_t j = i;
+                while (j > 0 && active[j - 1].x > e.x) {
+                    active[j] = active[j - 1];
+                    j--;
+                }
+                active[j] = e;
+            }
+
+            //! walk the crossings from left to right, keeping the winding number
+            int winding = 0;
+            for (size_t i = 0; i + 1 < active.size(); i++) {
+                winding += active[i].winding;
+                bool inside = rule == FillRule::nonzero ? winding != 0 : (winding & 1) != 0;
+                if (inside) {
+                    int x0 = std::max(first_pixel(active[i].x), clip.x0);
+                    int x1 = std::min(first_pixel(active[i + 1].x), clip.x1);
+                    fill_span(img, y, x0, x1, color, alpha);
+                }
+            }
+
+            //! step to the next row and drop the edges that end here
+            y++;
+            size_t kept = 0;
+            for (size_t i = 0; i < active.size(); i++) {
+                if (active[i].last > y) {
+                    active[i].x += active[i].slope;
+                    active[kept++] = active[i];
+                }
+            }
+            active.resize(kept);
+        }
+    }
+
+    void fill_polygon(PNGImage &img, const std::vector<Point> *contours, size_t n,
+                      const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        std::vector<Edge> edges;
+        for (size_t c = 0; c < n; c++) {
+            if (contours[c].size() >= 3) {
+                add_edges(edges, contours[c].data(), contours[c].size());
+            }
+        }
+        fill_edges(img, edges, color, rule, clip, alpha);
+    }
+
+    void fill_polygon(PNGImage &img, const std::vector<Point> &points,
+                      const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        fill_polygon(img, points.data(), points.size(), color, rule, clip, alpha);
+    }
+
+    void fill_polygon(PNGImage &img, const Point *points, size_t count,
+                      const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        std::vector<Edge> edges;
+        if (count >= 3) {
+            add_edges(edges, points, count);
+        }
+        fill_edges(img, edges, color, rule, clip, alpha);
+    }
+
+    void fill_contours(PNGImage &img, const Point *points, const uint32_t *ends, size_t n, int bits,
+                       const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        std::vector<Edge> edges;
+        uint32_t begin = 0;
+        for (size_t c = 0; c < n; c++) {
+            if (ends[c] - begin >= 3) {
+                add_edges(edges, points + begin, ends[c] - begin, bits);
+            }
+            begin = ends[c];
+        }
+        fill_edges(img, edges, color, rule, clip, alpha);
+    }
+
+    //! the polygon used for ellipses that are not aligned with the axes
+    static std::vector<Point> ellipse_polygon(const Point &center, const Point &radius, double angle) {
+        double s = std::sin(angle * M_PI / 180.0);
+        double c = std::cos(angle * M_PI / 180.0);
+        int n = std::max(16, static_cast<int>(M_PI * std::max(radius.x, radius.y)));
+        std::vector<Point> points;
+        points.reserve(n);
+        for (int i = 0; i < n; i++) {
+            double t = 2 * M_PI * i / n;
+            double x = radius.x * std::cos(t);
+            double y = radius.y * std::sin(t);
+            points.push_back({center.x + static_cast<int>(std::lround(c * x - s * y)),
+                              center.y + static_cast<int>(std::lround(s * x + c * y))});
+        }
+        return points;
+    }
+
+    void fill_ellipse(PNGImage &img, const Point &center, const Point &radius, double angle,
+                      const Color &color, const Box &clip, uint8_t alpha) {
+        Point r = radius;
+        if (std::fabs(std::remainder(angle, 90.0)) > 1e-6) {
+            fill_polygon(img, ellipse_polygon(center, radius, angle), color, FillRule::nonzero, clip, alpha);
+            return;
+        }
+        if (std::fabs(std::remainder(angle, 180.0)) > 45.0) {
+            r = {radius.y, radius.x}; //! rotated by 90 or 270 degrees, the radii swap
+        }
+        if (r.x <= 0 || r.y <= 0) {
+            return;
+        }
+        int y0 = std::max(center.y - r.y, clip.y0);
+        int y1 = std::min(center.y + r.y + 1, clip.y1);
+        for (int y = y0; y < y1; y++) {
+            double dy = static_cast<double>(y - center.y) / r.y;
+            double half = r.x * std::sqrt(std::max(0.0, 1 - dy * dy));
+            //! only the offsets from the center are rounded, so the pixels don't depend on where the
+            //! ellipse is on the canvas (a region or a layer draws it moved)
+            int x0 = std::max(center.x - static_cast<int>(std::floor(half)), clip.x0);
+            int x1 = std::min(center.x + static_cast<int>(std::floor(half)) + 1, clip.x1);
+            fill_span(img, y, x0, x1, color, alpha);
+        }
+    }
+
+    //! n / d rounded to the nearest integer (halves go up), for any signs
+    static int64_t round_div(int64_t n, int64_t d) {
+        if (d < 0) {
+            n = -n;
+            d = -d;
+        }
+        int64_t q = 2 * n + d;
+        int64_t r = q / (2 * d);
+        if (q % (2 * d) != 0 && q < 0) {
+            r--; //! C++ division truncates, we want the floor
+        }
+        return r;
+    }
+
+    //! one pixel of a line, opaque or blended
+    static inline void plot(PNGImage &img, int x, int y, const Color &color, uint8_t alpha) {
+        count(Counter::pixels, 1);
+        if (alpha == 255) {
+            img.at(x, y) = color;
+        } else {
+            blend_pixel(img.at(x, y), color, alpha);
+        }
+    }
+
+    void plot_line(PNGImage &img, const Point &a, const Point &b, const Color &color, const Box &clip,
+                   uint8_t alpha) {
+        if (alpha == 0) {
+            return;
+        }
+        int64_t dx = b.x - a.x;
+        int64_t dy = b.y - a.y;
+        if (dx == 0 && dy == 0) {
+            if (a.x >= clip.x0 && a.x < clip.x1 && a.y >= clip.y0 && a.y < clip.y1) {
+                plot(img, a.x, a.y, color, alpha);
+            }
+            return;
+        }
+        if (std::llabs(dx) >= std::llabs(dy)) {
+            //! one pixel per column
+            int x0 = std::max(std::min(a.x, b.x), clip.x0);
+            int x1 = std::min(std::max(a.x, b.x), clip.x1 - 1);
+            for (int x = x0; x <= x1; x++) {
+                int64_t y = a.y + round_div(dy * (x - a.x), dx);
+                if (y >= clip.y0 && y < clip.y1) {
+                    plot(img, x, static_cast<int>(y), color, alpha);
+                }
+            }
+        } else {
+            //! one pixel per row
+            int y0 = std::max(std::min(a.y, b.y), clip.y0);
+            int y1 = std::min(std::max(a.y, b.y), clip.y1 - 1);
+            for (int y = y0; y <= y1; y++) {
+                int64_t x = a.x + round_div(dx * (y - a.y), dy);
+                if (x >= clip.x0 && x < clip.x1) {
+                    plot(img, static_cast<int>(x), y, color, alpha);
+                }
+            }
+        }
+    }
+
+    void Layer::capture(const PNGImage &over_black, const PNGImage &over_white) {
+        int width = box.x1 - box.x0;
+        int height = box.y1 - box.y0;
+        color.resize(static_cast<size_t>(width) * height);
+        alpha.resize(color.size());
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                const Color &b = over_black.at(x, y);
+                const Color &w = over_white.at(x, y);
+                size_t i = static_cast<size_t>(y) * width + x;
+                //! over black a pixel is c * a, over white c * a + 255 * (1 - a), so w - b = 255 * (1 - a)
+                //! (the three channels give the same value up to rounding, the largest one is used)
+                int through = std::max({w.red - b.red, w.green - b.green, w.blue - b.blue, 0});
+                color[i] = b;
+                alpha[i] = static_cast<uint8_t>(255 - std::min(through, 255));
+            }
+        }
+    }
+
+    void Layer::composite(PNGImage &img, const Point &offset, uint8_t opacity) const {
+        Box target = {box.x0 + offset.x, box.y0 + offset.y, box.x1 + offset.x, box.y1 + offset.y};
+        Box visible = target.intersect(image_box(img));
+        if (visible.empty() || opacity == 0) {
+            return;
+        }
+        int width = box.x1 - box.x0;
+        uint64_t written = 0;
+        for (int y = visible.y0; y < visible.y1; y++) {
+            size_t row = static_cast<size_t>(y - target.y0) * width - target.x0;
+            Color *out = &img.at(0, y);
+            for (int x = visible.x0; x < visible.x1; x++) {
+                uint8_t a = alpha[row + x];
+                if (a == 0) {
+                    continue;
+                }
+                written++;
+                const Color &c = color[row + x];
+                if (a == 255 && opacity == 255) {
+                    out[x] = c; //! the usual case, an opaque pixel is just copied
+                    continue;
+                }
+                //! c is already multiplied by a: out = c * opacity + out * (1 - a * opacity)
+                unsigned keep = 255 - multiply_alpha(a, opacity);
+                Color &d = out[x];
+                d.red = static_cast<unsigned char>(div255(c.red * opacity + d.red * keep));
+                d.green = static_cast<unsigned char>(div255(c.green * opacity + d.green * keep));
+                d.blue = static_cast<unsigned char>(div255(c.blue * opacity + d.blue * keep));
+            }
+        }
+        count(Counter::pixels, written);
+    }
+
+    Box pixel_box(const Box &units, int bits) {
+        if (bits == 0 || units.empty()) {
+            return units;
+        }
+        int one = 1 << bits;
+        //! >> rounds down also for negative numbers
+        return {units.x0 >> bits, units.y0 >> bits, (units.x1 + one - 1) >> bits, (units.y1 + one - 1) >> bits};
+    }
+
+    namespace
+    {
+        //! the accumulation buffer of the anti-aliased rasterizer, for the pixels of box
+        //! every row has two more cells than the box is wide, for the area that spills past the last pixel
+        struct Coverage
+        {
+            Box box;
+            int top;    //! the first row of the whole shape, the y of the coordinates starts there
+            int stride;
+            std::vector<float> cells;
+
+            //! b is the part of the shape that is drawn, whole the pixels of the whole shape
+            void reset(const Box &b, const Box &whole) {
+                box = b;
+                top = whole.y0;
+                stride = b.x1 - b.x0 + 2;
+                cells.assign(static_cast<size_t>(stride) * (b.y1 - b.y0), 0.0f);
+            }
+
+            //! adds the signed area between the segment and the right side of the box, row by row
+            //! (x is in pixels relative to the box, inside [0, width], and y relative to top)
+            //! the x where the segment enters and leaves every row is computed from its start instead of
+            //! stepping from the first row of the box, so a row gets the same values whatever rows the
+            //! box has, and x is clamped to [0, width] again since the product can round past the sides
+            void line(double x0, double y0, double x1, double y1) {
+                if (y0 == y1) {
+                    return;
+                }
+                double dir = 1;
+                if (y0 > y1) {
+                    std::swap(x0, x1);
+                    std::swap(y0, y1);
+                    dir = -1;
+                }
+                int first_row = box.y0 - top;
+                double width = box.x1 - box.x0;
+                double dxdy = (x1 - x0) / (y1 - y0);
+                int first = std::max(first_row, static_cast<int>(std::floor(y0)));
+                int last = std::min(box.y1 - top, static_cast<int>(std::ceil(y1)));
+                for (int y = first; y < last; y++) {
+                    float *row = cells.data() + static_cast<size_t>(y - first_row) * stride;
+                    double ya = std::max(static_cast<double>(y), y0);
+                    double yb = std::min(static_cast<double>(y + 1), y1);
+                    double x = std::clamp(ya == y0 ? x0 : x0 + dxdy * (ya - y0), 0.0, width);
+                    double xnext = std::clamp(yb == y1 ? x1 : x0 + dxdy * (yb - y0), 0.0, width);
+                    double d = (yb - ya) * dir;
+                    double left = std::min(x, xnext);
+                    double right = std::max(x, xnext);
+                    int left_cell = static_cast<int>(std::floor(left));
+                    int right_cell = static_cast<int>(std::ceil(right));
+                    if (right_cell <= left_cell + 1) {
+                        //! the segment stays in one pixel of the row
+                        double middle = 0.5 * (x + xnext) - left_cell;
+                        row[left_cell] += static_cast<float>(d - d * middle);
+                        row[left_cell + 1] += static_cast<float>(d * middle);
+                    } else {
+                        //! it crosses several pixels: a triangle in the first, trapezoids in the middle
+                        //! and a triangle in the last
+                        double inv = 1 / (right - left);
+                        double left_frac = left - left_cell;
+                        double a0 = 0.5 * inv * (1 - left_frac) * (1 - left_frac);
+                        double right_frac = right - right_cell + 1;
+                        double am = 0.5 * inv * right_frac * right_frac;
+                        row[left_cell] += static_cast<float>(d * a0);
+                        if (right_cell == left_cell + 2) {
+                            row[left_cell + 1] += static_cast<float>(d * (1 - a0 - am));
+                        } else {
+                            double a1 = inv * (1.5 - left_frac);
+                            row[left_cell + 1] += static_cast<float>(d * (a1 - a0));
+                            for (int c = left_cell + 2; c < right_cell - 1; c++) {
+                                row[c] += static_cast<float>(d * inv);
+                            }
+                            double a2 = a1 + (right_cell - left_cell - 3) * inv;
+                            row[right_cell - 1] += static_cast<float>(d * (1 - a2 - am));
+                        }
+                        row[right_cell] += static_cast<float>(d * am);
+                    }
+                }
+            }
+
+            //! adds the segment a-b (in 1/2^bits pixels), cut at the left and right sides of the box:
+            //! what is outside becomes a vertical segment on the side, which covers the pixels inside
+            //! exactly like the original part did
+            void edge(const Point &a, const Point &b, double scale) {
+                double ax = a.x * scale - box.x0, ay = a.y * scale - top;
+                double bx = b.x * scale - box.x0, by = b.y * scale - top;
+                double width = box.x1 - box.x0;
+                double cuts[4] = {0, 1, 1, 1};
+                int n = 1;
+                for (double side : {0.0, width}) {
+                    if ((ax < side) != (bx < side)) {
+                        cuts[n++] = (side - ax) / (bx - ax);
+                    }
+                }
+                cuts[n++] = 1;
+                //! 0 and 1 are already at the ends, only the two cuts between them can be out of order
+                if (n == 4 && cuts[2] < cuts[1]) {
+                    std::swap(cuts[1], cuts[2]);
+                }
+                for (int i = 0; i + 1 < n; i++) {
+                    double t0 = cuts[i], t1 = cuts[i + 1];
+                    double x0 = std::clamp(ax + (bx - ax) * t0, 0.0, width);
+                    double x1 = std::clamp(ax + (bx - ax) * t1, 0.0, width);
+                    line(x0, ay + (by - ay) * t0, x1, ay + (by - ay) * t1);
+                }
+            }
+
+            void contour(const Point *points, size_t count, double scale) {
+                svg::count(Counter::vertices, count);
+                for (size_t i = 0; i < count; i++) {
+                    edge(points[i], points[(i + 1) % count], scale);
+                }
+            }
+
+            //! the running sum of every row gives the coverage of each pixel, which is turned into alpha
+            void composite(PNGImage &img, const Color &color, FillRule rule, uint8_t alpha) const {
+                int width = box.x1 - box.x0;
+                uint64_t blended = 0; //! the partly covered pixels, the full ones are counted by fill_span
+                for (int y = 0; y < box.y1 - box.y0; y++) {
+                    const float *row = cells.data() + static_cast<size_t>(y) * stride;
+                    double sum = 0;
+                    int run = -1; //! start of the current run of fully covered pixels
+                    for (int x = 0; x <= width; x++) {
+                        double c = 0;
+                        if (x < width) {
+                            sum += row[x];
+                            c = std::fabs(sum);
+                            if (rule == FillRule::evenodd) {
+                                c = std::fmod(c, 2.0);
+                                c = c > 1 ? 2 - c : c;
+                            }
+                        }
+                        unsigned coverage = static_cast<unsigned>(std::lround(std::min(c, 1.0) * 255));
+                        if (coverage == 255) {
+                            if (run < 0) {
+                                run = x;
+                            }
+                            continue;
+                        }
+                        if (run >= 0) {
+                            fill_span(img, box.y0 + y, box.x0 + run, box.x0 + x, color, alpha);
+                            run = -1;
+                        }
+                        if (coverage != 0 && x < width) {
+                            blend_pixel(img.at(box.x0 + x, box.y0 + y), color, multiply_alpha(static_cast<uint8_t>(coverage), alpha));
+                            blended++;
+                        }
+                    }
+                }
+                count(Counter::pixels, blended);
+            }
+        };
+
+        //! one buffer per thread, reused from one element to the next
+        Coverage &coverage_buffer() {
+            thread_local Coverage coverage;
+            return coverage;
+        }
+
+        Box contours_box(const std::vector<Point> *contours, size_t n) {
+            Box b = {0, 0, 0, 0};
+            for (size_t c = 0; c < n; c++) {
+                for (const Point &p : contours[c]) {
+                    b = b.unite({p.x, p.y, p.x + 1, p.y + 1});
+                }
+            }
+            return b;
+        }
+    }
+
+    void fill_polygon_aa(PNGImage &img, const std::vector<Point> *contours, size_t n, int bits,
+                         const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        Box whole = pixel_box(contours_box(contours, n), bits);
+        Box box = whole.intersect(clip);
+        if (box.empty() || alpha == 0) {
+            return;
+        }
+        Coverage &coverage = coverage_buffer();
+        coverage.reset(box, whole);
+        double scale = 1.0 / (1 << bits);
+        for (size_t c = 0; c < n; c++) {
+            if (contours[c].size() >= 3) {
+                coverage.contour(contours[c].data(), contours[c].size(), scale);
+            }
+        }
+        coverage.composite(img, color, rule, alpha);
+    }
+
+    void fill_contours_aa(PNGImage &img, const Point *points, const uint32_t *ends, size_t n, int bits,
+                          const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        Box units = {0, 0, 0, 0};
+        size_t count = n == 0 ? 0 : ends[n - 1];
+        for (size_t i = 0; i < count; i++) {
+            units = units.unite({points[i].x, points[i].y, points[i].x + 1, points[i].y + 1});
+        }
+        Box whole = pixel_box(units, bits);
+        Box box = whole.intersect(clip);
+        if (box.empty() || alpha == 0) {
+            return;
+        }
+        Coverage &coverage = coverage_buffer();
+        coverage.reset(box, whole);
+        double scale = 1.0 / (1 << bits);
+        uint32_t begin = 0;
+        for (size_t c = 0; c < n; c++) {
+            if (ends[c] - begin >= 3) {
+                coverage.contour(points + begin, ends[c] - begin, scale);
+            }
+            begin = ends[c];
+        }
+        coverage.composite(img, color, rule, alpha);
+    }
+
+    void fill_polygon_aa(PNGImage &img, const Point *points, size_t count, int bits,
+                         const Color &color, FillRule rule, const Box &clip, uint8_t alpha) {
+        Box units = {0, 0, 0, 0};
+        for (size_t i = 0; i < count; i++) {
+            units = units.unite({points[i].x, points[i].y, points[i].x + 1, points[i].y + 1});
+        }
+        Box whole = pixel_box(units, bits);
+        Box box = whole.intersect(clip);
+        if (box.empty() || count < 3 || alpha == 0) {
+            return;
+        }
+        Coverage &coverage = coverage_buffer();
+        coverage.reset(box, whole);
+        coverage.contour(points, count, 1.0 / (1 << bits));
+        coverage.composite(img, color, rule, alpha);
+    }
+
+    void fill_ellipse_aa(PNGImage &img, const Point &center, const Point &radius, double angle, int bits,
+                         const Color &color, const Box &clip, uint8_t alpha) {
+        //! enough points for the polygon to be within a small part of a pixel of the curve
+        double s = std::sin(angle * M_PI / 180.0);
+        double c = std::cos(angle * M_PI / 180.0);
+        double pixels = std::max(radius.x, radius.y) / static_cast<double>(1 << bits);
+        int n = std::max(16, static_cast<int>(2 * M_PI * std::sqrt(pixels * 8)));
+        std::vector<Point> points;
+        points.reserve(n);
+        for (int i = 0; i < n; i++) {
+            double t = 2 * M_PI * i / n;
+            double x = radius.x * std::cos(t);
+            double y = radius.y * std::sin(t);
+            points.push_back({center.x + static_cast<int>(std::lround(c * x - s * y)),
+                              center.y + static_cast<int>(std::lround(s * x + c * y))});
+        }
+        fill_polygon_aa(img, points.data(), points.size(), bits, color, FillRule::nonzero, clip, alpha);
+    }
+}
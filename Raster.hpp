@@ -0,0 +1,125 @@
+//! @file Raster.hpp
+#ifndef __svg_Raster_hpp__
+#define __svg_Raster_hpp__
+
+#include "Color.hpp"
+#include "Point.hpp"
+#include "PNGImage.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! a rectangle of pixels, [x0, x1) x [y0, y1), used for clipping and bounding boxes
+    struct Box
+    {
+        int x0, y0, x1, y1;
+
+        bool empty() const {return x0 >= x1 || y0 >= y1;}
+        bool intersects(const Box &o) const {return x0 < o.x1 && o.x0 < x1 && y0 < o.y1 && o.y0 < y1;}
+        Box intersect(const Box &o) const {
+            return {std::max(x0, o.x0), std::max(y0, o.y0), std::min(x1, o.x1), std::min(y1, o.y1)};
+        }
+        Box unite(const Box &o) const {
+            if (empty()) return o;
+            if (o.empty()) return *this;
+            return {std::min(x0, o.x0), std::min(y0, o.y0), std::max(x1, o.x1), std::max(y1, o.y1)};
+        }
+    };
+
+    //! the whole image as a Box
+    Box image_box(const PNGImage &img);
+
+    //! the points moved by -origin, to draw a part of a document in a smaller image without changing the shapes:
+    //! points itself when origin is (0, 0), otherwise a copy in a buffer of the calling thread that is valid
+    //! until the next call on that thread
+    const Point *moved_points(const Point *points, size_t count, const Point &origin);
+
+    //! the fill-rule SVG property, decides which parts of a self intersecting polygon are inside
+    enum class FillRule
+    {
+        nonzero,
+        evenodd
+    };
+
+    //! all the rasterizers take the opacity of what they draw as alpha (0 transparent, 255 opaque)
+    //! and composite it over the image with source-over; an opaque span is a plain fill, the others
+    //! go through a blend kernel that does 16 (SSE2) or 32 (AVX2) pixels at a time
+
+    //! fills the pixels [x0, x1) of row y (already clipped by the caller)
+    void fill_span(PNGImage &img, int y, int x0, int x1, const Color &color, uint8_t alpha = 255);
+
+    //! source-over of color with alpha on one pixel
+    void blend_pixel(Color &dst, const Color &color, uint8_t alpha);
+
+    //! fills an axis aligned rectangle, without any edge processing
+    void fill_rect(PNGImage &img, const Box &rect, const Color &color, const Box &clip, uint8_t alpha = 255);
+
+    //! scanline polygon filling: the edges are sorted by their first row (edge table), and for every row
+    //! the edges that cross it (active edge list) are stepped in 16.16 fixed point and sorted by x
+    //! a pixel is inside when its center is inside the polygon according to rule
+    //! contours is an array of n closed contours that are filled together (e.g. a shape with holes)
+    void fill_polygon(PNGImage &img, const std::vector<Point> *contours, size_t n,
+                      const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+    void fill_polygon(PNGImage &img, const std::vector<Point> &points,
+                      const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+    //! same thing for a contour given as a pointer and a number of points (e.g. a range of a vertex pool)
+    void fill_polygon(PNGImage &img, const Point *points, size_t count,
+                      const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+
+    //! n contours stored one after the other in points, contour i ends at ends[i] (exclusive), filled together
+    //! the coordinates are in 1/2^bits of a pixel (up to 16), with the same pixel center sampling
+    void fill_contours(PNGImage &img, const Point *points, const uint32_t *ends, size_t n, int bits,
+                       const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+
+    //! fills an ellipse whose x radius makes angle degrees with the x axis
+    //! a pixel is inside when ((x - cx) / rx)^2 + ((y - cy) / ry)^2 <= 1 (after undoing the rotation)
+    void fill_ellipse(PNGImage &img, const Point &center, const Point &radius, double angle,
+                      const Color &color, const Box &clip, uint8_t alpha = 255);
+
+    //! a one pixel wide line from a to b; the y (or x) of every pixel is computed directly from its x (or y)
+    //! instead of accumulating an error like Bresenham, so the pixels that are drawn don't depend on the clip
+    //! and drawing a line tile by tile gives the same image as drawing it at once
+    void plot_line(PNGImage &img, const Point &a, const Point &b, const Color &color, const Box &clip,
+                   uint8_t alpha = 255);
+
+    //! anti-aliased versions, for coordinates in 1/2^bits of a pixel (e.g. bits = 8 for 24.8 fixed point)
+    //! the edges are accumulated with their exact area in a buffer of one float per pixel, and a running
+    //! sum along every row gives how much of each pixel is covered (as in font rasterizers), so there is
+    //! no supersampling; the coverage is the alpha of the pixel, and fully covered runs are filled as spans
+    //! the nonzero rule is exact where contours don't overlap with opposite directions, evenodd folds the sum
+    //! the rows drawn are the same whatever rows clip has; a clip that cuts the shape on the left or right
+    //! sums the coverage in another order, so the pixels can differ by one level from the unclipped ones
+    void fill_polygon_aa(PNGImage &img, const std::vector<Point> *contours, size_t n, int bits,
+                         const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+    void fill_polygon_aa(PNGImage &img, const Point *points, size_t count, int bits,
+                         const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+    void fill_contours_aa(PNGImage &img, const Point *points, const uint32_t *ends, size_t n, int bits,
+                          const Color &color, FillRule rule, const Box &clip, uint8_t alpha = 255);
+    void fill_ellipse_aa(PNGImage &img, const Point &center, const Point &radius, double angle, int bits,
+                         const Color &color, const Box &clip, uint8_t alpha = 255);
+    //! the pixels a box in 1/2^bits pixel units can touch
+    Box pixel_box(const Box &units, int bits);
+
+    //! 255 * (a / 255) * (b / 255), rounded: the alpha of something with alpha a inside something with alpha b
+    uint8_t multiply_alpha(uint8_t a, uint8_t b);
+
+    //! a layer is something drawn in an offscreen image before being composited (a group with opacity,
+    //! the cached raster of a <use>): it is drawn twice, over black and over white, and for every pixel
+    //! the difference between the two gives how much of the background shows through it, so the layer
+    //! keeps its own alpha without the images having an alpha channel
+    struct Layer
+    {
+        Box box = {0, 0, 0, 0};       //! where the layer goes in the image it is composited on
+        std::vector<Color> color;     //! the pixels over black, i.e. the colors multiplied by their alpha
+        std::vector<uint8_t> alpha;   //! 0 where nothing was drawn, 255 where it is opaque
+
+        //! builds the layer from the two images (of the size of box)
+        void capture(const PNGImage &over_black, const PNGImage &over_white);
+        //! composites the layer moved by offset over img, with the extra opacity opacity
+        void composite(PNGImage &img, const Point &offset, uint8_t opacity = 255) const;
+    };
+}
+#endif
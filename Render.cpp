@@ -0,0 +1,367 @@
+#include "Render.hpp"
+#include "Scene.hpp"
+#include "PNGWriter.hpp"
+#include "Stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace svg
+{
+    namespace
+    {
+        //! one element of the scene, as stored in the tile lists
+        struct ElementRef
+        {
+            CompiledScene::Kind kind;
+            uint32_t index;
+        };
+    }
+
+    void write_png(const PNGImage &img, PNGWriter &writer) {
+        StageTimer timer(Stage::encode);
+        std::vector<unsigned char> row(static_cast<size_t>(img.width()) * 3);
+        for (int y = 0; y < img.height(); y++) {
+            for (int x = 0; x < img.width(); x++) {
+                const Color &c = img.at(x, y);
+                row[3 * x] = c.red;
+                row[3 * x + 1] = c.green;
+                row[3 * x + 2] = c.blue;
+            }
+            writer.write_row(row.data());
+        }
+        writer.finish();
+    }
+
+    RenderedImage encode(const PNGImage &img, OutputFormat format, const PNGOptions &png_options) {
+        RenderedImage out;
+        out.width = img.width();
+        out.height = img.height();
+        out.format = format;
+        std::vector<unsigned char> &data = out.data;
+        size_t pixels = static_cast<size_t>(out.width) * out.height;
+        switch (format) {
+            case OutputFormat::RGBA: {
+                StageTimer timer(Stage::encode);
+                data.reserve(pixels * 4);
+                for (int y = 0; y < out.height; y++) {
+                    for (int x = 0; x < out.width; x++) {
+                        const Color &c = img.at(x, y);
+                        data.insert(data.end(), {c.red, c.green, c.blue, 255});
+                    }
+                }
+                count(Counter::output_bytes, data.size());
+                break;
+            }
+            case OutputFormat::PPM: {
+                StageTimer timer(Stage::encode);
+                std::string header = "P6\n" + std::to_string(out.width) + " " + std::to_string(out.height) + "\n255\n";
+                data.reserve(header.size() + pixels * 3);
+                data.insert(data.end(), header.begin(), header.end());
+                for (int y = 0; y < out.height; y++) {
+                    for (int x = 0; x < out.width; x++) {
+                        const Color &c = img.at(x, y);
+                        data.insert(data.end(), {c.red, c.green, c.blue});
+                    }
+                }
+                count(Counter::output_bytes, data.size());
+                break;
+            }
+            case OutputFormat::PNG: { //! write_png times the encoding and PNGWriter counts the bytes
+                PNGWriter writer(out.width, out.height, [&data](const unsigned char *bytes, size_t size) {
+                    data.insert(data.end(), bytes, bytes + size);
+                }, png_options);
+                write_png(img, writer);
+                break;
+            }
+        }
+        return out;
+    }
+
+    RenderedImage convert(std::string_view svg_text, OutputFormat format, const PNGOptions &png_options,
+                          ConvertStats *stats) {
+        StatsCollector collector;
+        StatsScope scope(stats != nullptr ? &collector : nullptr);
+        RenderedImage out;
+        {
+            Scene scene;
+            parseSVG(svg_text, scene);
+            PNGImage img(scene.dimensions.x, scene.dimensions.y);
+            render(scene.elements, img);
+            out = encode(img, format, png_options);
+        }
+        if (stats != nullptr) {
+            *stats = collector.stats();
+        }
+        return out;
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file, ConvertStats &stats,
+                 const PNGOptions &png_options) {
+        StatsCollector collector;
+        {
+            StatsScope scope(&collector);
+            Scene scene;
+            readSVG(svg_file, scene);
+            PNGImage img(scene.dimensions.x, scene.dimensions.y);
+            render(scene.elements, img);
+            PNGWriter writer(img.width(), img.height(), png_file, png_options);
+            write_png(img, writer);
+        }
+        stats = collector.stats();
+    }
+
+    void render(const std::vector<SVGElement *> &elements, PNGImage &img) {
+        StageTimer timer(Stage::raster);
+        Box canvas = image_box(img);
+        for (const SVGElement *element : elements) {
+            if (element->bounds().intersects(canvas)) {
+                element->draw(img);
+            }
+        }
+    }
+
+    void render_region(const std::vector<SVGElement *> &elements, const Box &region, PNGImage &out) {
+        StageTimer timer(Stage::raster);
+        Point origin = {region.x0, region.y0};
+        for (const SVGElement *element : elements) {
+            if (element->bounds().intersects(region)) {
+                element->draw(out, origin);
+            }
+        }
+    }
+
+    void convert_region(const std::string &svg_file, const std::string &png_file, const Box &region) {
+        if (region.empty()) {
+            throw std::runtime_error("Invalid region " + std::to_string(region.x0) + " " + std::to_string(region.y0) +
+                                     " " + std::to_string(region.x1) + " " + std::to_string(region.y1));
+        }
+        Scene scene;
+        readSVG(svg_file, scene);
+        PNGImage img(region.x1 - region.x0, region.y1 - region.y0);
+        render_region(scene.elements, region, img);
+        img.save(png_file);
+    }
+
+    void convert_strips(const std::string &svg_file, const std::string &png_file, int strip_height,
+                        const PNGOptions &png_options) {
+        if (strip_height <= 0) {
+            throw std::runtime_error("Invalid strip height " + std::to_string(strip_height));
+        }
+        Scene scene;
+        readSVG(svg_file, scene);
+        int width = scene.dimensions.x;
+        int height = scene.dimensions.y;
+        PNGWriter writer(width, height, png_file, png_options);
+
+        //! the elements sorted by the first row they touch; the active ones are kept in document order
+        std::vector<Box> boxes;
+        std::vector<size_t> by_top(scene.elements.size());
+        for (size_t i = 0; i < scene.elements.size(); i++) {
+            boxes.push_back(scene.elements[i]->bounds());
+            by_top[i] = i;
+        }
+        std::stable_sort(by_top.begin(), by_top.end(), [&](size_t a, size_t b) {return boxes[a].y0 < boxes[b].y0;});
+
+        std::vector<size_t> active;
+        size_t next = 0;
+        std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+        for (int y = 0; y < height; y += strip_height) {
+            int rows = std::min(strip_height, height - y);
+            Box strip = {0, y, width, y + rows};
+
+            //! drop the elements that ended above this strip and add the ones that start in it
+            active.erase(std::remove_if(active.begin(), active.end(), [&](size_t i) {return boxes[i].y1 <= y;}), active.end());
+            size_t old_size = active.size();
+            while (next < by_top.size() && boxes[by_top[next]].y0 < strip.y1) {
+                if (boxes[by_top[next]].y1 > y) {
+                    active.push_back(by_top[next]);
+                }
+                next++;
+            }
+            if (active.size() != old_size) {
+                std::sort(active.begin(), active.end()); //! back to painter's order
+            }
+
+            StageTimer raster(Stage::raster);
+            PNGImage img(width, rows);
+            for (size_t i : active) {
+                if (boxes[i].intersects(strip)) {
+                    scene.elements[i]->draw(img, {0, y});
+                }
+            }
+            raster.stop();
+            StageTimer encode(Stage::encode);
+            for (int r = 0; r < rows; r++) {
+                for (int x = 0; x < width; x++) {
+                    const Color &c = img.at(x, r);
+                    row[3 * x] = c.red;
+                    row[3 * x + 1] = c.green;
+                    row[3 * x + 2] = c.blue;
+                }
+                writer.write_row(row.data());
+            }
+        }
+        writer.finish();
+    }
+
+    void render_parallel(const CompiledScene &scene, PNGImage &img, unsigned threads, int tile_size) {
+        if (tile_size <= 0) {
+            throw std::runtime_error("Invalid tile size " + std::to_string(tile_size));
+        }
+        Box canvas = image_box(img);
+        if (canvas.empty()) {
+            return;
+        }
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        //! the wall time is the caller's, the CPU time is measured by every thread that draws
+        StageTimer timer(Stage::raster, StageTimer::WALL);
+        StatsCollector *collector = active_stats();
+        //! an anti-aliased edge cut on the left or right of a tile sums its coverage in another order than
+        //! when it is drawn whole, so those scenes are cut in bands of tile_size rows as wide as the image
+        int tile_width = scene.subpixel_bits != 0 ? canvas.x1 : tile_size;
+        int tiles_x = (canvas.x1 + tile_width - 1) / tile_width;
+        int tiles_y = (canvas.y1 + tile_size - 1) / tile_size;
+
+        //! binning, the elements are visited in drawing order so every list keeps the painter's order
+        std::vector<std::vector<ElementRef>> tiles(static_cast<size_t>(tiles_x) * tiles_y);
+        for (const CompiledScene::Run &run : scene.order) {
+            for (uint32_t i = run.begin; i < run.end; i++) {
+                Box b = scene.bounds(run.kind, i).intersect(canvas);
+                if (b.empty()) {
+                    continue;
+                }
+                for (int ty = b.y0 / tile_size; ty <= (b.y1 - 1) / tile_size; ty++) {
+                    for (int tx = b.x0 / tile_width; tx <= (b.x1 - 1) / tile_width; tx++) {
+                        tiles[static_cast<size_t>(ty) * tiles_x + tx].push_back({run.kind, i});
+                    }
+                }
+            }
+        }
+
+        //! the threads share a counter and each one takes the next tile when it finishes one,
+        //! so a thread that got cheap tiles just takes more of them
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            StatsScope scope(collector);
+            StageTimer cpu(Stage::raster, StageTimer::CPU);
+            while (true) {
+                size_t t = next.fetch_add(1, std::memory_order_relaxed);
+                if (t >= tiles.size()) {
+                    return;
+                }
+                int tx = static_cast<int>(t % tiles_x);
+                int ty = static_cast<int>(t / tiles_x);
+                Box clip = Box{tx * tile_width, ty * tile_size, (tx + 1) * tile_width, (ty + 1) * tile_size}.intersect(canvas);
+                for (const ElementRef &ref : tiles[t]) {
+                    scene.draw_element(ref.kind, ref.index, img, clip);
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++) {
+            pool.emplace_back(worker);
+        }
+        worker(); //! the calling thread works too
+        for (std::thread &t : pool) {
+            t.join();
+        }
+    }
+
+    void convert_parallel(const std::string &svg_file, const std::string &png_file, unsigned threads) {
+        Scene scene;
+        readSVG(svg_file, scene);
+        CompiledScene compiled = compile(scene.elements, scene.dimensions);
+        PNGImage img(scene.dimensions.x, scene.dimensions.y);
+        render_parallel(compiled, img, threads);
+        img.save(png_file);
+    }
+
+    void convert_antialiased(const std::string &svg_file, const std::string &png_file, int subpixel_bits,
+                             unsigned threads) {
+        Scene scene;
+        scene.subpixel_bits = subpixel_bits;
+        readSVG(svg_file, scene);
+        CompiledScene compiled = compile(scene.elements, scene.dimensions, subpixel_bits);
+        PNGImage img(scene.dimensions.x, scene.dimensions.y);
+        render_parallel(compiled, img, threads);
+        img.save(png_file);
+    }
+
+    double size_factor(const Point &dimensions, int size) {
+        int largest = std::max(dimensions.x, dimensions.y);
+        return size <= 0 || largest <= 0 ? 1 : static_cast<double>(size) / largest;
+    }
+
+    std::string sized_file(const std::string &png_file, int size) {
+        if (size <= 0) {
+            return png_file;
+        }
+        std::string name = png_file;
+        std::string extension;
+        size_t dot = name.rfind('.');
+        size_t slash = name.rfind('/');
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+            extension = name.substr(dot);
+            name.erase(dot);
+        }
+        return name + "-" + std::to_string(size) + extension;
+    }
+
+    void convert_sizes(const std::string &svg_file, const std::string &png_file, const std::vector<int> &sizes,
+                       int subpixel_bits, bool concurrent, const PNGOptions &png_options) {
+        Scene scene;
+        scene.subpixel_bits = subpixel_bits;
+        readSVG(svg_file, scene);
+        CompiledScene compiled = compile(scene.elements, scene.dimensions, subpixel_bits);
+
+        auto render_size = [&](int size, unsigned threads) {
+            double factor = size_factor(scene.dimensions, size);
+            CompiledScene copy;
+            if (factor != 1) {
+                copy = compiled.scaled(factor);
+            }
+            const CompiledScene &sized = factor != 1 ? copy : compiled;
+            PNGImage img(sized.dimensions.x, sized.dimensions.y);
+            render_parallel(sized, img, threads);
+            PNGWriter writer(img.width(), img.height(), sized_file(png_file, size), png_options);
+            write_png(img, writer);
+        };
+
+        if (!concurrent) {
+            for (int size : sizes) {
+                render_size(size, 0);
+            }
+            return;
+        }
+        //! the first error of a thread is thrown again here once they have all finished
+        std::vector<std::exception_ptr> errors(sizes.size());
+        std::vector<std::thread> pool;
+        StatsCollector *collector = active_stats();
+        for (size_t i = 0; i < sizes.size(); i++) {
+            pool.emplace_back([&, i]() {
+                StatsScope scope(collector);
+                try {
+                    render_size(sizes[i], 1);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread &t : pool) {
+            t.join();
+        }
+        for (const std::exception_ptr &error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+}
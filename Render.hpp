@@ -0,0 +1,102 @@
+//! @file Render.hpp
+#ifndef __svg_Render_hpp__
+#define __svg_Render_hpp__
+
+#include "CompiledScene.hpp"
+#include "PNGWriter.hpp"
+#include "Stats.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace svg
+{
+    //! the formats convert can produce in memory
+    enum class OutputFormat
+    {
+        PNG,  //! a complete PNG file
+        RGBA, //! width * height pixels, 4 bytes each, row by row, alpha always 255
+        PPM   //! a binary PPM (P6) file
+    };
+
+    //! an image produced in memory
+    struct RenderedImage
+    {
+        int width = 0;
+        int height = 0;
+        OutputFormat format = OutputFormat::PNG;
+        std::vector<unsigned char> data;
+    };
+
+    //! converts an SVG that is already in memory, without touching the file system
+    //! with stats, what the conversion did is written there (see Stats.hpp)
+    RenderedImage convert(std::string_view svg_text, OutputFormat format,
+                          const PNGOptions &png_options = PNGOptions(), ConvertStats *stats = nullptr);
+
+    //! converts svg_file to png_file and writes to stats the time of each stage and the counters of Stats.hpp
+    void convert(const std::string &svg_file, const std::string &png_file, ConvertStats &stats,
+                 const PNGOptions &png_options = PNGOptions());
+
+    //! writes all the rows of img to writer and finishes the file
+    void write_png(const PNGImage &img, PNGWriter &writer);
+
+    //! encodes img in format
+    RenderedImage encode(const PNGImage &img, OutputFormat format,
+                         const PNGOptions &png_options = PNGOptions());
+
+    //! draws the elements in order, skipping the ones (and whole groups) whose bounding box
+    //! doesn't touch the image
+    void render(const std::vector<SVGElement *> &elements, PNGImage &img);
+
+    //! draws only the part region of the document into out, which must have the size of region
+    //! the elements are drawn with (region.x0, region.y0) as origin, without being moved, so only the
+    //! elements that touch region are drawn, out is the only image allocated and several threads can
+    //! draw regions of the same elements at once
+    void render_region(const std::vector<SVGElement *> &elements, const Box &region, PNGImage &out);
+
+    //! converts only region of svg_file, the png has the size of region
+    //! an empty or inverted region (x1 <= x0 or y1 <= y0) throws a runtime_error
+    void convert_region(const std::string &svg_file, const std::string &png_file, const Box &region);
+
+    //! converts svg_file one horizontal strip of strip_height rows at a time: each strip is drawn
+    //! in a small image with only the elements whose bounding box crosses it, and its rows go straight
+    //! to a streaming PNG writer, so the memory used for pixels is width * strip_height whatever the canvas size
+    //! a strip_height <= 0 throws a runtime_error
+    void convert_strips(const std::string &svg_file, const std::string &png_file, int strip_height = 256,
+                        const PNGOptions &png_options = PNGOptions());
+
+    //! draws scene into img with several threads
+    //! the image is split in tiles of tile_size x tile_size pixels, every element is put in the list of
+    //! the tiles its bounding box touches (in drawing order), and then the threads take tiles one at a time
+    //! and draw their lists clipped to the tile; the result is exactly the same as scene.draw(img), and as
+    //! render() of the elements scene was compiled from (when compiled without subpixel bits)
+    //! a scene with subpixel bits is split in bands of tile_size rows as wide as the image instead, which
+    //! are exactly the same as scene.draw(img) too (see CompiledScene::draw)
+    //! threads = 0 means one thread per core, a tile_size <= 0 throws a runtime_error
+    void render_parallel(const CompiledScene &scene, PNGImage &img, unsigned threads = 0, int tile_size = 64);
+
+    //! like convert, but drawing with render_parallel
+    void convert_parallel(const std::string &svg_file, const std::string &png_file, unsigned threads = 0);
+
+    //! converts svg_file with anti-aliased edges, in one pass at the size of the image: the document is read
+    //! with subpixel coordinates (see Scene::subpixel_bits) and drawn with render_parallel
+    void convert_antialiased(const std::string &svg_file, const std::string &png_file, int subpixel_bits = 8,
+                             unsigned threads = 0);
+
+    //! the scale that makes the largest side of an image of dimensions size pixels long (1 for size 0)
+    double size_factor(const Point &dimensions, int size);
+    //! the file of the output of size pixels: png_file itself for size 0, "a-256.png" for "a.png" and 256
+    std::string sized_file(const std::string &png_file, int size);
+
+    //! converts svg_file to one PNG per size of sizes (the largest side in pixels, 0 for the size of the
+    //! document, see sized_file for the names) with a single readSVG and compile: every size is drawn
+    //! from a scaled copy of the compiled scene, so the shapes are redrawn at that size instead of
+    //! resampling the pixels of the biggest image
+    //! the document is read with subpixel coordinates so the small sizes lose nothing to the rounding
+    //! (with subpixel_bits = 0 the coordinates are whole pixels of the document and the sizes are not anti-aliased)
+    //! concurrent: each size is drawn and encoded by its own thread, otherwise one after the other,
+    //! each with render_parallel
+    void convert_sizes(const std::string &svg_file, const std::string &png_file, const std::vector<int> &sizes,
+                       int subpixel_bits = 8, bool concurrent = true, const PNGOptions &png_options = PNGOptions());
+}
+#endif
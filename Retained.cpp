@@ -0,0 +1,162 @@
+#include "Retained.hpp"
+#include "Render.hpp"
+#include <algorithm>
+
+namespace svg
+{
+    RetainedRenderer::RetainedRenderer(const std::vector<SVGElement *> &elements, const Point &dimensions,
+                                       const Color &background)
+        : elements_(elements), image_(dimensions.x, dimensions.y), background_(background),
+          tiles_x_((std::max(dimensions.x, 0) + TILE_SIZE - 1) / TILE_SIZE),
+          tiles_y_((std::max(dimensions.y, 0) + TILE_SIZE - 1) / TILE_SIZE),
+          bins_(static_cast<size_t>(tiles_x_) * tiles_y_), dirty_(bins_.size(), 0) {
+        //! the elements are visited in drawing order, so every bin starts sorted
+        bounds_.reserve(elements_.size());
+        for (uint32_t i = 0; i < elements_.size(); i++) {
+            index_.emplace(elements_[i], i);
+            bounds_.push_back(elements_[i]->bounds());
+            Box t = tiles(bounds_[i]);
+            for (int ty = t.y0; ty < t.y1; ty++) {
+                for (int tx = t.x0; tx < t.x1; tx++) {
+                    bins_[static_cast<size_t>(ty) * tiles_x_ + tx].push_back(i);
+                }
+            }
+        }
+        damage(image_box(image_));
+    }
+
+    Box RetainedRenderer::tiles(const Box &b) const {
+        Box c = b.intersect(image_box(image_));
+        if (c.empty()) {
+            return {0, 0, 0, 0};
+        }
+        return {c.x0 / TILE_SIZE, c.y0 / TILE_SIZE, (c.x1 - 1) / TILE_SIZE + 1, (c.y1 - 1) / TILE_SIZE + 1};
+    }
+
+    void RetainedRenderer::translate(SVGElement *element, const Point &t) {
+        element->translate(t);
+        changed(element);
+    }
+
+    void RetainedRenderer::rotate(SVGElement *element, const Point &origin, int degrees) {
+        element->rotate(origin, degrees);
+        changed(element);
+    }
+
+    void RetainedRenderer::scale(SVGElement *element, const Point &origin, int v) {
+        element->scale(origin, v);
+        changed(element);
+    }
+
+    void RetainedRenderer::transform(SVGElement *element, const Transform &t) {
+        element->transform(t);
+        changed(element);
+    }
+
+    //! the element leaves the bins of the tiles it no longer touches and enters the new ones, where
+    //! it is inserted at its place in the drawing order
+    void RetainedRenderer::changed(SVGElement *element) {
+        auto it = index_.find(element);
+        if (it == index_.end()) {
+            return; //! not drawn by this renderer
+        }
+        uint32_t i = it->second;
+        Box before = bounds_[i];
+        Box after = element->bounds();
+        Box old_tiles = tiles(before);
+        Box new_tiles = tiles(after);
+        for (int ty = old_tiles.y0; ty < old_tiles.y1; ty++) {
+            for (int tx = old_tiles.x0; tx < old_tiles.x1; tx++) {
+                if (tx >= new_tiles.x0 && tx < new_tiles.x1 && ty >= new_tiles.y0 && ty < new_tiles.y1) {
+                    continue;
+                }
+                std::vector<uint32_t> &bin = bins_[static_cast<size_t>(ty) * tiles_x_ + tx];
+                auto at = std::lower_bound(bin.begin(), bin.end(), i);
+                if (at != bin.end() && *at == i) {
+                    bin.erase(at);
+                }
+            }
+        }
+        for (int ty = new_tiles.y0; ty < new_tiles.y1; ty++) {
+            for (int tx = new_tiles.x0; tx < new_tiles.x1; tx++) {
+                if (tx >= old_tiles.x0 && tx < old_tiles.x1 && ty >= old_tiles.y0 && ty < old_tiles.y1) {
+                    continue;
+                }
+                std::vector<uint32_t> &bin = bins_[static_cast<size_t>(ty) * tiles_x_ + tx];
+                bin.insert(std::lower_bound(bin.begin(), bin.end(), i), i);
+            }
+        }
+        bounds_[i] = after;
+        damage(before);
+        damage(after);
+    }
+
+    //! the damage is kept as whole tiles, so overlapping rectangles are merged by the tiles themselves
+    void RetainedRenderer::damage(const Box &region) {
+        Box t = tiles(region);
+        for (int ty = t.y0; ty < t.y1; ty++) {
+            for (int tx = t.x0; tx < t.x1; tx++) {
+                uint32_t tile = static_cast<uint32_t>(ty) * tiles_x_ + tx;
+                if (!dirty_[tile]) {
+                    dirty_[tile] = 1;
+                    damage_.push_back(tile);
+                }
+            }
+        }
+    }
+
+    void RetainedRenderer::redraw(const Box &region) {
+        //! the elements of the tiles of region, each once and back in drawing order
+        Box t = tiles(region);
+        found_.clear();
+        for (int ty = t.y0; ty < t.y1; ty++) {
+            for (int tx = t.x0; tx < t.x1; tx++) {
+                const std::vector<uint32_t> &bin = bins_[static_cast<size_t>(ty) * tiles_x_ + tx];
+                found_.insert(found_.end(), bin.begin(), bin.end());
+            }
+        }
+        std::sort(found_.begin(), found_.end());
+        found_.erase(std::unique(found_.begin(), found_.end()), found_.end());
+        drawn_.clear();
+        for (uint32_t i : found_) {
+            drawn_.push_back(elements_[i]);
+        }
+
+        //! the elements draw themselves whole, so they are drawn in a separate image of the size of region
+        //! (with render_region) and only that is copied, otherwise the parts of an element outside region
+        //! would cover the elements above it
+        PNGImage scratch(region.x1 - region.x0, region.y1 - region.y0);
+        fill_rect(scratch, image_box(scratch), background_, image_box(scratch));
+        render_region(drawn_, region, scratch);
+        for (int y = region.y0; y < region.y1; y++) {
+            const Color *from = &scratch.at(0, y - region.y0);
+            std::copy(from, from + (region.x1 - region.x0), &image_.at(region.x0, y));
+        }
+    }
+
+    //! the dirty tiles are sorted by row and the consecutive ones of a row are redrawn together
+    const PNGImage &RetainedRenderer::frame() {
+        std::sort(damage_.begin(), damage_.end());
+        redrawn_.clear();
+        Box canvas = image_box(image_);
+        for (size_t i = 0; i < damage_.size();) {
+            uint32_t first = damage_[i];
+            size_t j = i + 1;
+            while (j < damage_.size() && damage_[j] == damage_[j - 1] + 1 && damage_[j] % tiles_x_ != 0) {
+                j++;
+            }
+            int tx = static_cast<int>(first % tiles_x_);
+            int ty = static_cast<int>(first / tiles_x_);
+            int run = static_cast<int>(j - i);
+            redrawn_.push_back(Box{tx * TILE_SIZE, ty * TILE_SIZE, (tx + run) * TILE_SIZE, (ty + 1) * TILE_SIZE}.intersect(canvas));
+            for (; i < j; i++) {
+                dirty_[damage_[i]] = 0;
+            }
+        }
+        damage_.clear();
+        for (const Box &region : redrawn_) {
+            redraw(region);
+        }
+        return image_;
+    }
+}
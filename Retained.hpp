@@ -0,0 +1,65 @@
+//! @file Retained.hpp
+#ifndef __svg_Retained_hpp__
+#define __svg_Retained_hpp__
+
+#include "SVGElements.hpp"
+#include "Raster.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace svg
+{
+    //! keeps the image of a list of elements between frames and redraws only what changed
+    //! the image is divided in tiles of TILE_SIZE pixels, and every tile keeps the list of the elements
+    //! whose bounding box touches it (in drawing order); the elements must be moved through the renderer
+    //! (or reported with changed()), which updates those lists and marks the tiles under the bounding box
+    //! of the element before and after the change; the next frame() then clears the marked tiles and
+    //! redraws in them only the elements of their lists, so the time of a frame depends on what changed
+    //! and not on the number of elements
+    //! the elements are not owned, they must outlive the renderer, and each one can be in the list once
+    class RetainedRenderer
+    {
+    public:
+        static const int TILE_SIZE = 16;
+
+        RetainedRenderer(const std::vector<SVGElement *> &elements, const Point &dimensions,
+                         const Color &background = {255, 255, 255});
+
+        void translate(SVGElement *element, const Point &t);
+        void rotate(SVGElement *element, const Point &origin, int degrees);
+        void scale(SVGElement *element, const Point &origin, int v);
+        void transform(SVGElement *element, const Transform &t);
+        //! after element was changed in some other way: redraws where it was and where it is now
+        void changed(SVGElement *element);
+
+        //! marks region to be redrawn (e.g. after changing what an element looks like but not where it is)
+        void damage(const Box &region);
+
+        //! brings the image up to date and returns it; the first frame draws everything
+        const PNGImage &frame();
+
+        //! the rectangles redrawn by the last frame(), runs of marked tiles along the rows of tiles
+        const std::vector<Box> &redrawn() const {return redrawn_;}
+
+    private:
+        //! the tiles b touches, as a box of tile indices (empty if b is outside the image)
+        Box tiles(const Box &b) const;
+        void redraw(const Box &region);
+
+        std::vector<SVGElement *> elements_;
+        std::unordered_map<const SVGElement *, uint32_t> index_; //! the position of every element in elements_
+        std::vector<Box> bounds_;                                //! the bounding box each one is binned with
+        PNGImage image_;
+        Color background_;
+        int tiles_x_;
+        int tiles_y_;
+        std::vector<std::vector<uint32_t>> bins_; //! the elements of every tile, sorted (the drawing order)
+        std::vector<uint8_t> dirty_;              //! 1 for the tiles to redraw in the next frame
+        std::vector<uint32_t> damage_;            //! the tiles that are dirty, in the order they were marked
+        std::vector<Box> redrawn_;
+        std::vector<uint32_t> found_;             //! the elements of the tiles of the region being redrawn
+        std::vector<SVGElement *> drawn_;         //! the same elements, in drawing order and each once
+    };
+}
+#endif
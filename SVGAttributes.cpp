@@ -0,0 +1,215 @@
+#include "SVGAttributes.hpp"
+#include "external/tinyxml2/tinyxml2.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace svg
+{
+    //! we switch on the first character so each name is compared with at most a few candidates
+    Attr intern_attribute(std::string_view name) {
+        if (name.empty()) {
+            return Attr::count;
+        }
+        switch (name[0]) {
+            case 'x':
+                if (name == "x") return Attr::x;
+                if (name == "x1") return Attr::x1;
+                if (name == "x2") return Attr::x2;
+                if (name == "xlink:href") return Attr::href; //! SVG 1.1 name of href
+                break;
+            case 'y':
+                if (name == "y") return Attr::y;
+                if (name == "y1") return Attr::y1;
+                if (name == "y2") return Attr::y2;
+                break;
+            case 'w':
+                if (name == "width") return Attr::width;
+                break;
+            case 'h':
+                if (name == "height") return Attr::height;
+                if (name == "href") return Attr::href;
+                break;
+            case 'c':
+                if (name == "cx") return Attr::cx;
+                if (name == "cy") return Attr::cy;
+                break;
+            case 'r':
+                if (name == "r") return Attr::r;
+                if (name == "rx") return Attr::rx;
+                if (name == "ry") return Attr::ry;
+                break;
+            case 'f':
+                if (name == "fill") return Attr::fill;
+                if (name == "fill-rule") return Attr::fill_rule;
+                if (name == "fill-opacity") return Attr::fill_opacity;
+                break;
+            case 's':
+                if (name == "stroke") return Attr::stroke;
+                if (name == "style") return Attr::style;
+                if (name == "stroke-opacity") return Attr::stroke_opacity;
+                if (name == "stroke-width") return Attr::stroke_width;
+                if (name == "stroke-linejoin") return Attr::stroke_linejoin;
+                if (name == "stroke-linecap") return Attr::stroke_linecap;
+                if (name == "stroke-miterlimit") return Attr::stroke_miterlimit;
+                break;
+            case 'p':
+                if (name == "points") return Attr::points;
+                break;
+            case 't':
+                if (name == "transform") return Attr::transform;
+                if (name == "transform-origin") return Attr::transform_origin;
+                break;
+            case 'd':
+                if (name == "d") return Attr::d;
+                break;
+            case 'i':
+                if (name == "id") return Attr::id;
+                break;
+            case 'o':
+                if (name == "opacity") return Attr::opacity;
+                break;
+        }
+        return Attr::count;
+    }
+
+    Attributes::Attributes(const tinyxml2::XMLElement *elem) {
+        for (const tinyxml2::XMLAttribute *attr = elem->FirstAttribute(); attr != nullptr; attr = attr->Next()) {
+            Attr a = intern_attribute(attr->Name());
+            if (a != Attr::count) {
+                values_[index(a)] = attr->Value();
+            }
+        }
+        if (has(Attr::style)) {
+            read_style(get(Attr::style));
+        }
+    }
+
+    void Attributes::read_style(std::string_view style) {
+        auto trim = [](std::string_view s) {
+            while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\n' || s.front() == '\r')) {
+                s.remove_prefix(1);
+            }
+            while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\n' || s.back() == '\r')) {
+                s.remove_suffix(1);
+            }
+            return s;
+        };
+        while (!style.empty()) {
+            size_t end = std::min(style.find(';'), style.size());
+            std::string_view declaration = style.substr(0, end);
+            style.remove_prefix(std::min(end + 1, style.size()));
+            size_t colon = declaration.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            Attr a = intern_attribute(trim(declaration.substr(0, colon)));
+            if (a != Attr::count && a != Attr::style) {
+                values_[index(a)] = trim(declaration.substr(colon + 1));
+            }
+        }
+    }
+
+    void Attributes::inherit(const Attributes &parent) {
+        for (Attr a : {Attr::fill, Attr::fill_rule, Attr::stroke, Attr::fill_opacity, Attr::stroke_opacity,
+                       Attr::stroke_width, Attr::stroke_linejoin, Attr::stroke_linecap, Attr::stroke_miterlimit}) {
+            if (!has(a)) {
+                values_[index(a)] = parent.values_[index(a)];
+            }
+        }
+    }
+
+    int Attributes::get_int(Attr a, int def) const {
+        std::string_view s = get(a);
+        double value;
+        if (!next_number(s, value)) {
+            return def;
+        }
+        return static_cast<int>(std::lround(value));
+    }
+
+    double Attributes::get_number(Attr a, double def) const {
+        std::string_view s = get(a);
+        double value;
+        if (!next_number(s, value)) {
+            return def;
+        }
+        return value;
+    }
+
+    namespace
+    {
+        //! lookup table of the characters that separate numbers in SVG attributes
+        //! (the four XML whitespace characters and the comma), built at compile time so it is ready
+        //! before any static initializer of another file parses something
+        struct SeparatorTable
+        {
+            bool is[256] = {};
+            constexpr bool operator[](unsigned char c) const {return is[c];}
+        };
+
+        constexpr SeparatorTable separator_table() {
+            SeparatorTable table;
+            for (char c : {' ', '\t', '\n', '\r', ','}) {
+                table.is[static_cast<unsigned char>(c)] = true;
+            }
+            return table;
+        }
+        constexpr SeparatorTable is_separator = separator_table();
+    }
+
+    void skip_separators(std::string_view &s) {
+        size_t i = 0;
+        while (i < s.size() && is_separator[static_cast<unsigned char>(s[i])]) {
+            i++;
+        }
+        s.remove_prefix(i);
+    }
+
+    bool next_int(std::string_view &s, int &value) {
+        skip_separators(s);
+        const char *first = s.data();
+        //! from_chars does not accept a leading '+'
+        if (!s.empty() && s[0] == '+') {
+            first++;
+        }
+        auto [ptr, ec] = std::from_chars(first, s.data() + s.size(), value);
+        if (ec != std::errc()) {
+            return false;
+        }
+        s.remove_prefix(ptr - s.data());
+        return true;
+    }
+
+    bool next_number(std::string_view &s, double &value) {
+        skip_separators(s);
+        const char *first = s.data();
+        if (!s.empty() && s[0] == '+') {
+            first++;
+        }
+        auto [ptr, ec] = std::from_chars(first, s.data() + s.size(), value);
+        if (ec != std::errc()) {
+            return false;
+        }
+        s.remove_prefix(ptr - s.data());
+        return true;
+    }
+
+    void parse_points(std::string_view s, std::vector<Point> &points, double scale) {
+        //! first pass: count the tokens (runs of non separators) to reserve the vector only once
+        //! this is only an estimate, "10-5" is one token but two numbers, but it is close for real files
+        size_t tokens = 0;
+        bool in_token = false;
+        for (char c : s) {
+            bool sep = is_separator[static_cast<unsigned char>(c)];
+            tokens += (!sep && !in_token);
+            in_token = !sep;
+        }
+        points.reserve(points.size() + tokens / 2);
+
+        double x, y;
+        while (next_number(s, x) && next_number(s, y)) {
+            points.push_back({static_cast<int>(std::lround(x * scale)), static_cast<int>(std::lround(y * scale))});
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//! @file SVGAttributes.hpp
+#ifndef __svg_SVGAttributes_hpp__
+#define __svg_SVGAttributes_hpp__
+
+#include "Point.hpp"
+#include <string_view>
+#include <cstddef>
+#include <vector>
+
+namespace tinyxml2
+{
+    class XMLElement;
+}
+
+namespace svg
+{
+    //! the attribute names readSVG knows about, "interned" as an enum so that looking one up
+    //! is an array access instead of a string comparison or a map search
+    enum class Attr
+    {
+        x, y, width, height,
+        cx, cy, r, rx, ry,
+        x1, y1, x2, y2,
+        fill, fill_rule, stroke, points, d,
+        opacity, fill_opacity, stroke_opacity,
+        stroke_width, stroke_linejoin, stroke_linecap, stroke_miterlimit,
+        transform, transform_origin,
+        id, href, style,
+        count //! number of known attributes, not an attribute
+    };
+
+    //! returns the Attr for an attribute name, or Attr::count if we don't know it
+    Attr intern_attribute(std::string_view name);
+
+    //! the attributes of one XML element, as string_views over the text owned by tinyxml2
+    //! the declarations of a style attribute ("fill:red;stroke:blue") are split into the same slots
+    //! and win over the attributes with the same name, as in CSS
+    //! building one does not allocate, but it is only valid while the XMLDocument is alive
+    class Attributes
+    {
+    public:
+        explicit Attributes(const tinyxml2::XMLElement *elem);
+        bool has(Attr a) const {return values_[index(a)].data() != nullptr;}
+        std::string_view get(Attr a) const {return values_[index(a)];} //! empty view if missing
+        int get_int(Attr a, int def = 0) const; //! the value rounded to an int, def if missing or invalid
+        double get_number(Attr a, double def = 0) const; //! the value as a number, def if missing or invalid
+        //! takes from parent the inherited presentation attributes (fill, stroke, fill-rule, fill-opacity,
+        //! stroke-opacity and the stroke-width/linejoin/linecap/miterlimit, but not opacity) that are not set here,
+        //! which is how a <g> passes them to its children
+        void inherit(const Attributes &parent);
+
+    private:
+        static size_t index(Attr a) {return static_cast<size_t>(a);}
+        void read_style(std::string_view style);
+        std::string_view values_[static_cast<size_t>(Attr::count)];
+    };
+
+    //! skips separators (whitespace and commas) at the start of s
+    void skip_separators(std::string_view &s);
+    //! reads the next integer of s (after any separators) and removes it from s
+    //! returns false if there is no integer left
+    bool next_int(std::string_view &s, int &value);
+    //! same as next_int but for any SVG number: sign, decimals and exponent ("-1.5e2", ".5")
+    bool next_number(std::string_view &s, double &value);
+
+    //! parses the "points" attribute of polyline and polygon, numbers can be separated by any mix
+    //! of whitespace and commas; coordinates are multiplied by scale (the size of a pixel in the units of
+    //! the points, 1 unless subpixel coordinates are used) and rounded to the nearest unit
+    //! the points are appended to points, which is reserved once before parsing
+    void parse_points(std::string_view s, std::vector<Point> &points, double scale = 1);
+}
+#endif
@@ -1,12 +1,84 @@
 #include "SVGElements.hpp"
+#include "CompiledScene.hpp"
 #include <vector>//! included vector
 #include <cmath>
+#include <algorithm>
 
 namespace svg
 {
 
+    //! the scale about a point, used by the elements that keep a vector of points
+    //! so that they are scaled in one batch (see Transform::apply)
+    static Transform scale_about(const Point &origin, int factor) {
+        return Transform::translate(origin.x, origin.y) * Transform::scale(factor, factor) * Transform::translate(-origin.x, -origin.y);
+    }
+
+    //! the box around a vector of points, the last row and column are included
+    static Box points_bounds(const std::vector<Point> &points) {
+        if (points.empty()) {
+            return {0, 0, 0, 0};
+        }
+        Box b = {points[0].x, points[0].y, points[0].x + 1, points[0].y + 1};
+        for (const Point &p : points) {
+            b.x0 = std::min(b.x0, p.x);
+            b.y0 = std::min(b.y0, p.y);
+            b.x1 = std::max(b.x1, p.x + 1);
+            b.y1 = std::max(b.y1, p.y + 1);
+        }
+        return b;
+    }
+
+    //! how much a matrix scales lengths (the stroke width), the square root of how much it scales areas
+    static double length_scale(const Transform &m) {
+        return std::sqrt(std::fabs(m.a * m.d - m.b * m.c));
+    }
+
+    //! b with room for a stroke that goes reach units away from the points
+    static Box grow(const Box &b, double reach) {
+        int r = static_cast<int>(std::ceil(reach));
+        return {b.x0 - r, b.y0 - r, b.x1 + r, b.y1 + r};
+    }
+
+    //! the elements are drawn with their points moved by -origin (see moved_points), so drawing a part of the
+    //! document does not have to move the element and back, and the element can be drawn by several threads
+    static Point moved(const Point &p, const Point &origin) {
+        return {p.x - origin.x, p.y - origin.y};
+    }
+
+    static const Point *moved(const Point *points, size_t count, const Point &origin) {
+        return moved_points(points, count, origin);
+    }
+
+    //! the part of the document that img shows when it is drawn with origin
+    static Box canvas_box(const PNGImage &img, const Point &origin) {
+        return {origin.x, origin.y, origin.x + img.width(), origin.y + img.height()};
+    }
+
+    //! draws the part of box that img shows on its own, with draw(image, origin) over black and over white,
+    //! and composites it with alpha: what is drawn hides what it covers, and the result is blended as a whole
+    template <class Draw>
+    static void draw_layer(PNGImage &img, const Point &origin, const Box &box, uint8_t alpha, Draw draw) {
+        Layer layer;
+        layer.box = box.intersect(canvas_box(img, origin));
+        if (layer.box.empty() || alpha == 0) {
+            return;
+        }
+        int width = layer.box.x1 - layer.box.x0;
+        int height = layer.box.y1 - layer.box.y0;
+        PNGImage black(width, height);
+        PNGImage white(width, height);
+        fill_rect(black, image_box(black), {0, 0, 0}, image_box(black));
+        fill_rect(white, image_box(white), {255, 255, 255}, image_box(white));
+        Point corner = {layer.box.x0, layer.box.y0};
+        draw(black, corner);
+        draw(white, corner);
+        layer.capture(black, white);
+        layer.composite(img, {-origin.x, -origin.y}, alpha);
+    }
+
     // These must be defined!
     SVGElement::SVGElement()  {} //!the constructor
+    SVGElement::SVGElement(const Color &fill) : fill_(fill) {}
     SVGElement::~SVGElement() {} //! the destructor
 
     //! now we implement the translate, rotate and scale functions
@@ -20,24 +92,78 @@ namespace svg
 
     Ellipse::Ellipse(const Color &fill,
                      const Point &center,
-                     const Point &radius)
-        : fill(fill), center(center), radius(radius){};
+                     const Point &radius,
+                     double angle)
+        : SVGElement(fill), center(center), radius(radius), angle(angle){
+            update_bounds();
+        };
 
-    void Ellipse::draw(PNGImage &img) const
+    //! always the rasterizer of Raster.hpp, whatever the angle and the alpha: it is the one CompiledScene
+    //! uses, so an ellipse gives the same pixels drawn as an element or compiled
+    void draw_ellipse(PNGImage &img, const Point &center, const Point &radius, double angle, const Color &fill,
+                      uint8_t alpha)
     {
-        img.draw_ellipse(center, radius, fill);
+        fill_ellipse(img, center, radius, angle, fill, image_box(img), alpha);
+    }
+
+    void Ellipse::draw(PNGImage &img, const Point &origin) const
+    {
+        draw_ellipse(img, moved(center, origin), radius, angle, fill_, alpha_);
     }
 
     void Ellipse::translate(const Point &dir) {
         center = center.translate(dir);
+        update_bounds();
     }
     void Ellipse::rotate(const Point &origin, int degrees) {
         center = center.rotate(origin,degrees);
+        angle += degrees;
+        update_bounds();
     }
 
     void Ellipse::scale(const Point &origin, int factor) {
         center = center.scale(origin, factor);
         radius = {radius.x * factor, radius.y * factor};
+        update_bounds();
+    }
+
+    //! the image of an ellipse by an affine matrix is still an ellipse, but its axes are not
+    //! simply the transformed radii (think of a skew), so we take the matrix that maps the unit circle
+    //! to the transformed ellipse and get its singular value decomposition A = R(phi) * diag(sx, sy) * R(theta):
+    //! sx and sy are the new radii and phi the new orientation (R(theta) only rotates the unit circle)
+    void Ellipse::transform(const Transform &m) {
+        center = m.apply(center);
+        double s = std::sin(angle * M_PI / 180.0);
+        double c = std::cos(angle * M_PI / 180.0);
+        double a00 = (m.a * c + m.c * s) * radius.x;
+        double a10 = (m.b * c + m.d * s) * radius.x;
+        double a01 = (-m.a * s + m.c * c) * radius.y;
+        double a11 = (-m.b * s + m.d * c) * radius.y;
+        double e = (a00 + a11) / 2, f = (a00 - a11) / 2;
+        double g = (a10 + a01) / 2, h = (a10 - a01) / 2;
+        double q = std::hypot(e, h), r = std::hypot(f, g);
+        double phi = (std::atan2(h, e) + std::atan2(g, f)) / 2;
+        radius = {static_cast<int>(std::lround(q + r)), static_cast<int>(std::lround(std::fabs(q - r)))};
+        angle = phi * 180.0 / M_PI;
+        update_bounds();
+    }
+    void Ellipse::compile(CompiledScene &out) const {
+        out.add_ellipse(center, radius, angle, fill_, alpha_);
+    }
+    SVGElement *Ellipse::clone() const {
+        return new Ellipse(*this);
+    }
+    //! the box of a rotated ellipse is given by the extreme values of
+    //! x(t) = rx cos(a) cos(t) - ry sin(a) sin(t) and y(t) = rx sin(a) cos(t) + ry cos(a) sin(t)
+    void Ellipse::update_bounds() {
+        double s = std::sin(angle * M_PI / 180.0);
+        double c = std::cos(angle * M_PI / 180.0);
+        //! the squares in double, in int they overflow from a radius of 46341 units
+        double rx = radius.x, ry = radius.y;
+        double w = std::sqrt(rx * rx * c * c + ry * ry * s * s);
+        double h = std::sqrt(rx * rx * s * s + ry * ry * c * c);
+        bounds_ = {static_cast<int>(std::floor(center.x - w)), static_cast<int>(std::floor(center.y - h)),
+                   static_cast<int>(std::ceil(center.x + w)) + 1, static_cast<int>(std::ceil(center.y + h)) + 1};
     }
     
     //! Circle implementation
@@ -52,19 +178,32 @@ namespace svg
                   const Point &center,
                   const Point &radius)
                   : Ellipse(fill,center,radius){};
-    void Circle::draw(PNGImage &img) const{
-        img.draw_ellipse(center,radius,fill); //! and the draw function
+    void Circle::draw(PNGImage &img, const Point &origin) const{
+        Ellipse::draw(img, origin); //! a skewed or non uniformly scaled circle is drawn like an ellipse
     }
 
     void Circle::translate(const Point &dir) {
         center = center.translate(dir);
+        update_bounds();
     }
+    //! a circle that a non uniform transform made an ellipse has axes that turn with it
     void Circle::rotate(const Point &origin, int degrees) {
-        center = center.rotate(origin, degrees);
+        Ellipse::rotate(origin, degrees);
     }
     void Circle::scale(const Point &origin, int factor) {
         center = center.scale(origin, factor);
         radius = {radius.x * factor, radius.y * factor};
+        update_bounds();
+    }
+    void Circle::transform(const Transform &m) {
+        Ellipse::transform(m);
+        update_bounds();
+    }
+    void Circle::compile(CompiledScene &out) const {
+        Ellipse::compile(out);
+    }
+    SVGElement *Circle::clone() const {
+        return new Circle(*this);
     }
 
     //! Polyline implementation
@@ -73,39 +212,59 @@ namespace svg
     //! we have the fill and a vector of points
     //! however in the draw function we need to
     //! draw a line between a series of points
-    //!therefore we use a for loop to iterate between all the points
-    //! and draw a line between each one
+    //! the stroker (Stroke.hpp) turns all the segments, joins and caps into one outline
 
     polyline::polyline(const Color &fill,
                        const std::vector<Point> &points)
-                       :fill(fill), points(points){};
+                       :SVGElement(fill), points(points){
+                           update_bounds();
+                       };
 
-    void polyline::draw(PNGImage &img) const{
-        for (size_t i = 0; i < points.size() - 1; i++) {
-            Point start = points[i];
-            Point end = points[i + 1];
-            img.draw_line(start, end, fill);
-        }
+    polyline::polyline(const Color &fill,
+                       std::vector<Point> &&points)
+                       :SVGElement(fill), points(std::move(points)){
+                           update_bounds();
+                       };
+
+    //! the whole polyline is one outline filled in a single pass, so the joints are not painted twice
+    void polyline::draw(PNGImage &img, const Point &origin) const{
+        svg::draw_stroke(img, moved(points.data(), points.size(), origin), points.size(), false, stroke_style, fill_,
+                         image_box(img), alpha_);
+    }
+    void polyline::setStroke(const StrokeStyle &style) {
+        stroke_style = style;
+        update_bounds();
     }
 
     void polyline::translate(const Point &dir) {
-        for(Point &point : points){
-            point = point.translate(dir);
-        }
+        Transform::translate(dir.x, dir.y).apply(points);
+        update_bounds();
     }
     void polyline::rotate(const Point &origin, int degrees) {
-        for (Point &point : points)
-        {
-            point = point.rotate(origin,degrees);
-        }
+        Transform::rotate(degrees, origin.x, origin.y).apply(points);
+        update_bounds();
     }
 
-    //! we use the scale function already given for the polyline scale
+    //! the points are scaled in one batch with a precomputed matrix
     void polyline::scale(const Point &origin, int factor) {
         //! Scale each point of the polyline
-        for (Point &point : points){
-            point = point.scale(origin,factor);
-        }
+        scale_about(origin, factor).apply(points);
+        stroke_style.width *= std::abs(factor);
+        update_bounds();
+    }
+    void polyline::transform(const Transform &m) {
+        m.apply(points);
+        stroke_style.width *= length_scale(m);
+        update_bounds();
+    }
+    void polyline::compile(CompiledScene &out) const {
+        out.add_polyline(points, fill_, alpha_, stroke_style);
+    }
+    SVGElement *polyline::clone() const {
+        return new polyline(*this);
+    }
+    void polyline::update_bounds() {
+        bounds_ = grow(points_bounds(points), stroke_style.reach());
     }
 
     //! line implementation
@@ -116,24 +275,51 @@ namespace svg
     line::line(const Point &start,
                const Point &end,
                const Color &fill)
-               :start(start), end(end), fill(fill)
+               :SVGElement(fill), start(start), end(end)
     {
+        update_bounds();
+    }
+    //! a line is stroked like a polyline of two points
+    void line::draw(PNGImage &img, const Point &origin) const{
+        Point ends[2] = {moved(start, origin), moved(end, origin)};
+        svg::draw_stroke(img, ends, 2, false, stroke_style, fill_, image_box(img), alpha_);
     }
-    void line::draw(PNGImage &img) const{
-        img.draw_line(start,end,fill);
+    void line::setStroke(const StrokeStyle &style) {
+        stroke_style = style;
+        update_bounds();
     }
     
     void line::translate(const Point &dir) {
         start = start.translate(dir);
         end = end.translate(dir);
+        update_bounds();
     }
     void line::rotate(const Point &origin, int degrees) {
         start = start.rotate(origin,degrees);
         end = end.rotate(origin,degrees);
+        update_bounds();
     }
     void line::scale(const Point &origin, int factor) {
         start =start.scale(origin,factor);
         end = end.scale(origin,factor);
+        stroke_style.width *= std::abs(factor);
+        update_bounds();
+    }
+    void line::transform(const Transform &m) {
+        start = m.apply(start);
+        end = m.apply(end);
+        stroke_style.width *= length_scale(m);
+        update_bounds();
+    }
+    void line::compile(CompiledScene &out) const {
+        out.add_line(start, end, fill_, alpha_, stroke_style);
+    }
+    SVGElement *line::clone() const {
+        return new line(*this);
+    }
+    void line::update_bounds() {
+        bounds_ = {std::min(start.x, end.x), std::min(start.y, end.y), std::max(start.x, end.x) + 1, std::max(start.y, end.y) + 1};
+        bounds_ = grow(bounds_, stroke_style.reach());
     }
 
     //! polygon
@@ -142,25 +328,98 @@ namespace svg
     //! because the draw_polygon class already takes a vector of points as a argument, unlike the draw_line function
 
     polygon::polygon(const Color &fill,
-                     const std::vector<Point> &points)
-                     :fill(fill),points(points){};
-    void polygon::draw(PNGImage &img) const{
-        img.draw_polygon(points,fill);
+                     const std::vector<Point> &points,
+                     FillRule fill_rule)
+                     :SVGElement(fill),points(points),fill_rule(fill_rule){
+                         update_bounds();
+                     };
+    polygon::polygon(const Color &fill,
+                     std::vector<Point> &&points,
+                     FillRule fill_rule)
+                     :SVGElement(fill),points(std::move(points)),fill_rule(fill_rule){
+                         update_bounds();
+                     };
+    //! with an opacity, the fill and the stroke are drawn together in a layer and blended as a whole,
+    //! otherwise the fill would show through the part of the stroke that covers it
+    bool polygon::layered() const{
+        return alpha_ != 255 && alpha_ != 0 && stroked && fill_alpha != 0 && stroke_alpha != 0;
+    }
+    void polygon::draw(PNGImage &img, const Point &origin) const{
+        if (layered()) {
+            draw_layer(img, origin, bounds(), alpha_, [this](PNGImage &layer, const Point &corner) {
+                draw_shape(layer, corner, 255);
+            });
+        } else {
+            draw_shape(img, origin, alpha_);
+        }
+    }
+    //! we use our own scanline rasterizer (Raster.hpp) since draw_polygon does not know about fill-rule
+    void polygon::draw_shape(PNGImage &img, const Point &origin, uint8_t alpha) const{
+        fill_polygon(img, moved(points.data(), points.size(), origin), points.size(), fill_, fill_rule, image_box(img),
+                     multiply_alpha(alpha, fill_alpha));
+        draw_stroke(img, origin, alpha);
+    }
+    void polygon::setStroke(const Color &stroke, const StrokeStyle &style, uint8_t alpha) {
+        this->stroke = stroke;
+        stroke_style = style;
+        stroke_alpha = alpha;
+        stroked = true;
+        update_bounds();
+    }
+    //! the outline is stroked as a closed polyline, the joins go all the way around
+    void polygon::draw_stroke(PNGImage &img, const Point &origin, uint8_t alpha) const{
+        if (stroked) {
+            svg::draw_stroke(img, moved(points.data(), points.size(), origin), points.size(), true, stroke_style, stroke,
+                             image_box(img), multiply_alpha(alpha, stroke_alpha));
+        }
+    }
+    void polygon::compile_stroke(CompiledScene &out, uint8_t alpha) const {
+        if (stroked) {
+            out.add_polyline(points, stroke, multiply_alpha(alpha, stroke_alpha), stroke_style, true);
+        }
     }
     
     void polygon::translate(const Point &dir) {
-        for(Point &point : points){
-            point = point.translate(dir);
-        }
+        Transform::translate(dir.x, dir.y).apply(points);
+        update_bounds();
     }
     void polygon::rotate(const Point &origin, int degrees) {
-        for (Point &point : points){
-            point = point.rotate(origin,degrees);
-        }
+        Transform::rotate(degrees, origin.x, origin.y).apply(points);
+        update_bounds();
     }
     void polygon::scale(const Point &origin, int factor) {
-        for(Point &point : points){
-            point = point.scale(origin,factor);
+        scale_about(origin, factor).apply(points);
+        stroke_style.width *= std::abs(factor);
+        update_bounds();
+    }
+    void polygon::transform(const Transform &m) {
+        m.apply(points);
+        stroke_style.width *= length_scale(m);
+        update_bounds();
+    }
+    //! a layered element is a layer of the compiled scene too, with its fill and stroke inside
+    void polygon::compile(CompiledScene &out) const {
+        if (layered()) {
+            CompiledScene content;
+            content.dimensions = out.dimensions;
+            content.subpixel_bits = out.subpixel_bits;
+            compile_shape(content, 255);
+            out.add_layer(std::move(content), alpha_);
+        } else {
+            compile_shape(out, alpha_);
+        }
+    }
+    void polygon::compile_shape(CompiledScene &out, uint8_t alpha) const {
+        out.add_polygon(points, fill_, fill_rule, multiply_alpha(alpha, fill_alpha));
+        compile_stroke(out, alpha);
+    }
+    SVGElement *polygon::clone() const {
+        return new polygon(*this);
+    }
+    void polygon::update_bounds() {
+        bounds_ = points_bounds(points);
+        if (stroked) {
+            bounds_ = grow(bounds_, stroke_style.reach());
         }
     }
 
@@ -176,57 +435,346 @@ namespace svg
                 {upper_left_corner.x + width - 1, upper_left_corner.y + height - 1}, 
                 {upper_left_corner.x, upper_left_corner.y + height - 1}
                }) {};
-    void rect::draw(PNGImage &img) const{
-        img.draw_polygon(points,fill);
+    //! an axis aligned rectangle doesn't need the edge processing, it is just filled row by row
+    void rect::draw_shape(PNGImage &img, const Point &origin, uint8_t alpha) const{
+        uint8_t fill_opacity = multiply_alpha(alpha, fill_alpha);
+        if (axis_aligned()) {
+            Box box = {points[0].x - origin.x, points[0].y - origin.y, points[2].x + 1 - origin.x, points[2].y + 1 - origin.y};
+            fill_rect(img, box, fill_, image_box(img), fill_opacity);
+        } else {
+            fill_polygon(img, moved(points.data(), points.size(), origin), points.size(), fill_, fill_rule, image_box(img),
+                         fill_opacity);
+        }
+        draw_stroke(img, origin, alpha);
+    }
+    bool rect::axis_aligned() const {
+        const Point &p0 = points[0];
+        const Point &p2 = points[2];
+        return points[1].y == p0.y && points[1].x == p2.x && points[3].x == p0.x && points[3].y == p2.y
+            && p2.x >= p0.x && p2.y >= p0.y;
     }
     //! we can do this way in the rectangle since it will go over a vector of points
     //! just like in the case of the polygon
     void rect::translate(const Point &dir) {
-        for(Point &point : points){
-            point = point.translate(dir);
-        }
+        Transform::translate(dir.x, dir.y).apply(points);
+        update_bounds();
     }
     void rect::rotate(const Point &origin, int degrees) {
-        for (Point &point : points){
-            point = point.rotate(origin,degrees);  
-        }
+        Transform::rotate(degrees, origin.x, origin.y).apply(points);
+        update_bounds();
     }
     void rect::scale(const Point &origin, int factor) {
-        for(Point &point : points){
-            point = point.scale(origin,factor);
+        scale_about(origin, factor).apply(points);
+        stroke_style.width *= std::abs(factor);
+        update_bounds();
+    }
+    void rect::transform(const Transform &m) {
+        m.apply(points);
+        stroke_style.width *= length_scale(m);
+        update_bounds();
+    }
+    //! the rectangle stays a rectangle while it is only translated or scaled, in that case
+    //! we keep it as a corner and a size, otherwise (rotated or skewed) it is a polygon
+    void rect::compile_shape(CompiledScene &out, uint8_t alpha) const {
+        const Point &p0 = points[0];
+        const Point &p2 = points[2];
+        uint8_t fill_opacity = multiply_alpha(alpha, fill_alpha);
+        if (axis_aligned()) {
+            out.add_rect(p0, {p2.x - p0.x + 1, p2.y - p0.y + 1}, fill_, fill_opacity);
+        } else {
+            out.add_polygon(points, fill_, fill_rule, fill_opacity);
         }
+        compile_stroke(out, alpha);
     }
+    SVGElement *rect::clone() const {
+        return new rect(*this);
+    }
+
 
+    //! path implementation
+    //! the vertices of the curves are computed once, in the constructor, and then moved with the path
+
+    path::path(const Color &fill, PathData data, FillRule fill_rule, double tolerance)
+        : polygon(fill, {}, fill_rule), data(std::move(data)), tolerance(tolerance), error(tolerance)
+    {
+        flatten();
+    }
+    void path::flatten() {
+        flat.clear();
+        flatten_path(data, tolerance, flat);
+        error = tolerance;
+        flattenings_++;
+        round_points();
+    }
+    void path::round_points() {
+        points.resize(flat.points.size());
+        for (size_t i = 0; i < points.size(); i++) {
+            points[i] = {static_cast<int>(std::lround(flat.points[i].x)), static_cast<int>(std::lround(flat.points[i].y))};
+        }
+        update_bounds();
+    }
+    //! all the subpaths are filled together (so they can make holes) and stroked together
+    void path::draw_shape(PNGImage &img, const Point &origin, uint8_t alpha) const{
+        const Point *vertices = moved(points.data(), points.size(), origin);
+        uint8_t fill_opacity = multiply_alpha(alpha, fill_alpha);
+        if (fill_opacity != 0) {
+            fill_contours(img, vertices, flat.ends.data(), flat.ends.size(), 0, fill_, fill_rule, image_box(img), fill_opacity);
+        }
+        if (stroked) {
+            svg::draw_stroke(img, vertices, flat.ends.data(), flat.closed.data(), flat.ends.size(), stroke_style,
+                             stroke, image_box(img), multiply_alpha(alpha, stroke_alpha));
+        }
+    }
+    //! a translation does not change the shape, the vertices are just moved
+    void path::translate(const Point &dir) {
+        transform(Transform::translate(dir.x, dir.y));
+    }
+    void path::rotate(const Point &origin, int degrees) {
+        transform(Transform::rotate(degrees, origin.x, origin.y));
+    }
+    void path::scale(const Point &origin, int factor) {
+        transform(scale_about(origin, factor));
+    }
+    //! the distance between the vertices and the curves is multiplied by at most the stretch of m,
+    //! so the cached vertices are kept while that stays between tolerance / 4 and tolerance
+    void path::transform(const Transform &m) {
+        data.transform(m);
+        stroke_style.width *= length_scale(m);
+        double stretched = error * max_stretch(m);
+        if (stretched > tolerance * 1.0001 || stretched < tolerance / 4) {
+            flatten();
+            return;
+        }
+        error = stretched;
+        for (PathPoint &p : flat.points) {
+            p = {m.a * p.x + m.c * p.y + m.e, m.b * p.x + m.d * p.y + m.f};
+        }
+        round_points();
+    }
+    void path::compile_shape(CompiledScene &out, uint8_t alpha) const {
+        uint8_t stroke_opacity = stroked ? multiply_alpha(alpha, stroke_alpha) : 0;
+        out.add_path(points, flat.ends, flat.closed, fill_, fill_rule, multiply_alpha(alpha, fill_alpha),
+                     stroke, stroke_opacity, stroke_style);
+    }
+    SVGElement *path::clone() const {
+        return new path(*this);
+    }
 
     Group::Group(const std::vector<SVGElement*> &elements, const std::string &id)
-        : elements(elements), id_(id)
+        : storage(elements), elements(storage.data()), count(storage.size())
     {
+        id_ = id;
     };
 
-    void Group::draw(PNGImage &img) const{
-        for(const SVGElement *element: elements){
-            element->draw(img);
+    Group::Group(SVGElement *const *elements, size_t count, const std::string &id)
+        : elements(elements), count(count)
+    {
+        id_ = id;
+    };
+
+    //! the children that are completely outside the image are not drawn
+    void Group::draw(PNGImage &img, const Point &origin) const{
+        Box canvas = canvas_box(img, origin);
+        if (alpha_ == 255) {
+            for(size_t i = 0; i < count; i++){
+                if (elements[i]->bounds().intersects(canvas)) {
+                    elements[i]->draw(img, origin);
+                }
+            }
+            return;
         }
+        //!otherwise the children are drawn together in a layer (only the visible part of the group),
+        //!so where they overlap the one on top hides the other and the group is then blended as a whole
+        draw_layer(img, origin, bounds(), alpha_, [this](PNGImage &layer, const Point &corner) {
+            Box visible = canvas_box(layer, corner);
+            for(size_t i = 0; i < count; i++){
+                if (elements[i]->bounds().intersects(visible)) {
+                    elements[i]->draw(layer, corner);
+                }
+            }
+        });
+    }
+
+    //! the children can be changed directly, so the box is computed every time
+    Box Group::bounds() const{
+        Box b = {0, 0, 0, 0};
+        for(size_t i = 0; i < count; i++){
+            b = b.unite(elements[i]->bounds());
+        }
+        return b;
     }
 
     void Group::translate(const Point &dir) {
         //!Translate each element in the group
-        for(SVGElement *element: elements){
-            element->translate(dir);
+        for(size_t i = 0; i < count; i++){
+            elements[i]->translate(dir);
         }
     }
 
     void Group::rotate(const Point &origin, int degrees) {
         //!Rotate each element in the group
-        for(SVGElement *element: elements){
-            element->rotate(origin, degrees);
+        for(size_t i = 0; i < count; i++){
+            elements[i]->rotate(origin, degrees);
         }
     }
 
     void Group::scale(const Point &origin, int factor) {
         //!Scale each element in the group
-        for(SVGElement *element: elements){
-            element->scale(origin, factor);
+        for(size_t i = 0; i < count; i++){
+            elements[i]->scale(origin, factor);
+        }
+    }
+
+    void Group::transform(const Transform &m) {
+        //!Transform each element in the group
+        for(size_t i = 0; i < count; i++){
+            elements[i]->transform(m);
+        }
+    }
+
+    //!an opaque group is flattened, its children are added in place of the group, in the same order;
+    //!a group with alpha becomes a layer of the compiled scene, blended as a whole like draw() does
+    void Group::compile(CompiledScene &out) const {
+        if (alpha_ == 255) {
+            for(size_t i = 0; i < count; i++){
+                elements[i]->compile(out);
+            }
+            return;
+        }
+        if (alpha_ == 0) {
+            return;
+        }
+        CompiledScene content;
+        content.dimensions = out.dimensions;
+        content.subpixel_bits = out.subpixel_bits;
+        for(size_t i = 0; i < count; i++){
+            elements[i]->compile(content);
+        }
+        out.add_layer(std::move(content), alpha_);
+    }
+
+    SVGElement *Group::clone() const {
+        //!the copy owns the copies of the children
+        Group *copy = new Group(std::vector<SVGElement *>(), id_);
+        for(size_t i = 0; i < count; i++){
+            copy->clones.emplace_back(elements[i]->clone());
+            copy->storage.push_back(copy->clones.back().get());
+        }
+        copy->elements = copy->storage.data();
+        copy->count = copy->storage.size();
+        copy->alpha_ = alpha_;
+        return copy;
+    }
+
+    //! Symbol implementation
+    Symbol::Symbol(const SVGElement *element, bool owned)
+        : element_(element), owned_(owned)
+    {
+    }
+
+    Symbol::~Symbol() {
+        if (owned_) {
+            delete element_;
+        }
+    }
+
+    //!the element is drawn twice, over black and over white, and kept as a Layer
+    void Symbol::rasterize() const {
+        layer_.box = element_->bounds();
+        if (layer_.box.empty()) {
+            return;
+        }
+        int width = layer_.box.x1 - layer_.box.x0;
+        int height = layer_.box.y1 - layer_.box.y0;
+        Point corner = {layer_.box.x0, layer_.box.y0};
+        PNGImage white(width, height);
+        PNGImage black(width, height);
+        fill_rect(white, image_box(white), {255, 255, 255}, image_box(white));
+        fill_rect(black, image_box(black), {0, 0, 0}, image_box(black));
+        element_->draw(white, corner);
+        element_->draw(black, corner);
+        layer_.capture(black, white);
+    }
+
+    void Symbol::blit(PNGImage &img, const Point &offset, uint8_t opacity) const {
+        std::call_once(rasterized_, [this] {rasterize();});
+        layer_.composite(img, offset, opacity);
+    }
+
+    //! Use implementation
+    Use::Use(std::shared_ptr<const Symbol> symbol, const Transform &m)
+        : SVGElement(), symbol(std::move(symbol)), m(m)
+    {
+        update_bounds();
+    }
+
+    std::unique_ptr<SVGElement> Use::placed() const {
+        std::unique_ptr<SVGElement> copy(symbol->element().clone());
+        copy->transform(m);
+        copy->setAlpha(multiply_alpha(copy->alpha(), alpha_));
+        return copy;
+    }
+
+    void Use::draw(PNGImage &img, const Point &origin) const {
+        if (m.is_translation()) {
+            //!the points are integers, so moving them by the rounded offset is what transform() would do
+            Point offset = {static_cast<int>(std::nearbyint(m.e)) - origin.x, static_cast<int>(std::nearbyint(m.f)) - origin.y};
+            symbol->blit(img, offset, alpha_);
+        } else {
+            placed()->draw(img, origin);
+        }
+    }
+
+    void Use::translate(const Point &dir) {
+        transform(Transform::translate(dir.x, dir.y));
+    }
+    void Use::rotate(const Point &origin, int degrees) {
+        transform(Transform::rotate(degrees, origin.x, origin.y));
+    }
+    void Use::scale(const Point &origin, int factor) {
+        transform(scale_about(origin, factor));
+    }
+    void Use::transform(const Transform &t) {
+        m = t * m;
+        update_bounds();
+    }
+
+    //!a use only moved by whole pixels is drawn from the pixels of its symbol, so it is compiled as a layer of
+    //!the symbol element with the same offset, which gives the same pixels as draw()
+    void Use::compile(CompiledScene &out) const {
+        if (m.is_translation() && out.subpixel_bits == 0) {
+            CompiledScene content;
+            content.dimensions = out.dimensions;
+            symbol->element().compile(content);
+            out.add_layer(std::move(content), alpha_, {static_cast<int>(std::nearbyint(m.e)), static_cast<int>(std::nearbyint(m.f))});
+            return;
+        }
+        placed()->compile(out);
+    }
+
+    SVGElement *Use::clone() const {
+        return new Use(*this);
+    }
+
+    //!the box of the symbol element moved by m (for a rotation, the box around its four corners)
+    void Use::update_bounds() {
+        Box b = symbol->element().bounds();
+        if (b.empty()) {
+            bounds_ = b;
+            return;
+        }
+        if (m.is_translation()) {
+            int dx = static_cast<int>(std::nearbyint(m.e));
+            int dy = static_cast<int>(std::nearbyint(m.f));
+            bounds_ = {b.x0 + dx, b.y0 + dy, b.x1 + dx, b.y1 + dy};
+            return;
         }
+        std::vector<Point> corners = {{b.x0, b.y0}, {b.x1, b.y0}, {b.x1, b.y1}, {b.x0, b.y1}};
+        m.apply(corners);
+        bounds_ = points_bounds(corners);
+        bounds_.x0 -= 1; //!one more pixel on each side for the rounding of the points
+        bounds_.y0 -= 1;
+        bounds_.x1 += 1;
+        bounds_.y1 += 1;
     }
 }
@@ -5,7 +5,16 @@
 #include "Color.hpp"
 #include "Point.hpp"
 #include "PNGImage.hpp"
+#include "Transform.hpp"
+#include "Raster.hpp"
+#include "Stroke.hpp"
+#include "Path.hpp"
+#include <cstdint>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
 
 namespace svg
 {
@@ -13,45 +22,80 @@ namespace svg
     //! move pixels by a decimal value
     //! we implemented the translate, rotate and scale functions
 
+    class CompiledScene;
+
     class SVGElement
     {
 
     public:
         SVGElement();
+        explicit SVGElement(const Color &fill); //!the fill (or the stroke, for lines) is kept only here, not in each subclass
         virtual ~SVGElement();
-        virtual void draw(PNGImage &img) const = 0; //!the draw function
+        //!draws the element with the pixel (x, y) of the document at (x - origin.x, y - origin.y) of img, so a part
+        //!of the document can be drawn in a smaller image; drawing never changes the element, so several
+        //!threads can draw the same elements at once
+        virtual void draw(PNGImage &img, const Point &origin) const = 0;
+        void draw(PNGImage &img) const {draw(img, {0, 0});} //!the draw function
         virtual void translate(const Point &dir) = 0; //! the direction it will move
         virtual void rotate(const Point &center, int angle) = 0; //!the center of rotation and the angle of rotation
         virtual void scale(const Point &center, int factor) = 0; //! sx and sy represent the scale factors in both x and y
+        virtual void transform(const Transform &m) = 0; //! applies a whole affine matrix at once (see Transform.hpp)
         const std::string &getId() const {return id_;} //! get the id
+        void setId(const std::string &id) {id_ = id;} //! set by readSVG from the id attribute
         virtual std::string getType() const = 0;
+        virtual void compile(CompiledScene &out) const = 0; //! appends the element to the data oriented form of the scene
+        virtual SVGElement *clone() const = 0; //! a new copy of the element (a group copies its children too)
+        virtual Box bounds() const {return bounds_;} //! the pixels the element can touch, kept up to date by the transformations
+        uint8_t alpha() const {return alpha_;} //! the opacity, 0 (transparent) to 255 (opaque)
+        void setAlpha(uint8_t alpha) {alpha_ = alpha;} //! set by readSVG from opacity, fill-opacity/stroke-opacity and rgba()
 
     protected:
         Color fill_;
         std::string id_;
+        Box bounds_ = {0, 0, 0, 0};
+        uint8_t alpha_ = 255; //! a group with alpha is drawn in a layer that is then composited with it
     };
 
 
+    //! a <use> can refer to any element of the document, before or after it; the element it draws has only its
+    //! own transform, not the ones of the <g> around it
     void readSVG(const std::string &svg_file,
                  Point &dimensions,
                  std::vector<SVGElement *> &svg_elements);
+    //! streaming version of readSVG, each element is handed to on_element (which takes ownership)
+    //! as soon as its tag closes, without ever loading the whole document in memory
+    //! so a <use> can only refer to an element of a <defs> that came before it
+    //! the children of a <g> without opacity are handed one by one, with the transform and the attributes
+    //! of the <g> applied (there is no Group for it); a <g> with opacity is handed whole, as a Group
+    void streamSVG(const std::string &svg_file,
+                   Point &dimensions,
+                   const std::function<void(SVGElement *)> &on_element);
     void convert(const std::string &svg_file,
                  const std::string &png_file);
 
+    //! draws an ellipse whose x radius makes angle degrees with the x axis
+    void draw_ellipse(PNGImage &img, const Point &center, const Point &radius, double angle, const Color &fill,
+                      uint8_t alpha = 255);
+
     class Ellipse : public SVGElement
     {
     public:
-        Ellipse(const Color &fill, const Point &center, const Point &radius);
-        void draw(PNGImage &img) const override;
+        Ellipse(const Color &fill, const Point &center, const Point &radius, double angle = 0);
+        using SVGElement::draw;
+        void draw(PNGImage &img, const Point &origin) const override;
         void translate(const Point &dir) override;
         void rotate(const Point &origin, int degrees) override;
         void scale(const Point &origin, int factor) override;
+        void transform(const Transform &m) override;
         std::string getType() const override {return "Ellipse";}
+        void compile(CompiledScene &out) const override;
+        SVGElement *clone() const override;
 
     protected://change from private to protected since we are likely to use these attributes again
-        Color fill;
         Point center;
         Point radius;
+        double angle; //!the orientation of the x radius, in degrees, after rotations and skews
+        void update_bounds();
     };
 
 //!Now circle will be a subclass of the ellipse class
@@ -59,11 +103,15 @@ namespace svg
     class Circle : public Ellipse{
     public:
         Circle (const Color &fill, const Point &center, const Point &radius);//!circle will share fill, center, and radius with the ellipse
-        void draw(PNGImage &img) const override;
+        using SVGElement::draw;
+        void draw(PNGImage &img, const Point &origin) const override;
         void translate(const Point &dir) override;
         void rotate(const Point &origin, int degrees) override;
         void scale(const Point &origin, int factor) override;
+        void transform(const Transform &m) override;
         std::string getType() const override {return "Circle";}
+        void compile(CompiledScene &out) const override;
+        SVGElement *clone() const override;
 
 //!in this case is not necessary to declare fill, radius and center again since ellipse is the "super class" and
 //!circle will natively keep those variables, so there is no need to declare them again
@@ -76,28 +124,41 @@ namespace svg
     class polyline : public SVGElement{
         public:
             polyline (const Color &fill, const std::vector<Point> &points);
-            void draw(PNGImage &img) const override;
+            polyline (const Color &fill, std::vector<Point> &&points);
+            using SVGElement::draw;
+            void draw(PNGImage &img, const Point &origin) const override;
             void translate(const Point &dir) override;
             void rotate(const Point &origin, int degrees) override;
             void scale(const Point &origin, int factor) override;
+            void transform(const Transform &m) override;
             std::string getType() const override {return "polyline";}
+            void compile(CompiledScene &out) const override;
+            SVGElement *clone() const override;
+            void setStroke(const StrokeStyle &style); //!stroke-width, stroke-linejoin and stroke-linecap
         protected:
-            Color fill;
             std::vector<Point> points;//!we declare the vector of points of type Point
+            StrokeStyle stroke_style; //!the whole polyline is stroked as one outline (see Stroke.hpp)
+            void update_bounds();
     };
 
     class line : public SVGElement{
         public:
             line(const Point &start, const Point &end, const Color &fill);
-            void draw(PNGImage &img) const override;//!we again override the draw function
+            using SVGElement::draw;
+            void draw(PNGImage &img, const Point &origin) const override;//!we again override the draw function
             void translate(const Point &dir) override;
             void rotate(const Point &origin, int degrees) override;
             void scale(const Point &origin, int factor) override;
+            void transform(const Transform &m) override;
             std::string getType() const override {return "line";}
+            void compile(CompiledScene &out) const override;
+            SVGElement *clone() const override;
+            void setStroke(const StrokeStyle &style); //!stroke-width and stroke-linecap
         protected:
             Point start;//!the starting point with x1 and y1
             Point end;//!the end point with x2 and y2
-            Color fill; //!the stroke
+            StrokeStyle stroke_style;
+            void update_bounds();
     };
 
     //! polygon class is a subclass of SVGElement
@@ -105,15 +166,36 @@ namespace svg
     //! and will also have a stroke color, the fill parameter
     class polygon : public SVGElement{
         public:
-            polygon(const Color &fill, const std::vector<Point> &points);
-            void draw(PNGImage &img) const override;
+            polygon(const Color &fill, const std::vector<Point> &points, FillRule fill_rule = FillRule::nonzero);
+            polygon(const Color &fill, std::vector<Point> &&points, FillRule fill_rule = FillRule::nonzero);
+            using SVGElement::draw;
+            void draw(PNGImage &img, const Point &origin) const override;
             void translate(const Point &dir) override;
             void rotate(const Point &origin, int degrees) override;
             void scale(const Point &origin, int factor) override;
+            void transform(const Transform &m) override;
             std::string getType() const override {return "polygon";}
+            void compile(CompiledScene &out) const override;
+            SVGElement *clone() const override;
+            //!the alpha of the fill alone (fill-opacity and rgba()), multiplied by the alpha of the element
+            void setFillAlpha(uint8_t alpha) {fill_alpha = alpha;}
+            //!strokes the outline too, over the fill; alpha is multiplied by the alpha of the element
+            void setStroke(const Color &stroke, const StrokeStyle &style, uint8_t alpha = 255);
         protected:
-            Color fill;
             std::vector<Point> points;
+            FillRule fill_rule; //!how self intersecting polygons are filled, the fill-rule attribute
+            uint8_t fill_alpha = 255;
+            bool stroked = false; //!the outline is only drawn when the stroke attribute is a color
+            Color stroke;
+            uint8_t stroke_alpha = 255;
+            StrokeStyle stroke_style;
+            void update_bounds();
+            bool layered() const; //!true when the fill and the stroke are drawn in a layer, see draw()
+            //!the fill and the stroke, with alpha as the opacity of the element (255 inside a layer)
+            virtual void draw_shape(PNGImage &img, const Point &origin, uint8_t alpha) const;
+            virtual void compile_shape(CompiledScene &out, uint8_t alpha) const;
+            void draw_stroke(PNGImage &img, const Point &origin, uint8_t alpha) const;
+            void compile_stroke(CompiledScene &out, uint8_t alpha) const;
     };
 
     //! the class rect which is a subclass of polygon
@@ -126,19 +208,51 @@ namespace svg
     class rect : public polygon{
         public:
             rect(const Color &fill,const Point &upper_left_corner, const int &width, const int &height);
-            void draw(PNGImage &img) const override;
             void translate(const Point &dir) override;
             void rotate(const Point &origin, int degrees) override;
             void scale(const Point &origin, int factor) override;
+            void transform(const Transform &m) override;
             std::string getType() const override {return "rect";}
+            SVGElement *clone() const override;
+            bool axis_aligned() const; //!true while the rectangle was only translated or scaled
 
         protected:
+            void draw_shape(PNGImage &img, const Point &origin, uint8_t alpha) const override;
+            void compile_shape(CompiledScene &out, uint8_t alpha) const override;
 
             Point upper_left_corner;
             int width;
             int height;
     };
 
+    //! the path element, a subclass of polygon since it is filled and stroked the same way
+    //! the curves are kept as parsed (in doubles) and flattened once into the vertices that are drawn;
+    //! the transformations are applied to both, and the curves are only flattened again when a
+    //! transformation stretches (or shrinks) the vertices too far from the tolerance they were made for
+    class path : public polygon{
+        public:
+            //! tolerance is how far the vertices can be from the curves, in the units of data
+            path(const Color &fill, PathData data, FillRule fill_rule, double tolerance);
+            void translate(const Point &dir) override;
+            void rotate(const Point &origin, int degrees) override;
+            void scale(const Point &origin, int factor) override;
+            void transform(const Transform &m) override;
+            std::string getType() const override {return "path";}
+            SVGElement *clone() const override;
+            size_t flattenings() const {return flattenings_;} //!how many times the curves were flattened
+
+        protected:
+            void draw_shape(PNGImage &img, const Point &origin, uint8_t alpha) const override;
+            void compile_shape(CompiledScene &out, uint8_t alpha) const override;
+            PathData data; //!the curves
+            FlatPath flat; //!the cached vertices of the curves, points (of polygon) is the same rounded to units
+            double tolerance;
+            double error; //!how far flat can be from the curves, tolerance when it was flattened
+            size_t flattenings_ = 0;
+            void flatten();
+            void round_points();
+    };
+
     //!now we do the group class
     //!this will have a vector os elements and a string id
     //!the draw function which draws in the png file
@@ -147,16 +261,67 @@ namespace svg
 
     class Group : public SVGElement{
     public:
+        //! the group keeps its own copy of the vector of elements (it does not own the elements)
         Group(const std::vector<SVGElement *>&elements,const std::string &id);
-        void draw(PNGImage &img) const override;
+        //! the group only points to count elements stored somewhere else, e.g. in a Scene arena
+        Group(SVGElement *const *elements, size_t count, const std::string &id);
+        Group(const Group &) = delete; //!elements may point into storage, so copying would leave it dangling
+        Group &operator=(const Group &) = delete;
+        using SVGElement::draw;
+        void draw(PNGImage &img, const Point &origin) const override;
         void translate(const Point &dir) override; //! the direction of the translation, which will be of type point, an x and y value
         void rotate(const Point &origin, int degrees) override; //!the origin of rotation and the degrees of rotation
         void scale(const Point &origin, int factor) override; //!the origin of the scale and the factor which will be s int value
+        void transform(const Transform &m) override; //!applies the matrix to every element in the group
         std::string getType() const override {return "Group";}
+        void compile(CompiledScene &out) const override;
+        SVGElement *clone() const override;
+        Box bounds() const override; //!the union of the boxes of the children
     protected:
-        const std::vector<SVGElement *> &elements;
-        const std::string &id_;
+        std::vector<SVGElement *> storage; //!only used by the vector constructor
+        SVGElement *const *elements; //!the children, contiguous in memory
+        size_t count;
+        std::vector<std::unique_ptr<SVGElement>> clones; //!the children of a group made by clone(), which it owns
+    };
+    //!an element that is drawn through <use>, shared by all the uses of the same id
+    //!the element is drawn once in an offscreen image (the first time a use needs it) and then
+    //!every use that is only translated copies those pixels instead of drawing the element again
+    class Symbol{
+    public:
+        Symbol(const SVGElement *element, bool owned); //!owned: the symbol deletes element (when it was made with new)
+        ~Symbol();
+        Symbol(const Symbol &) = delete;
+        Symbol &operator=(const Symbol &) = delete;
+        const SVGElement &element() const {return *element_;}
+        //!the same pixels as drawing the element moved by offset, with its alpha multiplied by opacity
+        void blit(PNGImage &img, const Point &offset, uint8_t opacity = 255) const;
+    private:
+        void rasterize() const;
+        const SVGElement *element_;
+        bool owned_;
+        mutable std::once_flag rasterized_;
+        mutable Layer layer_; //!the cached pixels, the box is in the coordinates of the element
+    };
+
+    //!the <use> element: the element of a Symbol with a transformation of its own
+    //!the symbol element is never changed, the transformations only change the matrix of the use
+    class Use : public SVGElement{
+    public:
+        Use(std::shared_ptr<const Symbol> symbol, const Transform &m);
+        using SVGElement::draw;
+        void draw(PNGImage &img, const Point &origin) const override; //!blits the cached pixels if the matrix is a translation, draws a copy otherwise
+        void translate(const Point &dir) override;
+        void rotate(const Point &origin, int degrees) override;
+        void scale(const Point &origin, int factor) override;
+        void transform(const Transform &m) override;
+        std::string getType() const override {return "use";}
+        void compile(CompiledScene &out) const override;
+        SVGElement *clone() const override;
+    protected:
+        std::shared_ptr<const Symbol> symbol;
+        Transform m; //!from the coordinates of the symbol element to the image
+        void update_bounds();
+        std::unique_ptr<SVGElement> placed() const; //!a copy of the symbol element with m applied
     };
 };
 #endif
-
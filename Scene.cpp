@@ -0,0 +1,36 @@
+#include "Scene.hpp"
+#include "Render.hpp"
+#include "CompiledScene.hpp"
+
+namespace svg
+{
+    //! the arena starts with 64 KB and then grows geometrically, so a document with millions of
+    //! elements only does a few dozen real allocations
+    Scene::Scene() : arena_(64 * 1024) {}
+
+    //! the elements still have to be destroyed, because some of them own vectors of points,
+    //! but their own memory is released by the arena in one go
+    Scene::~Scene() {
+        for (auto it = owned_.rbegin(); it != owned_.rend(); ++it) {
+            (*it)->~SVGElement();
+        }
+    }
+
+    SVGElement **Scene::make_array(size_t n) {
+        void *memory = arena_.allocate(n * sizeof(SVGElement *), alignof(SVGElement *));
+        return static_cast<SVGElement **>(memory);
+    }
+
+    void Scene::draw(PNGImage &img) const {
+        if (subpixel_bits != 0) {
+            compile(elements, dimensions, subpixel_bits).draw(img);
+            return;
+        }
+        render(elements, img);
+    }
+
+    SVGElement *Scene::find(const std::string &id) const {
+        auto it = ids.find(id);
+        return it == ids.end() ? nullptr : it->second;
+    }
+}
@@ -0,0 +1,63 @@
+//! @file Scene.hpp
+#ifndef __svg_Scene_hpp__
+#define __svg_Scene_hpp__
+
+#include "SVGElements.hpp"
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace svg
+{
+    //! a parsed SVG document that owns all of its elements
+    //! the elements are not allocated one by one with new, they are placed one after the other in an
+    //! arena (a monotonic buffer that only grows), so the children of a group end up next to each other
+    //! in memory and all the memory is given back at once when the scene is destroyed
+    class Scene
+    {
+    public:
+        Scene();
+        ~Scene();
+        Scene(const Scene &) = delete;
+        Scene &operator=(const Scene &) = delete;
+
+        //! constructs an element of type T in the arena, the scene will destroy it
+        template <class T, class... Args>
+        T *make(Args &&...args)
+        {
+            void *memory = arena_.allocate(sizeof(T), alignof(T));
+            T *element = new (memory) T(std::forward<Args>(args)...);
+            owned_.push_back(element);
+            return element;
+        }
+
+        //! an array of n element pointers in the arena, used for the children of a group
+        SVGElement **make_array(size_t n);
+
+        void draw(PNGImage &img) const; //! draws the top level elements in order, skipping the ones outside img
+
+        Point dimensions = {0, 0}; //! the width and height of the root <svg>
+        //! set before reading to keep subpixel coordinates: the elements then use 1/2^subpixel_bits of a pixel
+        //! as unit (8 gives 24.8 fixed point), so nothing is rounded to whole pixels by the parse or the
+        //! transforms, and draw() goes through an anti-aliased CompiledScene (the elements can't draw
+        //! themselves at that scale)
+        int subpixel_bits = 0;
+        std::vector<SVGElement *> elements; //! the top level elements, in document order
+        std::unordered_map<std::string, SVGElement *> ids; //! the elements with an id attribute (also the ones in <defs>)
+
+        SVGElement *find(const std::string &id) const; //! the element with that id, nullptr if there is none
+
+    private:
+        std::pmr::monotonic_buffer_resource arena_;
+        std::vector<SVGElement *> owned_; //! every element made by the scene, to call the destructors
+    };
+
+    //! like readSVG, but all the elements are owned by scene
+    void readSVG(const std::string &svg_file, Scene &scene);
+    //! same thing, but the SVG is already in memory
+    void parseSVG(std::string_view svg_text, Scene &scene);
+}
+#endif
@@ -0,0 +1,503 @@
+#include "SceneCache.hpp"
+#include "Scene.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace svg
+{
+    namespace
+    {
+        const char MAGIC[4] = {'S', 'V', 'G', 'C'};
+
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            SceneCache::Key key;
+            Point dimensions;
+            int32_t subpixel_bits;
+        };
+
+        //! SHA-256 (FIPS 180-4), so two documents never share an entry by accident or on purpose
+        class SHA256
+        {
+        public:
+            void update(const unsigned char *data, size_t size) {
+                length_ += size;
+                while (size > 0) {
+                    size_t n = std::min(size, sizeof(block_) - used_);
+                    std::memcpy(block_ + used_, data, n);
+                    used_ += n;
+                    data += n;
+                    size -= n;
+                    if (used_ == sizeof(block_)) {
+                        compress();
+                        used_ = 0;
+                    }
+                }
+            }
+
+            void digest(uint8_t out[32]) {
+                uint64_t bits = length_ * 8;
+                static const unsigned char pad = 0x80;
+                static const unsigned char zero = 0;
+                update(&pad, 1);
+                while (used_ != 56) {
+                    update(&zero, 1);
+                }
+                unsigned char size[8];
+                for (int i = 0; i < 8; i++) {
+                    size[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+                }
+                update(size, 8);
+                for (int i = 0; i < 8; i++) {
+                    for (int j = 0; j < 4; j++) {
+                        out[4 * i + j] = static_cast<uint8_t>(state_[i] >> (24 - 8 * j));
+                    }
+                }
+            }
+
+        private:
+            static uint32_t rotr(uint32_t x, int n) {return (x >> n) | (x << (32 - n));}
+
+            void compress() {
+                static const uint32_t K[64] = {
+                    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+                uint32_t w[64];
+                for (int i = 0; i < 16; i++) {
+                    w[i] = static_cast<uint32_t>(block_[4 * i]) << 24 | static_cast<uint32_t>(block_[4 * i + 1]) << 16
+                           | static_cast<uint32_t>(block_[4 * i + 2]) << 8 | block_[4 * i + 3];
+                }
+                for (int i = 16; i < 64; i++) {
+                    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+                uint32_t v[8];
+                std::copy(state_, state_ + 8, v);
+                for (int i = 0; i < 64; i++) {
+                    uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+                    uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+                    uint32_t t1 = v[7] + s1 + ch + K[i] + w[i];
+                    uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+                    uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+                    std::copy_backward(v, v + 7, v + 8);
+                    v[4] += t1;
+                    v[0] = t1 + s0 + maj;
+                }
+                for (int i = 0; i < 8; i++) {
+                    state_[i] += v[i];
+                }
+            }
+
+            uint32_t state_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+            unsigned char block_[64] = {};
+            size_t used_ = 0;
+            uint64_t length_ = 0;
+        };
+
+        //! every array is written as its number of elements followed by its bytes, padded to 8 bytes
+        template <class T>
+        void write_array(std::ofstream &out, const std::vector<T> &v) {
+            static_assert(std::is_trivially_copyable<T>::value, "only plain data can be written as bytes");
+            uint64_t count = v.size();
+            out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+            size_t bytes = v.size() * sizeof(T);
+            out.write(reinterpret_cast<const char *>(v.data()), static_cast<std::streamsize>(bytes));
+            static const char padding[8] = {};
+            out.write(padding, static_cast<std::streamsize>((8 - bytes % 8) % 8));
+        }
+
+        //! reads an array written by write_array, returns false if the file is too short
+        template <class T>
+        bool read_array(const char *&p, const char *end, std::vector<T> &v) {
+            uint64_t count;
+            if (end - p < static_cast<ptrdiff_t>(sizeof(count))) {
+                return false;
+            }
+            std::memcpy(&count, p, sizeof(count));
+            p += sizeof(count);
+            size_t bytes = count * sizeof(T);
+            size_t padded = bytes + (8 - bytes % 8) % 8;
+            if (count > static_cast<uint64_t>(end - p) / sizeof(T) || static_cast<size_t>(end - p) < padded) {
+                return false;
+            }
+            v.resize(count);
+            if (bytes > 0) {
+                std::memcpy(v.data(), p, bytes);
+            }
+            p += padded;
+            return true;
+        }
+
+        //! the arrays of a CompiledScene, in file order; f is called with each of them
+        template <class Scene, class F>
+        bool for_each_array(Scene &s, F f) {
+            return f(s.ellipse_center) && f(s.ellipse_radius) && f(s.ellipse_angle) && f(s.ellipse_color) && f(s.ellipse_alpha)
+                && f(s.line_start) && f(s.line_end) && f(s.line_color) && f(s.line_alpha) && f(s.line_style)
+                && f(s.rect_corner) && f(s.rect_size) && f(s.rect_color) && f(s.rect_alpha)
+                && f(s.vertices)
+                && f(s.polyline_begin) && f(s.polyline_end) && f(s.polyline_color) && f(s.polyline_alpha)
+                && f(s.polyline_style) && f(s.polyline_closed)
+                && f(s.polygon_begin) && f(s.polygon_end) && f(s.polygon_color) && f(s.polygon_rule) && f(s.polygon_alpha)
+                && f(s.path_begin) && f(s.path_end) && f(s.path_contours_begin) && f(s.path_contours_end)
+                && f(s.contour_end) && f(s.contour_closed) && f(s.path_color) && f(s.path_alpha) && f(s.path_rule)
+                && f(s.path_stroke_color) && f(s.path_stroke_alpha) && f(s.path_style)
+                && f(s.layer_alpha) && f(s.layer_offset) && f(s.layer_bounds)
+                && f(s.order);
+        }
+
+        //! what comes before the arrays of the scene of a layer
+        struct LayerHeader
+        {
+            Point dimensions;
+            int32_t subpixel_bits;
+            int32_t reserved;
+        };
+
+        //! the layers can be nested (a group with opacity in another one), but not that deep
+        const int MAX_LAYER_DEPTH = 64;
+        //! the offsets and bounds of the layers are added to the corners of the parts drawn, a damaged one
+        //! further than this could overflow them
+        const int MAX_LAYER_COORDINATE = 1 << 28;
+
+        bool layer_coordinate(int x) {
+            return x >= -MAX_LAYER_COORDINATE && x <= MAX_LAYER_COORDINATE;
+        }
+
+        //! the arrays of scene, then the scenes of its layers one after the other, each after a LayerHeader
+        void write_scene(std::ofstream &out, const CompiledScene &scene) {
+            for_each_array(scene, [&](const auto &v) {write_array(out, v); return true;});
+            for (const CompiledScene &content : scene.layer_scene) {
+                LayerHeader header = {content.dimensions, content.subpixel_bits, 0};
+                out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                write_scene(out, content);
+            }
+        }
+
+        bool read_scene(const char *&p, const char *end, CompiledScene &scene, int depth) {
+            if (!for_each_array(scene, [&](auto &v) {return read_array(p, end, v);})) {
+                return false;
+            }
+            size_t layers = scene.layer_alpha.size();
+            if (layers == 0) {
+                return true;
+            }
+            //! every layer takes at least its header, so a damaged count can't allocate much
+            if (depth >= MAX_LAYER_DEPTH || layers > static_cast<size_t>(end - p) / sizeof(LayerHeader)) {
+                return false;
+            }
+            scene.layer_scene.resize(layers);
+            for (CompiledScene &content : scene.layer_scene) {
+                LayerHeader header;
+                if (end - p < static_cast<ptrdiff_t>(sizeof(header))) {
+                    return false;
+                }
+                std::memcpy(&header, p, sizeof(header));
+                p += sizeof(header);
+                content.dimensions = header.dimensions;
+                content.subpixel_bits = header.subpixel_bits;
+                if (!read_scene(p, end, content, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        template <class T>
+        bool same_size(size_t n, const std::vector<T> &v) {
+            return v.size() == n;
+        }
+
+        template <class T, class... More>
+        bool same_size(size_t n, const std::vector<T> &v, const More &... more) {
+            return v.size() == n && same_size(n, more...);
+        }
+
+        //! [begin, end) is a range of an array of size elements
+        bool inside(uint32_t begin, uint32_t end, size_t size) {
+            return begin <= end && end <= size;
+        }
+
+        bool valid_style(const StrokeStyle &style) {
+            return std::isfinite(style.width) && style.width >= 0 && std::isfinite(style.miter_limit)
+                   && static_cast<uint8_t>(style.join) <= static_cast<uint8_t>(LineJoin::bevel)
+                   && static_cast<uint8_t>(style.cap) <= static_cast<uint8_t>(LineCap::square);
+        }
+
+        bool valid_rule(FillRule rule) {
+            return rule == FillRule::nonzero || rule == FillRule::evenodd;
+        }
+
+        //! true if s can be drawn: the parallel arrays of every kind have the same length, and every run,
+        //! vertex range and contour range is inside its arrays (the same for the scenes of the layers),
+        //! so a damaged entry can't make draw() read out of bounds
+        bool drawable(const CompiledScene &s) {
+            if (s.subpixel_bits < 0 || s.subpixel_bits > 16 || s.dimensions.x < 0 || s.dimensions.y < 0) {
+                return false;
+            }
+            size_t ellipses = s.ellipse_center.size();
+            size_t lines = s.line_start.size();
+            size_t rects = s.rect_corner.size();
+            size_t polylines = s.polyline_begin.size();
+            size_t polygons = s.polygon_begin.size();
+            size_t paths = s.path_begin.size();
+            size_t contours = s.contour_end.size();
+            if (!same_size(ellipses, s.ellipse_radius, s.ellipse_angle, s.ellipse_color, s.ellipse_alpha)
+                || !same_size(lines, s.line_end, s.line_color, s.line_alpha, s.line_style)
+                || !same_size(rects, s.rect_size, s.rect_color, s.rect_alpha)
+                || !same_size(polylines, s.polyline_end, s.polyline_color, s.polyline_alpha, s.polyline_style,
+                              s.polyline_closed)
+                || !same_size(polygons, s.polygon_end, s.polygon_color, s.polygon_alpha, s.polygon_rule)
+                || !same_size(paths, s.path_end, s.path_contours_begin, s.path_contours_end, s.path_color, s.path_alpha,
+                              s.path_rule, s.path_stroke_color, s.path_stroke_alpha, s.path_style)
+                || !same_size(contours, s.contour_closed)
+                || !same_size(s.layer_alpha.size(), s.layer_offset, s.layer_bounds, s.layer_scene)) {
+                return false;
+            }
+            for (size_t i = 0; i < s.layer_scene.size(); i++) {
+                const Point &offset = s.layer_offset[i];
+                const Box &b = s.layer_bounds[i];
+                if (!layer_coordinate(offset.x) || !layer_coordinate(offset.y) || !layer_coordinate(b.x0)
+                    || !layer_coordinate(b.y0) || !layer_coordinate(b.x1) || !layer_coordinate(b.y1)
+                    || s.layer_scene[i].subpixel_bits != s.subpixel_bits || !drawable(s.layer_scene[i])) {
+                    return false;
+                }
+            }
+            for (double angle : s.ellipse_angle) {
+                if (!std::isfinite(angle)) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < lines; i++) {
+                if (!valid_style(s.line_style[i])) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < polylines; i++) {
+                if (!inside(s.polyline_begin[i], s.polyline_end[i], s.vertices.size()) || !valid_style(s.polyline_style[i])) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < polygons; i++) {
+                if (!inside(s.polygon_begin[i], s.polygon_end[i], s.vertices.size()) || !valid_rule(s.polygon_rule[i])) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < paths; i++) {
+                if (!inside(s.path_begin[i], s.path_end[i], s.vertices.size())
+                    || !inside(s.path_contours_begin[i], s.path_contours_end[i], contours)
+                    || !valid_rule(s.path_rule[i]) || !valid_style(s.path_style[i])) {
+                    return false;
+                }
+                //! the contours end in order inside the vertices of the path
+                uint32_t previous = 0;
+                for (uint32_t c = s.path_contours_begin[i]; c < s.path_contours_end[i]; c++) {
+                    if (s.contour_end[c] < previous || s.contour_end[c] > s.path_end[i] - s.path_begin[i]) {
+                        return false;
+                    }
+                    previous = s.contour_end[c];
+                }
+            }
+            const size_t counts[] = {ellipses, lines, polylines, polygons, rects, paths, s.layer_alpha.size()};
+            for (const CompiledScene::Run &run : s.order) {
+                if (run.kind > CompiledScene::LAYER || !inside(run.begin, run.end, counts[run.kind])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //! a read only mapping of a whole file
+        struct Mapping
+        {
+            const char *data = nullptr;
+            size_t size = 0;
+            explicit Mapping(const std::string &file) {
+                int fd = open(file.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    return;
+                }
+                struct stat st;
+                if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                    void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (p != MAP_FAILED) {
+                        data = static_cast<const char *>(p);
+                        size = static_cast<size_t>(st.st_size);
+                    }
+                }
+                close(fd);
+            }
+            ~Mapping() {
+                if (data != nullptr) {
+                    munmap(const_cast<char *>(data), size);
+                }
+            }
+        };
+    }
+
+    SceneCache::SceneCache(const std::string &directory, uint64_t max_bytes)
+        : directory_(directory), max_bytes_(max_bytes) {
+        fs::create_directories(directory_);
+    }
+
+    bool SceneCache::Key::operator==(const Key &o) const {
+        return std::memcmp(digest, o.digest, sizeof(digest)) == 0 && length == o.length
+               && subpixel_bits == o.subpixel_bits && reserved == o.reserved;
+    }
+
+    SceneCache::Key SceneCache::key(std::string_view svg_text, int subpixel_bits) {
+        Key k;
+        SHA256 hash;
+        hash.update(reinterpret_cast<const unsigned char *>(svg_text.data()), svg_text.size());
+        hash.digest(k.digest);
+        k.length = svg_text.size();
+        k.subpixel_bits = subpixel_bits;
+        return k;
+    }
+
+    //! the digest in hex and the options, the length is only in the header
+    std::string SceneCache::path(const Key &key) const {
+        std::string name;
+        char hex[3];
+        for (uint8_t byte : key.digest) {
+            snprintf(hex, sizeof(hex), "%02x", byte);
+            name += hex;
+        }
+        return directory_ + "/" + name + "-" + std::to_string(key.subpixel_bits) + ".scene";
+    }
+
+    bool SceneCache::load(const Key &key, CompiledScene &scene) {
+        std::string file = path(key);
+        bool valid = false;
+        {
+            Mapping m(file);
+            if (m.data == nullptr) {
+                return false;
+            }
+            Header header;
+            if (m.size >= sizeof(header)) {
+                std::memcpy(&header, m.data, sizeof(header));
+                valid = std::memcmp(header.magic, MAGIC, 4) == 0 && header.version == FORMAT_VERSION && header.key == key
+                        && header.subpixel_bits == key.subpixel_bits;
+            }
+            if (valid) {
+                const char *p = m.data + sizeof(header);
+                const char *end = m.data + m.size;
+                CompiledScene loaded;
+                loaded.dimensions = header.dimensions;
+                loaded.subpixel_bits = header.subpixel_bits;
+                valid = read_scene(p, end, loaded, 0) && p == end && drawable(loaded);
+                if (valid) {
+                    scene = std::move(loaded);
+                }
+            }
+        }
+        if (!valid) {
+            std::error_code ec;
+            fs::remove(file, ec); //! old format or damaged, it will be written again
+            return false;
+        }
+        //! the modification time is the "last used" time for the LRU eviction
+        utimensat(AT_FDCWD, file.c_str(), nullptr, 0);
+        return true;
+    }
+
+    void SceneCache::store(const Key &key, const CompiledScene &scene) {
+        std::string file = path(key);
+        //! written to a temporary name and then renamed, so a reader never sees half a file
+        std::string tmp = file + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out) {
+                throw std::runtime_error("Unable to write " + tmp);
+            }
+            Header header;
+            std::memcpy(header.magic, MAGIC, 4);
+            header.version = FORMAT_VERSION;
+            header.key = key;
+            header.dimensions = scene.dimensions;
+            header.subpixel_bits = scene.subpixel_bits;
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            write_scene(out, scene);
+            out.close();
+            if (!out) {
+                std::error_code ec;
+                fs::remove(tmp, ec);
+                throw std::runtime_error("Unable to write " + tmp);
+            }
+        }
+        fs::rename(tmp, file);
+        evict();
+    }
+
+    void SceneCache::evict() {
+        struct Entry
+        {
+            fs::path path;
+            fs::file_time_type used;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (const fs::directory_entry &e : fs::directory_iterator(directory_, ec)) {
+            if (e.path().extension() == ".scene") {
+                uint64_t size = e.file_size(ec);
+                entries.push_back({e.path(), e.last_write_time(ec), size});
+                total += size;
+            }
+        }
+        if (total <= max_bytes_) {
+            return;
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {return a.used < b.used;});
+        for (const Entry &e : entries) {
+            if (total <= max_bytes_) {
+                break;
+            }
+            fs::remove(e.path, ec);
+            total -= e.size;
+        }
+    }
+
+    CompiledScene SceneCache::get(const std::string &svg_file, int subpixel_bits) {
+        std::ifstream in(svg_file, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Unable to load " + svg_file);
+        }
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        Key k = key(text, subpixel_bits);
+        CompiledScene compiled;
+        if (load(k, compiled)) {
+            return compiled;
+        }
+        Scene scene;
+        scene.subpixel_bits = subpixel_bits;
+        parseSVG(text, scene);
+        compiled = compile(scene.elements, scene.dimensions, scene.subpixel_bits);
+        store(k, compiled);
+        return compiled;
+    }
+}
@@ -0,0 +1,60 @@
+//! @file SceneCache.hpp
+#ifndef __svg_SceneCache_hpp__
+#define __svg_SceneCache_hpp__
+
+#include "CompiledScene.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace svg
+{
+    //! a cache on disk of compiled scenes, keyed by a hash of the SVG text and the options it was compiled with
+    //! each entry is one file with the arrays of the CompiledScene stored as they are in memory, so loading
+    //! one is a few memcpy from a mapped file, with no XML and no transforms at all
+    //! entries written by another version of the format are ignored (and removed), and when the
+    //! cache grows past max_bytes the entries used least recently are removed
+    //! an entry is checked before it is used (every run and index inside its arrays), so a damaged or
+    //! forged file is removed instead of being drawn
+    class SceneCache
+    {
+    public:
+        //! bump it whenever CompiledScene or the file layout changes
+        static const uint32_t FORMAT_VERSION = 7;
+
+        //! what identifies an entry: the SVG text (its SHA-256 and its length) and the options of compile()
+        //! the whole key is stored in the entry and compared when it is loaded, not only its file name
+        struct Key
+        {
+            uint8_t digest[32] = {};
+            uint64_t length = 0;
+            int32_t subpixel_bits = 0;
+            uint32_t reserved = 0; //! always 0, so the key has no padding
+
+            bool operator==(const Key &o) const;
+            bool operator!=(const Key &o) const {return !(*this == o);}
+        };
+
+        SceneCache(const std::string &directory, uint64_t max_bytes = 256ull << 20);
+
+        //! the key of an SVG text compiled with subpixel_bits
+        static Key key(std::string_view svg_text, int subpixel_bits = 0);
+
+        //! fills scene from the entry of key, returns false if there is no valid entry
+        bool load(const Key &key, CompiledScene &scene);
+        //! writes scene as the entry of key and evicts old entries if needed, throws if it can't be written
+        void store(const Key &key, const CompiledScene &scene);
+
+        //! the compiled scene of svg_file at subpixel_bits, from the cache if possible, otherwise parsed
+        //! and then stored
+        CompiledScene get(const std::string &svg_file, int subpixel_bits = 0);
+
+    private:
+        std::string path(const Key &key) const;
+        void evict();
+
+        std::string directory_;
+        uint64_t max_bytes_;
+    };
+}
+#endif
@@ -0,0 +1,200 @@
+#include "Stats.hpp"
+#include "SVGElements.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <time.h>
+
+namespace svg
+{
+    namespace stats_detail
+    {
+        thread_local StatsCollector *active = nullptr;
+    }
+
+    namespace
+    {
+        const char *const STAGE_NAMES[STAGES] = {"load", "parse", "build", "raster", "encode"};
+        const char *const COUNTER_NAMES[COUNTERS] = {"vertices", "pixels", "allocations", "allocated_bytes",
+                                                     "output_bytes"};
+
+        int64_t wall_now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        //! the CPU time of the calling thread
+        int64_t cpu_now() {
+            timespec t;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+            return static_cast<int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+        }
+
+        //! s as a JSON string, the element types are plain names but a quote or a backslash is escaped
+        std::string json_string(const std::string &s) {
+            std::string out = "\"";
+            for (char c : s) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                }
+                out += c;
+            }
+            return out + "\"";
+        }
+
+        std::string json_number(double x) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.9g", x);
+            return buffer;
+        }
+    }
+
+    const char *stage_name(Stage stage) {
+        return STAGE_NAMES[static_cast<size_t>(stage)];
+    }
+
+    std::string ConvertStats::json() const {
+        std::string out = "{\"stages\": {";
+        for (size_t s = 0; s < STAGES; s++) {
+            out += (s == 0 ? "\"" : ", \"") + std::string(STAGE_NAMES[s]) + "\": {\"wall\": "
+                   + json_number(wall_seconds[s]) + ", \"cpu\": " + json_number(cpu_seconds[s]) + "}";
+        }
+        out += "}, \"elements\": {";
+        bool first = true;
+        for (const auto &element : elements) {
+            out += (first ? "" : ", ") + json_string(element.first) + ": " + std::to_string(element.second);
+            first = false;
+        }
+        out += "}";
+        for (size_t c = 0; c < COUNTERS; c++) {
+            out += ", \"" + std::string(COUNTER_NAMES[c]) + "\": " + std::to_string(counters[c]);
+        }
+        return out + "}";
+    }
+
+    StatsCollector::StatsCollector() : read_cpu_ns_(0) {
+        for (std::atomic<uint64_t> &c : counters_) {
+            c.store(0, std::memory_order_relaxed);
+        }
+        for (size_t s = 0; s < STAGES; s++) {
+            wall_ns_[s].store(0, std::memory_order_relaxed);
+            cpu_ns_[s].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void StatsCollector::add_element(const SVGElement &element) {
+        std::string type = element.getType();
+        std::lock_guard<std::mutex> lock(mutex_);
+        elements_[type]++;
+    }
+
+    ConvertStats StatsCollector::stats() const {
+        ConvertStats out;
+        for (size_t c = 0; c < COUNTERS; c++) {
+            out.counters[c] = counters_[c].load(std::memory_order_relaxed);
+        }
+        for (size_t s = 0; s < STAGES; s++) {
+            out.wall_seconds[s] = wall_ns_[s].load(std::memory_order_relaxed) * 1e-9;
+            out.cpu_seconds[s] = cpu_ns_[s].load(std::memory_order_relaxed) * 1e-9;
+        }
+        size_t parse = static_cast<size_t>(Stage::parse), build = static_cast<size_t>(Stage::build);
+        double read_wall = out.wall_seconds[parse] + out.wall_seconds[build];
+        double read_cpu = read_cpu_ns_.load(std::memory_order_relaxed) * 1e-9;
+        if (read_wall > 0) {
+            out.cpu_seconds[parse] += read_cpu * out.wall_seconds[parse] / read_wall;
+            out.cpu_seconds[build] += read_cpu * out.wall_seconds[build] / read_wall;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.elements = elements_;
+        return out;
+    }
+
+    StatsScope::StatsScope(StatsCollector *collector)
+        : previous_(stats_detail::active), attached_(SVG_STATS && collector != nullptr) {
+        if (attached_) {
+            stats_detail::active = collector;
+        }
+    }
+
+    StatsScope::~StatsScope() {
+        if (attached_) {
+            stats_detail::active = previous_;
+        }
+    }
+
+    void StageTimer::start(Stage stage, Clocks clocks) {
+        stage_ = stage;
+        clocks_ = clocks;
+        if (clocks & WALL) {
+            wall_start_ = wall_now();
+        }
+        if (clocks & (CPU | READ_CPU)) {
+            cpu_start_ = cpu_now();
+        }
+    }
+
+    void StageTimer::finish() {
+        if (clocks_ & WALL) {
+            collector_->add_wall(stage_, wall_now() - wall_start_);
+        }
+        if (clocks_ & CPU) {
+            collector_->add_cpu(stage_, cpu_now() - cpu_start_);
+        } else if (clocks_ & READ_CPU) {
+            collector_->add_read_cpu(cpu_now() - cpu_start_);
+        }
+    }
+}
+
+#if SVG_STATS && SVG_STATS_ALLOCATIONS
+//! the replaceable global allocation functions; the nothrow and over-aligned versions are not replaced,
+//! so they are not counted
+//! counting is the same single test as the rest of the instrumentation when no collector is attached
+namespace
+{
+    void *allocate(std::size_t size) {
+        if (svg::StatsCollector *collector = svg::active_stats()) {
+            collector->add(svg::Counter::allocations, 1);
+            collector->add(svg::Counter::allocated_bytes, size);
+        }
+        if (size == 0) {
+            size = 1;
+        }
+        //! like the standard operator new: the new handler gets a chance to free memory, until there is none
+        while (true) {
+            if (void *p = std::malloc(size)) {
+                return p;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+}
+
+void *operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void *operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
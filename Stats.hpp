@@ -0,0 +1,191 @@
+//! @file Stats.hpp
+#ifndef __svg_Stats_hpp__
+#define __svg_Stats_hpp__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+//! SVG_STATS=0 compiles the instrumentation out: the counters and timers below become empty inline code
+//! and a ConvertStats filled that way stays at zero
+//! with SVG_STATS=1 (the default) every instrumented place costs the test of a thread_local pointer
+//! while no StatsScope is active on the thread, so it can stay on in production
+#ifndef SVG_STATS
+#define SVG_STATS 1
+#endif
+//! SVG_STATS_ALLOCATIONS=1 replaces the global operator new and delete by ones that count the
+//! allocations of the threads with a StatsScope (see Stats.cpp); it is off by default, because replacing
+//! them is a decision of the whole program, not of a library, and without it the allocation counters stay at zero
+#ifndef SVG_STATS_ALLOCATIONS
+#define SVG_STATS_ALLOCATIONS 0
+#endif
+
+namespace svg
+{
+    class SVGElement;
+
+    //! the stages a conversion goes through
+    enum class Stage : uint8_t
+    {
+        load,   //! reading the file and parsing the XML
+        parse,  //! reading the attributes and the transforms of the elements
+        build,  //! creating the elements (with their coordinates, colors and geometry) and compiling them
+        raster, //! drawing
+        encode, //! encoding the image, and writing it when it goes to a file
+        count
+    };
+    const size_t STAGES = static_cast<size_t>(Stage::count);
+    //! "load", "parse", "build", "raster" or "encode"
+    const char *stage_name(Stage stage);
+
+    //! what is counted besides the time
+    enum class Counter : uint8_t
+    {
+        vertices,        //! points of the polygons, contours and stroke outlines given to the rasterizers of Raster.hpp
+        pixels,          //! pixels filled or blended by the rasterizers of Raster.hpp (not the ones PNGImage draws itself)
+        allocations,     //! calls to operator new, only counted with SVG_STATS_ALLOCATIONS=1
+        allocated_bytes, //! bytes asked to operator new, only counted with SVG_STATS_ALLOCATIONS=1
+        output_bytes,    //! bytes of the encoded images
+        count
+    };
+    const size_t COUNTERS = static_cast<size_t>(Counter::count);
+
+    //! what a conversion (or a whole batch) did
+    //! the times of a stage are summed over the threads that worked on it, so with several threads
+    //! they can be longer than the conversion
+    //! the parse and build stages alternate for every element, and measuring the CPU time costs a system
+    //! call, so their wall times are measured per element and their CPU time once for the whole document,
+    //! split between them in proportion to their wall times
+    struct ConvertStats
+    {
+        double wall_seconds[STAGES] = {};
+        double cpu_seconds[STAGES] = {};
+        std::map<std::string, uint64_t> elements; //! elements created by readSVG, by getType()
+        uint64_t counters[COUNTERS] = {};
+
+        double wall(Stage stage) const {return wall_seconds[static_cast<size_t>(stage)];}
+        double cpu(Stage stage) const {return cpu_seconds[static_cast<size_t>(stage)];}
+        uint64_t operator[](Counter counter) const {return counters[static_cast<size_t>(counter)];}
+        //! one JSON object: {"stages": {"load": {"wall": s, "cpu": s}, ...}, "elements": {...}, "vertices": n, ...}
+        std::string json() const;
+    };
+
+    //! where the instrumentation of the threads attached to it (with StatsScope) adds up
+    //! the counters are atomic, so any number of threads can share one collector
+    class StatsCollector
+    {
+    public:
+        StatsCollector();
+        StatsCollector(const StatsCollector &) = delete;
+        StatsCollector &operator=(const StatsCollector &) = delete;
+
+        void add(Counter counter, uint64_t n) {
+            counters_[static_cast<size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+        }
+        void add_wall(Stage stage, int64_t ns) {wall_ns_[static_cast<size_t>(stage)].fetch_add(ns, std::memory_order_relaxed);}
+        void add_cpu(Stage stage, int64_t ns) {cpu_ns_[static_cast<size_t>(stage)].fetch_add(ns, std::memory_order_relaxed);}
+        //! CPU time of reading, shared between parse and build when the stats are made
+        void add_read_cpu(int64_t ns) {read_cpu_ns_.fetch_add(ns, std::memory_order_relaxed);}
+        void add_element(const SVGElement &element);
+
+        //! what was collected so far
+        ConvertStats stats() const;
+
+    private:
+        std::atomic<uint64_t> counters_[COUNTERS];
+        std::atomic<int64_t> wall_ns_[STAGES];
+        std::atomic<int64_t> cpu_ns_[STAGES];
+        std::atomic<int64_t> read_cpu_ns_;
+        mutable std::mutex mutex_;
+        std::map<std::string, uint64_t> elements_;
+    };
+
+    namespace stats_detail
+    {
+        extern thread_local StatsCollector *active;
+    }
+
+    //! the collector of the calling thread, nullptr when its stats are not collected
+    inline StatsCollector *active_stats() {
+#if SVG_STATS
+        return stats_detail::active;
+#else
+        return nullptr;
+#endif
+    }
+
+    //! attaches collector to the calling thread until the end of the scope (and then restores the one
+    //! it had); a thread started by an instrumented function has to attach the collector of its parent
+    //! a null collector changes nothing, so the parent's collector keeps counting
+    class StatsScope
+    {
+    public:
+        explicit StatsScope(StatsCollector *collector);
+        ~StatsScope();
+        StatsScope(const StatsScope &) = delete;
+        StatsScope &operator=(const StatsScope &) = delete;
+
+    private:
+        StatsCollector *previous_;
+        bool attached_;
+    };
+
+    //! adds n to counter, if the thread has a collector
+    inline void count(Counter counter, uint64_t n) {
+        if (StatsCollector *collector = active_stats()) {
+            collector->add(counter, n);
+        }
+    }
+
+    //! counts an element created by readSVG, if the thread has a collector
+    inline void count_element(const SVGElement &element) {
+        if (StatsCollector *collector = active_stats()) {
+            collector->add_element(element);
+        }
+    }
+
+    //! times the rest of the scope (or up to stop()) as stage, if the thread has a collector
+    //! the wall time costs a few tens of nanoseconds, the CPU time of the thread a system call
+    class StageTimer
+    {
+    public:
+        enum Clocks : uint8_t
+        {
+            WALL = 1,
+            CPU = 2,
+            BOTH = WALL | CPU,
+            READ_CPU = 4 //! the CPU time goes to StatsCollector::add_read_cpu, stage is ignored
+        };
+
+        explicit StageTimer(Stage stage, Clocks clocks = BOTH) : collector_(active_stats()) {
+            if (collector_ != nullptr) {
+                start(stage, clocks);
+            }
+        }
+        ~StageTimer() {stop();}
+        StageTimer(const StageTimer &) = delete;
+        StageTimer &operator=(const StageTimer &) = delete;
+
+        //! ends the measure before the end of the scope
+        void stop() {
+            if (collector_ != nullptr) {
+                finish();
+                collector_ = nullptr;
+            }
+        }
+
+    private:
+        void start(Stage stage, Clocks clocks);
+        void finish();
+
+        StatsCollector *collector_;
+        Stage stage_ = Stage::load;
+        Clocks clocks_ = BOTH;
+        int64_t wall_start_ = 0;
+        int64_t cpu_start_ = 0;
+    };
+}
+#endif
@@ -0,0 +1,232 @@
+#include "Stroke.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace svg
+{
+    namespace
+    {
+        struct Vec
+        {
+            double x, y;
+        };
+        Vec operator+(Vec a, Vec b) {return {a.x + b.x, a.y + b.y};}
+        Vec operator-(Vec a, Vec b) {return {a.x - b.x, a.y - b.y};}
+        Vec operator-(Vec a) {return {-a.x, -a.y};}
+        Vec operator*(Vec a, double k) {return {a.x * k, a.y * k};}
+        double dot(Vec a, Vec b) {return a.x * b.x + a.y * b.y;}
+        double cross(Vec a, Vec b) {return a.x * b.y - a.y * b.x;}
+        //! a turned by 90 degrees, the normal on the left side of a segment going along a
+        Vec normal(Vec a) {return {-a.y, a.x};}
+
+        //! builds the pieces of an Outline one at a time, turning each one so that they all have
+        //! a positive area (nonzero then adds their windings instead of cancelling them)
+        class PieceBuilder
+        {
+        public:
+            //! the round pieces are precise to 1/8 of a pixel
+            PieceBuilder(Outline &out, double pixel) : out_(out), tolerance_(pixel / 8) {}
+
+            void begin() {piece_.clear();}
+            void add(Vec p) {piece_.push_back(p);}
+            //! the points of an arc around center, from center + from, turning by sweep radians
+            void arc(Vec center, Vec from, double sweep) {
+                double r = std::hypot(from.x, from.y);
+                //! the largest step that keeps the chords within tolerance of the circle
+                double step = r > tolerance_ ? 2 * std::acos(1 - tolerance_ / r) : M_PI / 2;
+                int n = std::max(1, static_cast<int>(std::ceil(std::fabs(sweep) / step)));
+                for (int k = 0; k <= n; k++) {
+                    double a = sweep * k / n;
+                    double c = std::cos(a), s = std::sin(a);
+                    add({center.x + from.x * c - from.y * s, center.y + from.x * s + from.y * c});
+                }
+            }
+            void end() {
+                double area = 0;
+                for (size_t i = 0; i < piece_.size(); i++) {
+                    area += cross(piece_[i], piece_[(i + 1) % piece_.size()]);
+                }
+                if (piece_.size() < 3 || area == 0) {
+                    return;
+                }
+                if (area < 0) {
+                    std::reverse(piece_.begin(), piece_.end());
+                }
+                for (const Vec &p : piece_) {
+                    out_.points.push_back({static_cast<int>(std::lround(p.x)), static_cast<int>(std::lround(p.y))});
+                }
+                out_.ends.push_back(static_cast<uint32_t>(out_.points.size()));
+            }
+
+        private:
+            Outline &out_;
+            double tolerance_;
+            std::vector<Vec> piece_;
+        };
+
+        //! the piece that fills the corner at p between the segments going along d0 and then d1
+        void add_join(PieceBuilder &b, Vec p, Vec d0, Vec d1, double half, const StrokeStyle &style) {
+            double turn = cross(d0, d1);
+            double along = dot(d0, d1);
+            bool reversal = std::fabs(turn) <= 1e-9;
+            if (reversal && along > 0) {
+                return; //! a straight continuation needs no join
+            }
+            //! the corner is filled on the outer side of the turn, the inner side is covered by the quads
+            double side = turn > 0 ? -1 : 1;
+            Vec o0 = normal(d0) * (half * side);
+            Vec o1 = normal(d1) * (half * side);
+            b.begin();
+            b.add(p);
+            switch (style.join) {
+                case LineJoin::round: {
+                    //! when the polyline goes back on itself the arc goes around the end of the first segment
+                    double sweep = reversal ? -side * M_PI : std::atan2(cross(o0, o1), dot(o0, o1));
+                    b.arc(p, o0, sweep);
+                    break;
+                }
+                case LineJoin::miter:
+                    //! the miter length is half / cos(angle / 2), with cos(angle / 2)^2 = (1 + along) / 2
+                    if (!reversal && 2 <= style.miter_limit * style.miter_limit * (1 + along)) {
+                        b.add(p + o0);
+                        b.add(p + (o0 + o1) * (1 / (1 + along)));
+                        b.add(p + o1);
+                        break;
+                    }
+                    [[fallthrough]];
+                case LineJoin::bevel:
+                    b.add(p + o0);
+                    b.add(p + o1);
+                    break;
+            }
+            b.end();
+        }
+
+        //! the piece at the end p of a polyline, d is the direction going out of the polyline
+        void add_cap(PieceBuilder &b, Vec p, Vec d, double half, LineCap cap) {
+            Vec n = normal(d) * half;
+            switch (cap) {
+                case LineCap::butt:
+                    return;
+                case LineCap::square:
+                    b.begin();
+                    b.add(p + n);
+                    b.add(p + n + d * half);
+                    b.add(p - n + d * half);
+                    b.add(p - n);
+                    b.end();
+                    return;
+                case LineCap::round:
+                    b.begin();
+                    b.arc(p, n, -M_PI); //! from p + n to p - n, through p + d * half
+                    b.end();
+                    return;
+            }
+        }
+    }
+
+    double StrokeStyle::reach() const {
+        double k = join == LineJoin::miter ? std::max(miter_limit, 1.0) : 1.0;
+        if (cap == LineCap::square) {
+            k = std::max(k, M_SQRT2);
+        }
+        return width / 2 * k;
+    }
+
+    void stroke_outline(const Point *points, size_t count, bool closed, const StrokeStyle &style,
+                        double scale, double offset, double pixel, Outline &out) {
+        double half = style.width * scale / 2;
+        if (count == 0 || !(half > 0)) {
+            return;
+        }
+        //! the points in the output units, without repeated points (their segments have no direction)
+        thread_local std::vector<Vec> p;
+        p.clear();
+        for (size_t i = 0; i < count; i++) {
+            Vec v = {points[i].x * scale + offset, points[i].y * scale + offset};
+            if (p.empty() || v.x != p.back().x || v.y != p.back().y) {
+                p.push_back(v);
+            }
+        }
+        if (closed && p.size() > 1 && p.front().x == p.back().x && p.front().y == p.back().y) {
+            p.pop_back();
+        }
+        PieceBuilder b(out, pixel);
+        size_t n = p.size();
+        if (n == 1) {
+            //! a stroke of length zero only shows its caps
+            if (style.cap == LineCap::round) {
+                b.begin();
+                b.arc(p[0], {half, 0}, 2 * M_PI);
+                b.end();
+            } else if (style.cap == LineCap::square) {
+                b.begin();
+                b.add(p[0] + Vec{-half, -half});
+                b.add(p[0] + Vec{half, -half});
+                b.add(p[0] + Vec{half, half});
+                b.add(p[0] + Vec{-half, half});
+                b.end();
+            }
+            return;
+        }
+        if (n < 3) {
+            closed = false;
+        }
+        auto direction = [&](size_t i) {
+            Vec d = p[(i + 1) % n] - p[i];
+            return d * (1 / std::hypot(d.x, d.y));
+        };
+        size_t segments = closed ? n : n - 1;
+        for (size_t i = 0; i < segments; i++) {
+            Vec a = p[i];
+            Vec c = p[(i + 1) % n];
+            Vec side = normal(direction(i)) * half;
+            b.begin();
+            b.add(a + side);
+            b.add(c + side);
+            b.add(c - side);
+            b.add(a - side);
+            b.end();
+        }
+        for (size_t i = closed ? 0 : 1; i < (closed ? n : n - 1); i++) {
+            add_join(b, p[i], direction((i + n - 1) % n), direction(i), half, style);
+        }
+        if (!closed) {
+            add_cap(b, p[0], -direction(0), half, style.cap);
+            add_cap(b, p[n - 1], direction(n - 2), half, style.cap);
+        }
+    }
+
+    void draw_stroke(PNGImage &img, const Point *points, size_t count, bool closed, const StrokeStyle &style,
+                     const Color &color, const Box &clip, uint8_t alpha, int bits) {
+        uint32_t end = static_cast<uint32_t>(count);
+        uint8_t is_closed = closed;
+        draw_stroke(img, points, &end, &is_closed, 1, style, color, clip, alpha, bits);
+    }
+
+    void draw_stroke(PNGImage &img, const Point *points, const uint32_t *ends, const uint8_t *closed, size_t n,
+                     const StrokeStyle &style, const Color &color, const Box &clip, uint8_t alpha, int bits) {
+        if (alpha == 0) {
+            return;
+        }
+        //! reused by every stroke drawn by the thread, a big polyline only allocates the first time
+        thread_local Outline outline;
+        outline.clear();
+        //! without bits, pixel x covers [x, x + 1) so the stroke goes along x + 0.5, with 8 bits below the pixel
+        int out_bits = bits == 0 ? 8 : bits;
+        double scale = bits == 0 ? 256 : 1;
+        double offset = bits == 0 ? 128 : 0;
+        uint32_t begin = 0;
+        for (size_t i = 0; i < n; i++) {
+            stroke_outline(points + begin, ends[i] - begin, closed[i] != 0, style, scale, offset, 1 << out_bits, outline);
+            begin = ends[i];
+        }
+        if (bits == 0) {
+            fill_contours(img, outline.points.data(), outline.ends.data(), outline.ends.size(), out_bits,
+                          color, FillRule::nonzero, clip, alpha);
+        } else {
+            fill_contours_aa(img, outline.points.data(), outline.ends.data(), outline.ends.size(), out_bits,
+                             color, FillRule::nonzero, clip, alpha);
+        }
+    }
+}
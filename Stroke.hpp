@@ -0,0 +1,71 @@
+//! @file Stroke.hpp
+#ifndef __svg_Stroke_hpp__
+#define __svg_Stroke_hpp__
+
+#include "Raster.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! the stroke-linejoin SVG property, the shape at the corners of a polyline
+    enum class LineJoin : uint8_t
+    {
+        miter,
+        round,
+        bevel
+    };
+
+    //! the stroke-linecap SVG property, the shape at the two ends of an open polyline
+    enum class LineCap : uint8_t
+    {
+        butt,
+        round,
+        square
+    };
+
+    //! how a line, polyline or polygon outline is stroked
+    //! width is in the units of the points of the element (pixels, or 1/2^bits of a pixel)
+    struct StrokeStyle
+    {
+        double width = 1;
+        LineJoin join = LineJoin::miter;
+        LineCap cap = LineCap::butt;
+        double miter_limit = 4; //! miters longer than miter_limit * width / 2 become bevels
+
+        //! how far the outline can go from the points, in the same units as width
+        double reach() const;
+    };
+
+    //! several polygons (contours) stored one after the other, contour i ends at ends[i] (exclusive)
+    //! so that building a stroke of thousands of segments does not allocate once per piece
+    struct Outline
+    {
+        std::vector<Point> points;
+        std::vector<uint32_t> ends;
+
+        void clear() {points.clear(); ends.clear();}
+    };
+
+    //! appends to out the outline of the stroke of the polyline points (closed: also from the last point
+    //! back to the first, as for a polygon), as one quad per segment plus the join and cap pieces
+    //! every piece has the same orientation, so filling all of them together with the nonzero rule gives
+    //! the union: each pixel is painted once, even where the segments and joins overlap
+    //! the points are multiplied by scale and moved by offset (in both x and y), and the outline is
+    //! rounded to the resulting units, in which a pixel is pixel units long (for the round joins and caps)
+    void stroke_outline(const Point *points, size_t count, bool closed, const StrokeStyle &style,
+                        double scale, double offset, double pixel, Outline &out);
+
+    //! strokes the polyline in one rasterization pass
+    //! with bits == 0 the points are pixels, and the outline is built around the pixel centers with 8 bits
+    //! of subpixel precision and filled by sampling the centers, like the other non anti-aliased shapes
+    //! with bits != 0 the points are in 1/2^bits of a pixel and the outline is filled anti-aliased
+    void draw_stroke(PNGImage &img, const Point *points, size_t count, bool closed, const StrokeStyle &style,
+                     const Color &color, const Box &clip, uint8_t alpha = 255, int bits = 0);
+    //! same thing for n polylines stored one after the other (polyline i ends at ends[i] and is closed
+    //! if closed[i] isn't 0), all stroked together in the same pass, like the subpaths of a path
+    void draw_stroke(PNGImage &img, const Point *points, const uint32_t *ends, const uint8_t *closed, size_t n,
+                     const StrokeStyle &style, const Color &color, const Box &clip, uint8_t alpha = 255, int bits = 0);
+}
+#endif
@@ -0,0 +1,197 @@
+#include "Transform.hpp"
+#include "SVGAttributes.hpp"
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SVG_TRANSFORM_X86
+#endif
+
+namespace svg
+{
+    static double radians(double degrees) {
+        return degrees * M_PI / 180.0;
+    }
+
+    Transform Transform::translate(double tx, double ty) {
+        return {1, 0, 0, 1, tx, ty};
+    }
+
+    Transform Transform::scale(double sx, double sy) {
+        return {sx, 0, 0, sy, 0, 0};
+    }
+
+    Transform Transform::rotate(double degrees) {
+        double s = std::sin(radians(degrees));
+        double c = std::cos(radians(degrees));
+        return {c, s, -s, c, 0, 0};
+    }
+
+    Transform Transform::rotate(double degrees, double cx, double cy) {
+        return translate(cx, cy) * rotate(degrees) * translate(-cx, -cy);
+    }
+
+    Transform Transform::skew_x(double degrees) {
+        return {1, 0, std::tan(radians(degrees)), 1, 0, 0};
+    }
+
+    Transform Transform::skew_y(double degrees) {
+        return {1, std::tan(radians(degrees)), 0, 1, 0, 0};
+    }
+
+    Transform Transform::operator*(const Transform &o) const {
+        return {a * o.a + c * o.b,
+                b * o.a + d * o.b,
+                a * o.c + c * o.d,
+                b * o.c + d * o.d,
+                a * o.e + c * o.f + e,
+                b * o.e + d * o.f + f};
+    }
+
+    bool Transform::is_identity() const {
+        return is_translation() && e == 0 && f == 0;
+    }
+
+    bool Transform::is_translation() const {
+        return a == 1 && b == 0 && c == 0 && d == 1;
+    }
+
+    //! we round with nearbyint (round half to even) because that is what the SIMD conversions do,
+    //! so the scalar and the vector kernels give exactly the same pixels
+    Point Transform::apply(const Point &p) const {
+        return {static_cast<int>(std::nearbyint(a * p.x + c * p.y + e)),
+                static_cast<int>(std::nearbyint(b * p.x + d * p.y + f))};
+    }
+
+    void Transform::apply(std::vector<Point> &points) const {
+        apply(points.data(), points.size());
+    }
+
+    //! the kernels work directly on the Point array (x0 y0 x1 y1 ...) instead of splitting it in
+    //! x and y lanes: with v = [x y] and the swapped w = [y x] every point is v * [a d] + w * [c b] + [e f],
+    //! so there is no need to transpose the data in and out
+    static_assert(sizeof(Point) == 2 * sizeof(int), "the kernels expect Point to be two packed ints");
+
+#ifdef SVG_TRANSFORM_X86
+    //! SSE2 is always there on x86-64, one point per iteration
+    static void apply_sse2(const Transform &m, Point *points, size_t n) {
+        const __m128d ad = _mm_setr_pd(m.a, m.d);
+        const __m128d cb = _mm_setr_pd(m.c, m.b);
+        const __m128d ef = _mm_setr_pd(m.e, m.f);
+        for (size_t i = 0; i < n; i++) {
+            __m128i *p = reinterpret_cast<__m128i *>(points + i);
+            __m128d v = _mm_cvtepi32_pd(_mm_loadl_epi64(p));
+            __m128d w = _mm_shuffle_pd(v, v, 1);
+            __m128d r = _mm_add_pd(_mm_add_pd(_mm_mul_pd(v, ad), _mm_mul_pd(w, cb)), ef);
+            _mm_storel_epi64(p, _mm_cvtpd_epi32(r));
+        }
+    }
+
+    //! AVX2, four points per iteration as two groups of two
+    __attribute__((target("avx2")))
+    static void apply_avx2(const Transform &m, Point *points, size_t n) {
+        const __m256d ad = _mm256_setr_pd(m.a, m.d, m.a, m.d);
+        const __m256d cb = _mm256_setr_pd(m.c, m.b, m.c, m.b);
+        const __m256d ef = _mm256_setr_pd(m.e, m.f, m.e, m.f);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i *p0 = reinterpret_cast<__m128i *>(points + i);
+            __m128i *p1 = reinterpret_cast<__m128i *>(points + i + 2);
+            __m256d v0 = _mm256_cvtepi32_pd(_mm_loadu_si128(p0));
+            __m256d v1 = _mm256_cvtepi32_pd(_mm_loadu_si128(p1));
+            __m256d w0 = _mm256_permute_pd(v0, 0x5);
+            __m256d w1 = _mm256_permute_pd(v1, 0x5);
+            __m256d r0 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(v0, ad), _mm256_mul_pd(w0, cb)), ef);
+            __m256d r1 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(v1, ad), _mm256_mul_pd(w1, cb)), ef);
+            _mm_storeu_si128(p0, _mm256_cvtpd_epi32(r0));
+            _mm_storeu_si128(p1, _mm256_cvtpd_epi32(r1));
+        }
+        apply_sse2(m, points + i, n - i);
+    }
+#else
+    //! the portable kernel, where the vector ones are not compiled
+    static void apply_scalar(const Transform &m, Point *points, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            points[i] = m.apply(points[i]);
+        }
+    }
+#endif
+
+    using ApplyKernel = void (*)(const Transform &, Point *, size_t);
+
+    static ApplyKernel select_kernel() {
+#ifdef SVG_TRANSFORM_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return apply_avx2;
+        }
+        return apply_sse2;
+#else
+        return apply_scalar;
+#endif
+    }
+
+    void Transform::apply(Point *points, size_t n) const {
+        static const ApplyKernel kernel = select_kernel();
+        if (is_identity()) {
+            return;
+        }
+        kernel(*this, points, n);
+    }
+
+    //! reads up to max numbers of the argument list that starts after the "(", returns how many were read
+    //! s is left after the ")"
+    static int read_arguments(std::string_view &s, double *args, int max) {
+        int n = 0;
+        double value;
+        while (n < max && next_number(s, value)) {
+            args[n++] = value;
+        }
+        skip_separators(s);
+        if (s.empty() || s[0] != ')') {
+            return -1;
+        }
+        s.remove_prefix(1);
+        return n;
+    }
+
+    Transform parse_transform(std::string_view s) {
+        Transform result;
+        while (true) {
+            skip_separators(s);
+            size_t open = s.find('(');
+            if (open == std::string_view::npos) {
+                break;
+            }
+            std::string_view name = s.substr(0, open);
+            while (!name.empty() && (name.back() == ' ' || name.back() == '\t' || name.back() == '\n' || name.back() == '\r')) {
+                name.remove_suffix(1);
+            }
+            s.remove_prefix(open + 1);
+
+            double args[6];
+            int n = read_arguments(s, args, 6);
+            Transform t;
+            if (n < 0) {
+                break;
+            } else if (name == "matrix" && n == 6) {
+                t = {args[0], args[1], args[2], args[3], args[4], args[5]};
+            } else if (name == "translate" && (n == 1 || n == 2)) {
+                t = Transform::translate(args[0], n == 2 ? args[1] : 0);
+            } else if (name == "scale" && (n == 1 || n == 2)) {
+                t = Transform::scale(args[0], n == 2 ? args[1] : args[0]);
+            } else if (name == "rotate" && n == 1) {
+                t = Transform::rotate(args[0]);
+            } else if (name == "rotate" && n == 3) {
+                t = Transform::rotate(args[0], args[1], args[2]);
+            } else if (name == "skewX" && n == 1) {
+                t = Transform::skew_x(args[0]);
+            } else if (name == "skewY" && n == 1) {
+                t = Transform::skew_y(args[0]);
+            } else {
+                break;
+            }
+            result = result * t;
+        }
+        return result;
+    }
+}
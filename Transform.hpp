@@ -0,0 +1,46 @@
+//! @file Transform.hpp
+#ifndef __svg_Transform_hpp__
+#define __svg_Transform_hpp__
+
+#include "Point.hpp"
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+namespace svg
+{
+    //! a 2x3 affine matrix, with the same meaning as the SVG matrix(a b c d e f):
+    //! x' = a*x + c*y + e
+    //! y' = b*x + d*y + f
+    //! the values are doubles so that composing several transforms does not lose precision,
+    //! the points are only rounded to pixels once, when the matrix is applied
+    struct Transform
+    {
+        double a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
+
+        static Transform translate(double tx, double ty);
+        static Transform scale(double sx, double sy);
+        static Transform rotate(double degrees); //! around the origin (0,0)
+        static Transform rotate(double degrees, double cx, double cy); //! around (cx,cy)
+        static Transform skew_x(double degrees);
+        static Transform skew_y(double degrees);
+
+        //! (m * n) applies n first and then m, like in an SVG transform list
+        Transform operator*(const Transform &o) const;
+
+        bool is_identity() const;
+        bool is_translation() const; //! true if the matrix only moves points
+
+        Point apply(const Point &p) const;
+        //! batch versions, they transform all points in place with a SIMD kernel (AVX2 or SSE2,
+        //! chosen at runtime, with a scalar fallback) and give exactly the same result as apply(p)
+        void apply(std::vector<Point> &points) const;
+        void apply(Point *points, size_t n) const;
+    };
+
+    //! parses an SVG transform list, e.g. "translate(10 20) rotate(45 5 5) scale(2)"
+    //! supports matrix, translate, scale, rotate (with optional center), skewX and skewY
+    //! unknown or malformed functions stop the parsing, keeping what was read until there
+    Transform parse_transform(std::string_view s);
+}
+#endif
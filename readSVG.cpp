@@ -1,326 +1,956 @@
 #include <iostream>
-#include <sstream>
 #include "SVGElements.hpp"
 #include "external/tinyxml2/tinyxml2.h"
 #include "Color.hpp"
+#include "SVGAttributes.hpp"
+#include "ColorResolver.hpp"
+#include "Transform.hpp"
+#include "Scene.hpp"
+#include "Stats.hpp"
 #include <string>
-#include <map>
+#include <string_view>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace tinyxml2;
 
 namespace svg
 {
+    //! Lê os atributos transform e transform-origin e compõe-nos numa só matriz
+    //! o transform-origin aplica-se como translate(o) * transform * translate(-o)
+    static Transform read_transform(const Attributes &attrs)
+    {
+        Transform t;
+        if (attrs.has(Attr::transform))
+        {
+            t = parse_transform(attrs.get(Attr::transform));
+        }
+        if (attrs.has(Attr::transform_origin) && !t.is_identity()) //! para o caso de encontrar o transform_origin
+        {
+            string_view origin = attrs.get(Attr::transform_origin);
+            double x = 0, y = 0;
+            next_number(origin, x);
+            next_number(origin, y);
+            t = Transform::translate(x, y) * t * Transform::translate(-x, -y);
+        }
+        return t;
+    }
+
+    //! Aplica a matriz ao elemento numa só passagem pelos seus pontos
+    static void apply_transform(SVGElement *element, const Transform &t)
+    {
+        if (!t.is_identity())
+        {
+            element->transform(t);
+        }
+    }
+
+    //! Estado partilhado por todos os elementos de um documento enquanto é lido
+    struct ReadContext
+    {
+        Scene *scene = nullptr; //! onde os elementos são alocados (nullptr para usar new)
+        bool streaming = false; //! no streamSVG os elementos lidos deixam de ser nossos, só os de <defs> ficam no índice
+        bool in_defs = false;
+        unordered_map<string, SVGElement *> ids; //! índice dos elementos com atributo id
+        unordered_map<string, shared_ptr<const Symbol>> symbols; //! um Symbol por id usado em <use>, partilhado pelos <use>
+        //! os nodes com id de todo o documento (vazio no streamSVG), para um <use> encontrar também os que vêm depois dele
+        unordered_map<string_view, XMLElement *> nodes;
+        unordered_set<string> resolving; //! os ids cujo alvo está a ser construído, um <use> dentro do próprio alvo é ignorado
+        bool in_target = false; //! os elementos feitos para um <use> não vão para o índice nem para as estatísticas
+        ColorCache colors; //! as mesmas cores repetem-se muitas vezes, cada texto só é analisado uma vez
+        double unit = 1; //! o tamanho de um pixel nas coordenadas dos elementos (2^subpixel_bits da scene)
+
+        //! A matriz t (em pixels) para coordenadas em unidades: unit * t * (1 / unit), só muda a translação
+        Transform to_units(Transform t) const
+        {
+            t.e *= unit;
+            t.f *= unit;
+            return t;
+        }
+    };
+
+    //! Uma coordenada ou um comprimento, arredondado às unidades da scene (pixels, ou frações de pixel)
+    static int coordinate(const Attributes &attrs, Attr a, const ReadContext &ctx)
+    {
+        return static_cast<int>(lround(attrs.get_number(a) * ctx.unit));
+    }
+
+    //! A cor do atributo a (fill ou stroke), já com o style e a herança aplicados
+    static Color read_color(const Attributes &attrs, Attr a, ReadContext &ctx)
+    {
+        return ctx.colors.resolve(attrs.get(a));
+    }
+
+    //! Um atributo de opacidade, entre 0 e 1 (ou uma percentagem)
+    static double read_opacity(const Attributes &attrs, Attr a)
+    {
+        string_view value = attrs.get(a);
+        double opacity;
+        if (!next_number(value, opacity))
+        {
+            return 1;
+        }
+        if (!value.empty() && value.front() == '%')
+        {
+            opacity /= 100;
+        }
+        return clamp(opacity, 0.0, 1.0);
+    }
+
+    //! A opacidade de uma pintura (paint é Attr::fill ou Attr::stroke): fill-opacity (ou stroke-opacity)
+    //! vezes o alpha de rgba()/hsla()
+    static double paint_opacity(const Attributes &attrs, Attr paint, ReadContext &ctx)
+    {
+        double color_alpha;
+        ctx.colors.resolve(attrs.get(paint), color_alpha);
+        return color_alpha * read_opacity(attrs, paint == Attr::fill ? Attr::fill_opacity : Attr::stroke_opacity);
+    }
+
+    //! A opacidade de um elemento: opacity vezes a opacidade da sua pintura
+    //! paint é Attr::fill ou Attr::stroke, ou Attr::count para os elementos sem cor (grupos e <use>)
+    //! e para os que têm as duas (polygon e rect), que guardam a de cada pintura à parte
+    static uint8_t read_alpha(const Attributes &attrs, Attr paint, ReadContext &ctx)
+    {
+        double alpha = read_opacity(attrs, Attr::opacity);
+        if (paint != Attr::count)
+        {
+            alpha *= paint_opacity(attrs, paint, ctx);
+        }
+        return static_cast<uint8_t>(lround(alpha * 255));
+    }
+
+    //! O stroke-width (nas unidades da scene), stroke-linejoin, stroke-linecap e stroke-miterlimit
+    static StrokeStyle read_stroke_style(const Attributes &attrs, const ReadContext &ctx)
+    {
+        StrokeStyle style;
+        style.width = max(0.0, attrs.get_number(Attr::stroke_width, 1)) * ctx.unit;
+        string_view join = attrs.get(Attr::stroke_linejoin);
+        if (join == "round")
+        {
+            style.join = LineJoin::round;
+        }
+        else if (join == "bevel")
+        {
+            style.join = LineJoin::bevel;
+        }
+        string_view cap = attrs.get(Attr::stroke_linecap);
+        if (cap == "round")
+        {
+            style.cap = LineCap::round;
+        }
+        else if (cap == "square")
+        {
+            style.cap = LineCap::square;
+        }
+        style.miter_limit = max(1.0, attrs.get_number(Attr::stroke_miterlimit, 4));
+        return style;
+    }
+
+    //! Para polygon, rect e path: a opacidade do fill (0 com fill="none") e, se o stroke for uma cor (e não "none"), o contorno
+    static SVGElement *fill_and_stroke(polygon *element, const Attributes &attrs, ReadContext &ctx)
+    {
+        bool filled = attrs.get(Attr::fill) != "none";
+        element->setFillAlpha(filled ? static_cast<uint8_t>(lround(paint_opacity(attrs, Attr::fill, ctx) * 255)) : 0);
+        Color stroke;
+        double alpha;
+        if (attrs.has(Attr::stroke) && parse_color_value(attrs.get(Attr::stroke), stroke, alpha))
+        {
+            uint8_t stroke_alpha = static_cast<uint8_t>(lround(paint_opacity(attrs, Attr::stroke, ctx) * 255));
+            element->setStroke(stroke, read_stroke_style(attrs, ctx), stroke_alpha);
+        }
+        return element;
+    }
+
+    //! Guarda o id do elemento, adiciona-o ao índice e conta-o nas estatísticas
+    static void register_element(SVGElement *element, const Attributes &attrs, ReadContext &ctx)
+    {
+        if (attrs.has(Attr::id))
+        {
+            string id(attrs.get(Attr::id));
+            element->setId(id);
+            if ((!ctx.streaming || ctx.in_defs) && !ctx.in_target)
+            {
+                ctx.ids[id] = element;
+            }
+        }
+        if (!ctx.in_target)
+        {
+            count_element(*element);
+        }
+    }
+
+    //! Indexa os nodes com id de todo o documento antes de o ler (o primeiro ganha, como no getElementById)
+    static void index_nodes(XMLElement *node, ReadContext &ctx)
+    {
+        for (XMLElement *child = node->FirstChildElement(); child != nullptr; child = child->NextSiblingElement())
+        {
+            if (const char *id = child->Attribute("id"))
+            {
+                ctx.nodes.emplace(id, child);
+            }
+            index_nodes(child, ctx);
+        }
+    }
+
+    static void read_element(XMLElement *child, vector<SVGElement *> &svg_elements, ReadContext &ctx,
+                             const Transform &parent = Transform(), const Attributes *inherited = nullptr);
+
+    //! Constrói o alvo de um <use> a partir do seu node, só com a sua própria transformação: a dos <g>
+    //! onde está não se aplica a quem o usa. Herda os atributos dos pais até ao <defs> onde estiver
+    //! (o mesmo que o read_defs lhe dá), ou até à root se não estiver num <defs>
+    static SVGElement *read_target(XMLElement *node, ReadContext &ctx)
+    {
+        vector<const XMLElement *> parents;
+        for (const XMLNode *p = node->Parent(); p != nullptr && p->ToElement() != nullptr; p = p->Parent())
+        {
+            if (p->Parent() == nullptr || p->Parent()->ToElement() == nullptr)
+            {
+                break; //! a root <svg>, cujos atributos nunca são herdados
+            }
+            parents.push_back(p->ToElement());
+            if (string_view(p->Value()) == "defs")
+            {
+                break;
+            }
+        }
+        vector<SVGElement *> built;
+        bool in_target = ctx.in_target;
+        ctx.in_target = true;
+        if (parents.empty())
+        {
+            read_element(node, built, ctx);
+        }
+        else
+        {
+            Attributes inherited(parents.back());
+            for (size_t i = parents.size() - 1; i-- > 0;)
+            {
+                Attributes attrs(parents[i]);
+                attrs.inherit(inherited);
+                inherited = attrs;
+            }
+            read_element(node, built, ctx, Transform(), &inherited);
+        }
+        ctx.in_target = in_target;
+        return built.empty() ? nullptr : built[0];
+    }
+
+    //! Devolve o Symbol do elemento referido por href ("#id"), ou nullptr se o id não existir
+    //! fora do streamSVG o alvo é construído do seu node, esteja antes ou depois do <use>; no streamSVG o
+    //! documento não está todo em memória, só servem os elementos de <defs> já lidos
+    static shared_ptr<const Symbol> find_symbol(string_view href, ReadContext &ctx)
+    {
+        if (!href.empty() && href[0] == '#')
+        {
+            href.remove_prefix(1);
+        }
+        string id(href);
+        auto symbol = ctx.symbols.find(id);
+        if (symbol != ctx.symbols.end())
+        {
+            return symbol->second;
+        }
+        auto node = ctx.nodes.find(href);
+        if (node != ctx.nodes.end())
+        {
+            if (!ctx.resolving.insert(id).second)
+            {
+                return nullptr; //! o <use> está dentro do seu próprio alvo
+            }
+            SVGElement *target = read_target(node->second, ctx);
+            ctx.resolving.erase(id);
+            if (target == nullptr)
+            {
+                return nullptr;
+            }
+            //! sem scene o alvo foi feito com new e passa a ser do Symbol
+            shared_ptr<const Symbol> created = make_shared<Symbol>(target, ctx.scene == nullptr);
+            ctx.symbols[id] = created;
+            return created;
+        }
+        auto element = ctx.ids.find(id);
+        if (element == ctx.ids.end())
+        {
+            return nullptr;
+        }
+        //! o elemento pertence à scene (ou a quem chamou readSVG), o Symbol só aponta para ele
+        shared_ptr<const Symbol> created = make_shared<Symbol>(element->second, false);
+        ctx.symbols[id] = created;
+        return created;
+    }
+
+    //! Cria um elemento na arena da scene, ou com new se não houver scene (readSVG e streamSVG)
+    template <class T, class... Args>
+    static T *create(Scene *scene, Args &&...args)
+    {
+        if (scene != nullptr)
+        {
+            return scene->make<T>(std::forward<Args>(args)...);
+        }
+        return new T(std::forward<Args>(args)...);
+    }
+
+    //! Funções que criam cada forma básica a partir dos seus atributos (nullptr se não for possível)
+    static SVGElement *make_rect(const Attributes &attrs, ReadContext &ctx)
+    {
+        int x = coordinate(attrs, Attr::x, ctx);
+        int y = coordinate(attrs, Attr::y, ctx);
+        int width = coordinate(attrs, Attr::width, ctx);
+        int height = coordinate(attrs, Attr::height, ctx);
+        return fill_and_stroke(create<rect>(ctx.scene, read_color(attrs, Attr::fill, ctx), Point{x, y}, width, height),
+                               attrs, ctx);
+    }
+
+    static SVGElement *make_circle(const Attributes &attrs, ReadContext &ctx)
+    {
+        int cx = coordinate(attrs, Attr::cx, ctx);
+        int cy = coordinate(attrs, Attr::cy, ctx);
+        int r = coordinate(attrs, Attr::r, ctx);
+        return create<Circle>(ctx.scene, read_color(attrs, Attr::fill, ctx), Point{cx, cy}, Point{r, r});
+    }
+
+    static SVGElement *make_line(const Attributes &attrs, ReadContext &ctx)
+    {
+        int x1 = coordinate(attrs, Attr::x1, ctx);
+        int y1 = coordinate(attrs, Attr::y1, ctx);
+        int x2 = coordinate(attrs, Attr::x2, ctx);
+        int y2 = coordinate(attrs, Attr::y2, ctx);
+        line *element = create<line>(ctx.scene, Point{x1, y1}, Point{x2, y2}, read_color(attrs, Attr::stroke, ctx));
+        element->setStroke(read_stroke_style(attrs, ctx));
+        return element;
+    }
+
+    static SVGElement *make_ellipse(const Attributes &attrs, ReadContext &ctx)
+    {
+        int cx = coordinate(attrs, Attr::cx, ctx);
+        int cy = coordinate(attrs, Attr::cy, ctx);
+        int rx = coordinate(attrs, Attr::rx, ctx);
+        int ry = coordinate(attrs, Attr::ry, ctx);
+        return create<Ellipse>(ctx.scene, read_color(attrs, Attr::fill, ctx), Point{cx, cy}, Point{rx, ry});
+    }
+
+    static SVGElement *make_polyline(const Attributes &attrs, ReadContext &ctx)
+    {
+        vector<Point> points;
+        parse_points(attrs.get(Attr::points), points, ctx.unit);
+        polyline *element = create<polyline>(ctx.scene, read_color(attrs, Attr::stroke, ctx), std::move(points));
+        element->setStroke(read_stroke_style(attrs, ctx));
+        return element;
+    }
+
+    static SVGElement *make_polygon(const Attributes &attrs, ReadContext &ctx)
+    {
+        vector<Point> points;
+        parse_points(attrs.get(Attr::points), points, ctx.unit);
+        FillRule rule = attrs.get(Attr::fill_rule) == "evenodd" ? FillRule::evenodd : FillRule::nonzero;
+        return fill_and_stroke(create<polygon>(ctx.scene, read_color(attrs, Attr::fill, ctx), std::move(points), rule), attrs, ctx);
+    }
+
+    //! As curvas são aproximadas por segmentos a menos de um quarto de pixel
+    static SVGElement *make_path(const Attributes &attrs, ReadContext &ctx)
+    {
+        PathData data;
+        parse_path(attrs.get(Attr::d), data, ctx.unit);
+        if (data.empty())
+        {
+            return nullptr;
+        }
+        FillRule rule = attrs.get(Attr::fill_rule) == "evenodd" ? FillRule::evenodd : FillRule::nonzero;
+        return fill_and_stroke(create<path>(ctx.scene, read_color(attrs, Attr::fill, ctx), std::move(data), rule, ctx.unit / 4),
+                               attrs, ctx);
+    }
+
+    static SVGElement *make_use(const Attributes &attrs, ReadContext &ctx)
+    {
+        //! O x e o y do <use> são uma translação aplicada antes do seu transform
+        shared_ptr<const Symbol> symbol = find_symbol(attrs.get(Attr::href), ctx);
+        if (symbol == nullptr)
+        {
+            return nullptr;
+        }
+        Transform t = Transform::translate(attrs.get_number(Attr::x) * ctx.unit, attrs.get_number(Attr::y) * ctx.unit);
+        return create<Use>(ctx.scene, symbol, t);
+    }
+
+    //! Lê um node (e, no caso de <g> e <defs>, todos os seus descendentes) para out
+    //! t é a matriz do node já composta com a dos pais, attrs já tem os atributos herdados
+    using ReadFunction = void (*)(XMLElement *node, const Attributes &attrs, const Transform &t,
+                                  vector<SVGElement *> &out, ReadContext &ctx);
+
+    static void read_children(XMLElement *node, const Attributes &attrs, const Transform &t,
+                              vector<SVGElement *> &out, ReadContext &ctx);
+
+    //! Uma forma básica: cria-a, aplica a matriz, a opacidade e regista o id
+    //! Paint é o atributo com a cor da forma (fill ou stroke), Attr::count se a forma tratar da sua opacidade
+    template <SVGElement *(*Make)(const Attributes &, ReadContext &), Attr Paint>
+    static void read_shape(XMLElement *, const Attributes &attrs, const Transform &t,
+                           vector<SVGElement *> &out, ReadContext &ctx)
+    {
+        StageTimer timer(Stage::build, StageTimer::WALL);
+        SVGElement *element = Make(attrs, ctx);
+        if (element != nullptr)
+        {
+            out.push_back(element);
+            apply_transform(element, ctx.to_units(t));
+            element->setAlpha(read_alpha(attrs, Paint, ctx));
+            register_element(element, attrs, ctx);
+        }
+    }
+
+    //! Um <g>, com qualquer profundidade: os filhos herdam a matriz e os atributos de apresentação
+    static void read_group(XMLElement *node, const Attributes &attrs, const Transform &t,
+                           vector<SVGElement *> &out, ReadContext &ctx)
+    {
+        vector<SVGElement *> group_elements;
+        read_children(node, attrs, t, group_elements, ctx);
+
+        string id(attrs.get(Attr::id));
+        SVGElement *group;
+        if (ctx.scene != nullptr)
+        {
+            //! os filhos ficam num array da arena, o grupo só aponta para eles
+            SVGElement **children = ctx.scene->make_array(group_elements.size());
+            copy(group_elements.begin(), group_elements.end(), children);
+            group = ctx.scene->make<Group>(children, group_elements.size(), id);
+        }
+        else
+        {
+            group = new Group(group_elements, id);
+        }
+        out.push_back(group);
+        group->setAlpha(read_alpha(attrs, Attr::count, ctx)); //! o opacity de um grupo não é herdado, aplica-se ao grupo todo
+        register_element(group, attrs, ctx);
+    }
+
+    //! Os filhos de <defs> não são desenhados, só ficam no índice para os <use>
+    //! (sem a transformação dos pais, que não se aplica a quem os usa)
+    //! também não herdam os atributos dos pais do <defs>, só os do próprio <defs>
+    static void read_defs(XMLElement *node, const Attributes &, const Transform &,
+                          vector<SVGElement *> &, ReadContext &ctx)
+    {
+        vector<SVGElement *> defs;
+        bool in_defs = ctx.in_defs;
+        ctx.in_defs = true;
+        read_children(node, Attributes(node), Transform(), defs, ctx);
+        ctx.in_defs = in_defs;
+        //! Sem scene ninguém é dono destes elementos: passam a ser dos seus Symbol
+        //! (um <use> que vem antes já construiu o seu alvo, igual, e esse Symbol fica)
+        bool owned = ctx.scene == nullptr;
+        for (SVGElement *def : defs)
+        {
+            if (!def->getId().empty())
+            {
+                ctx.symbols.emplace(def->getId(), make_shared<Symbol>(def, owned));
+            }
+            else if (owned)
+            {
+                delete def;
+            }
+        }
+    }
+
+    //! Tabela de dispersão perfeita (calculada em tempo de compilação) do nome da tag para a função que o lê
+    //! o hash usa só o tamanho, a primeira e a última letra, e o static_assert garante que não há colisões
+    namespace
+    {
+        struct TagEntry
+        {
+            string_view name;
+            ReadFunction read = nullptr;
+        };
+
+        constexpr size_t TAG_TABLE_SIZE = 32;
+
+        constexpr size_t tag_hash(string_view name)
+        {
+            return (static_cast<unsigned char>(name[0]) * 2u + static_cast<unsigned char>(name[name.size() - 1]) * 9u
+                    + name.size()) % TAG_TABLE_SIZE;
+        }
+
+        constexpr TagEntry TAGS[] = {
+            {"rect", read_shape<make_rect, Attr::count>},
+            {"circle", read_shape<make_circle, Attr::fill>},
+            {"line", read_shape<make_line, Attr::stroke>},
+            {"ellipse", read_shape<make_ellipse, Attr::fill>},
+            {"polyline", read_shape<make_polyline, Attr::stroke>},
+            {"polygon", read_shape<make_polygon, Attr::count>},
+            {"path", read_shape<make_path, Attr::count>},
+            {"use", read_shape<make_use, Attr::count>},
+            {"g", read_group},
+            {"defs", read_defs},
+        };
+
+        struct TagTable
+        {
+            TagEntry slots[TAG_TABLE_SIZE] = {};
+            bool collision = false;
+        };
+
+        constexpr TagTable make_tag_table()
+        {
+            TagTable table;
+            for (const TagEntry &entry : TAGS)
+            {
+                TagEntry &slot = table.slots[tag_hash(entry.name)];
+                table.collision = table.collision || slot.read != nullptr;
+                slot = entry;
+            }
+            return table;
+        }
+
+        constexpr TagTable TAG_TABLE = make_tag_table();
+        static_assert(!TAG_TABLE.collision, "two tags have the same tag_hash, change its multipliers");
+    }
+
+    //! A função que lê a tag name, ou nullptr se a tag não for conhecida (é ignorada, com os descendentes)
+    static ReadFunction find_reader(string_view name)
+    {
+        if (name.empty())
+        {
+            return nullptr;
+        }
+        const TagEntry &entry = TAG_TABLE.slots[tag_hash(name)];
+        return entry.name == name ? entry.read : nullptr;
+    }
+
+    //! Cria os SVGElement do node child e dos seus descendentes (e aplica as transformações) e
+    //! adiciona-os a svg_elements; é usado tanto pelo readSVG como pelo streamSVG
+    //! parent é a matriz acumulada dos <g> onde o node está, inherited os atributos desses <g>
+    static void read_element(XMLElement *child, vector<SVGElement *> &svg_elements, ReadContext &ctx,
+                             const Transform &parent, const Attributes *inherited)
+    {
+        ReadFunction read = find_reader(child->Name());
+        if (read == nullptr)
+        {
+            return;
+        }
+        //! Os atributos são lidos uma só vez, como string_views sobre o texto do tinyxml2
+        //! (o tempo do parse pára antes de read, que mede o seu próprio build e lê os filhos de um <g>)
+        StageTimer timer(Stage::parse, StageTimer::WALL);
+        Attributes attrs(child);
+        if (inherited != nullptr)
+        {
+            attrs.inherit(*inherited);
+        }
+        Transform t = parent * read_transform(attrs);
+        timer.stop();
+        read(child, attrs, t, svg_elements, ctx);
+    }
+
+    static void read_children(XMLElement *node, const Attributes &attrs, const Transform &t,
+                              vector<SVGElement *> &out, ReadContext &ctx)
+    {
+        for (XMLElement *child = node->FirstChildElement(); child != nullptr; child = child->NextSiblingElement())
+        {
+            read_element(child, out, ctx, t, &attrs);
+        }
+    }
+
     void readSVG(const string &svg_file, Point &dimensions, vector<SVGElement *> &svg_elements)
     {
         XMLDocument doc;
+        StageTimer load(Stage::load);
         XMLError r = doc.LoadFile(svg_file.c_str());
         if (r != XML_SUCCESS)
         {
             throw runtime_error("Unable to load " + svg_file);
         }
+        load.stop();
+        StageTimer reading(Stage::parse, StageTimer::READ_CPU);
         XMLElement *xml_elem = doc.RootElement();
 
         dimensions.x = xml_elem->IntAttribute("width");
         dimensions.y = xml_elem->IntAttribute("height");
 
         //! Dar traverse aos XML child nodes
+        ReadContext ctx;
+        index_nodes(xml_elem, ctx);
         XMLElement *child = xml_elem->FirstChildElement();
         while (child != nullptr)
         {
+            read_element(child, svg_elements, ctx);
+            //! Avançar para o próximo child node
+            child = child->NextSiblingElement();
+        }
+    }
 
-            //!Declarar o default de rotate, scale e translate para ser usado depois
-            int rotate = 0;
-            Point translate = {0,0};
-            int scale = 1;
-            Point transform_origin = {0,0};
-
-            //! Criar SVGElement de acordo com o nome do node
-            const char *name = child->Name();
-            //! Verificar se existe transform
-            map<string, string> atributes_map; //! Um mapa de strings, as chaves serão os nomes dos atributos e os valores serão
-            //! os valores dos atributos
-            //!este código criará um mapa onde as chaves serão os nomes dos atributos e os valores serão os valores dos atributos
-            for (const XMLAttribute *attr = child->FirstAttribute(); attr != nullptr; attr = attr->Next()) { //! itera sobre o mapa até não haver mais atributos
-                atributes_map.insert({attr->Name(), attr->Value()}); //! a forma para inserir os atributos, nomes e valores
-            }
-            if (atributes_map.find("transform") != atributes_map.end()) {
-                string transform = child->Attribute("transform");
-
-                //!rotate
-
-                string new_substr = transform.substr(0,transform.find("(", 0)); //!crio nova substring "geral" da transformação que vai do indíce 0 até o primeiro "("
-                if(new_substr == "rotate"){
-                    string values = transform.substr(transform.find("(", 0) + 1, transform.find(")", 0));//!obter os valores dentro dos parênteses, por exemplo
-                    //!se fôr rotate(180), a partir da substring conseguimos o 180
-                    rotate = stoi(values); //!converter a string do número para inteiro
-
-                } else if(new_substr == "translate"){
-                    string value_x = transform.substr(transform.find("(", 0) + 1, transform.find(" ", 0));
-                    string value_y = transform.substr(transform.find(" ", 0) + 1, transform.find(")",0));
-                    int x = stoi(value_x);
-                    int y = stoi(value_y);
-                    translate = {x, y};
-                   
-                } else if(new_substr == "scale"){
-                    string values = transform.substr(transform.find("(", 0) + 1, transform.find(")", 0));//!obter os valores dentro dos parênteses
-                    scale = stoi(values); //!converter a string do número para int
+    //! Lê a root de um documento já carregado para a scene
+    static void read_document(XMLDocument &doc, Scene &scene)
+    {
+        StageTimer reading(Stage::parse, StageTimer::READ_CPU);
+        XMLElement *xml_elem = doc.RootElement();
+
+        scene.dimensions.x = xml_elem->IntAttribute("width");
+        scene.dimensions.y = xml_elem->IntAttribute("height");
+
+        ReadContext ctx;
+        ctx.scene = &scene;
+        ctx.unit = 1 << scene.subpixel_bits;
+        index_nodes(xml_elem, ctx);
+        for (XMLElement *child = xml_elem->FirstChildElement(); child != nullptr; child = child->NextSiblingElement())
+        {
+            read_element(child, scene.elements, ctx);
+        }
+        scene.ids = std::move(ctx.ids);
+    }
+
+    void readSVG(const string &svg_file, Scene &scene)
+    {
+        XMLDocument doc;
+        StageTimer load(Stage::load);
+        XMLError r = doc.LoadFile(svg_file.c_str());
+        if (r != XML_SUCCESS)
+        {
+            throw runtime_error("Unable to load " + svg_file);
+        }
+        load.stop();
+        read_document(doc, scene);
+    }
+
+    void parseSVG(string_view svg_text, Scene &scene)
+    {
+        XMLDocument doc;
+        StageTimer load(Stage::load);
+        XMLError r = doc.Parse(svg_text.data(), svg_text.size());
+        if (r != XML_SUCCESS || doc.RootElement() == nullptr)
+        {
+            throw runtime_error("Unable to parse SVG text");
+        }
+        load.stop();
+        read_document(doc, scene);
+    }
+
+    namespace
+    {
+        //! Ficheiro mapeado em memória (só leitura), é libertado no destrutor
+        struct MappedFile
+        {
+            const char *data = nullptr;
+            size_t size = 0;
+
+            explicit MappedFile(const string &file)
+            {
+                int fd = open(file.c_str(), O_RDONLY);
+                if (fd < 0)
+                {
+                    throw runtime_error("Unable to load " + file);
+                }
+                struct stat st;
+                if (fstat(fd, &st) != 0 || st.st_size == 0)
+                {
+                    close(fd);
+                    throw runtime_error("Unable to load " + file);
+                }
+                size = static_cast<size_t>(st.st_size);
+                void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (p == MAP_FAILED)
+                {
+                    throw runtime_error("Unable to load " + file);
                 }
+                madvise(p, size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(p);
             }
-            if (atributes_map.find("transform-origin") != atributes_map.end()) { //! para o caso de encontrar o transform_origin
-
-                string transform = child->Attribute("transform-origin"); //!obtém o valor de transform_origin dos nodes
-                string value_x = transform.substr(transform.find("(", 0) + 1, transform.find(" ", 0));//o valor de x
-                string value_y = transform.substr(transform.find(" ", 0) + 1, transform.find(")",0));//o valor de y
-                int x = stoi(value_x);
-                int y = stoi(value_y);
-                transform_origin = {x, y}; //!a forma final do transform_origin
-            }
-
-            if (strcmp(name, "rect") == 0)
-            {
-                //! Dar parse aos atributos do retângulo e criar rect
-                int x = child->IntAttribute("x");
-                int y = child->IntAttribute("y");
-                int width = child->IntAttribute("width");
-                int height = child->IntAttribute("height");
-                string fill = child->Attribute("fill");
-                Color color = parse_color(fill);
-                svg_elements.push_back(new rect(color, {x, y}, width, height));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
-            }
-            else if (strcmp(name, "circle") == 0)
-            {
-                //! Dar parse aos atributos do círculo e criar Circle
-                int cx = child->IntAttribute("cx");
-                int cy = child->IntAttribute("cy");
-                int r = child->IntAttribute("r");
-                string fill = child->Attribute("fill");
-                Color color = parse_color(fill);
-                svg_elements.push_back(new Circle(color, {cx, cy}, {r, r}));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
-            }
-            else if (strcmp(name, "line") == 0)
-            {
-                //! Dar parse aos atributos da linha e criar line
-                int x1 = child->IntAttribute("x1");
-                int y1 = child->IntAttribute("y1");
-                int x2 = child->IntAttribute("x2");
-                int y2 = child->IntAttribute("y2");
-                string stroke = child->Attribute("stroke");
-                Color color = parse_color(stroke);
-                svg_elements.push_back(new line({x1, y1}, {x2, y2}, color));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
-            }
-            else if (strcmp(name, "ellipse") == 0)
-            {
-                //! Dar parse aos atributos da elipse e criar Ellipse
-                int cx = child->IntAttribute("cx");
-                int cy = child->IntAttribute("cy");
-                int rx = child->IntAttribute("rx");
-                int ry = child->IntAttribute("ry");
-                string fill = child->Attribute("fill");
-                Color color = parse_color(fill);
-                svg_elements.push_back(new Ellipse(color, {cx, cy}, {rx, ry}));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
-            }
-
-            else if (strcmp(name, "polyline") == 0)
-            {
-                //! Dar parse aos atributos do polyline e criar polyline
-                string points_str = child->Attribute("points");
-                vector<Point> points;
-                istringstream iss(points_str); 
-                int x, y;
-                char comma;
-                while (iss >> x >> comma >> y)
+            ~MappedFile() { munmap(const_cast<char *>(data), size); }
+            MappedFile(const MappedFile &) = delete;
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            //! Liberta as páginas que já foram lidas (tudo antes de pos), para o RSS não crescer com o ficheiro
+            void release_before(size_t pos)
+            {
+                size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                size_t end = pos / page * page;
+                if (end > 0)
                 {
-                    Point p;
-                    p.x = x;
-                    p.y = y;
-                    points.push_back(p);
+                    madvise(const_cast<char *>(data), end, MADV_DONTNEED);
                 }
-                string stroke = child->Attribute("stroke");
-                Color color = parse_color(stroke);
-                svg_elements.push_back(new polyline(color, points));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
             }
+        };
 
-            if (strcmp(name, "polygon") == 0)
+        //! Procura o fim de "needle" a partir de pos, devolve size se não existir
+        size_t skip_past(const char *data, size_t size, size_t pos, const char *needle)
+        {
+            size_t n = strlen(needle);
+            while (pos + n <= size)
             {
-                
-                //! Dar parse aos atributos do polígono e criar polygon
-                string points_str = child->Attribute("points");
+                if (memcmp(data + pos, needle, n) == 0)
+                {
+                    return pos + n;
+                }
+                pos++;
+            }
+            return size;
+        }
 
-                int x;
-                int y;
-                
-                size_t pos = 0;
+        //! Avança até ao '>' que fecha a tag que começa em pos, ignorando '>' dentro de aspas
+        size_t tag_end(const char *data, size_t size, size_t pos)
+        {
+            char quote = 0;
+            for (; pos < size; pos++)
+            {
+                char c = data[pos];
+                if (quote != 0)
+                {
+                    if (c == quote)
+                    {
+                        quote = 0;
+                    }
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    quote = c;
+                }
+                else if (c == '>')
+                {
+                    return pos + 1;
+                }
+            }
+            throw runtime_error("Unexpected end of SVG input");
+        }
 
-                std::vector<Point> points;
+        //! Salta comentários, instruções de processamento, CDATA e DOCTYPE; devolve pos se não houver nada para saltar
+        size_t skip_markup(const char *data, size_t size, size_t pos)
+        {
+            if (size - pos >= 4 && memcmp(data + pos, "<!--", 4) == 0)
+            {
+                return skip_past(data, size, pos + 4, "-->");
+            }
+            if (size - pos >= 9 && memcmp(data + pos, "<![CDATA[", 9) == 0)
+            {
+                return skip_past(data, size, pos + 9, "]]>");
+            }
+            if (size - pos >= 2 && memcmp(data + pos, "<?", 2) == 0)
+            {
+                return skip_past(data, size, pos + 2, "?>");
+            }
+            if (size - pos >= 2 && memcmp(data + pos, "<!", 2) == 0)
+            {
+                //! DOCTYPE, pode ter um internal subset entre [ ]
+                int brackets = 0;
+                for (pos += 2; pos < size; pos++)
+                {
+                    if (data[pos] == '[')
+                        brackets++;
+                    else if (data[pos] == ']')
+                        brackets--;
+                    else if (data[pos] == '>' && brackets == 0)
+                        return pos + 1;
+                }
+                return size;
+            }
+            return pos;
+        }
 
-                while (pos < points_str.length()) {
+        //! Analisa só a start tag [pos, end) em doc, fechada com "/>" para ser XML válido sozinha
+        //! devolve false se a tag não for válida; empty diz se ela já era "/>"
+        bool parse_start_tag(XMLDocument &doc, const char *data, size_t pos, size_t end, bool &empty)
+        {
+            string tag(data + pos, end - pos);
+            empty = tag.size() >= 2 && tag[tag.size() - 2] == '/';
+            if (!empty)
+            {
+                tag.insert(tag.size() - 1, "/");
+            }
+            doc.Clear();
+            return doc.Parse(tag.c_str(), tag.size()) == XML_SUCCESS;
+        }
 
-                    //! Encontrar x, sabe-se que ',' separa o x e o y
-                    size_t end = points_str.find(',', pos);
-                    if (pos != 0) { //!não estamos no início da string
-                        x = stoi(points_str.substr(pos + 1, end - pos)); //!extrai o x
-                    } else { //!estamos no início da string
-                        x = stoi(points_str.substr(pos, end - pos));
-                    }
-                    pos = end; //!atualizamos o pos, para começar depois da vírgula
+        //! Se a tag em pos é a start tag de um <g>
+        bool is_group_tag(const char *data, size_t size, size_t pos)
+        {
+            return pos + 2 < size && data[pos + 1] == 'g' &&
+                   (isspace(static_cast<unsigned char>(data[pos + 2])) || data[pos + 2] == '>' || data[pos + 2] == '/');
+        }
 
-                    //! Encontrar y, sabe-se que o y está entre a vírgula e o espaço
-                    end = points_str.find(' ', pos);
-                    if (end == std::string::npos) { //! Verificar se o final da string foi encontrada
-                        end = points_str.length();
-                    }
-                    y = stoi(points_str.substr(pos + 1, end - pos));
+        //! Um <g> aberto no streamSVG: a sua start tag fica num XMLDocument próprio enquanto os filhos
+        //! são lidos, porque os Attributes são string_views sobre o texto dele
+        struct OpenGroup
+        {
+            unique_ptr<XMLDocument> doc;
+            Attributes attrs;
+            Transform t;
+        };
 
-                    //! Adicionar o ponto ao vetor
-                    points.push_back({x, y});
-                    pos = end; //!atualizar novamente a variável
+        //! Devolve o fim do elemento que começa em pos (a seguir ao seu end tag, ou à tag "/>")
+        size_t element_end(const char *data, size_t size, size_t pos)
+        {
+            int depth = 0;
+            while (pos < size)
+            {
+                if (data[pos] != '<')
+                {
+                    pos++;
+                    continue;
+                }
+                size_t skipped = skip_markup(data, size, pos);
+                if (skipped != pos)
+                {
+                    pos = skipped;
+                    continue;
+                }
+                size_t end = tag_end(data, size, pos);
+                if (data[pos + 1] == '/')
+                {
+                    depth--;
+                }
+                else if (data[end - 2] != '/')
+                {
+                    depth++;
+                }
+                pos = end;
+                if (depth == 0)
+                {
+                    return pos;
                 }
-
-                string fill = child->Attribute("fill");
-                Color color = parse_color(fill);
-                svg_elements.push_back(new polygon(color, points));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
             }
+            throw runtime_error("Unexpected end of SVG input");
+        }
+    }
+
+    //! Versão em streaming do readSVG: o ficheiro é mapeado em memória e cada filho do <svg> é
+    //! analisado sozinho num XMLDocument pequeno (reutilizado), por isso nunca existe o DOM completo.
+    //! Nos <g> sem opacity entra-se, e cada filho deles é analisado sozinho da mesma maneira, por isso um
+    //! documento todo dentro de um <g> também não é lido de uma vez.
+    //! Cada SVGElement é entregue a on_element assim que a sua tag fecha, e passa a ser de quem o recebe
+    void streamSVG(const string &svg_file, Point &dimensions, const function<void(SVGElement *)> &on_element)
+    {
+        MappedFile file(svg_file);
+        const char *data = file.data;
+        size_t size = file.size;
 
-            else if (strcmp(name, "g") == 0)
+        //! Encontrar a root <svg>, saltando o prólogo
+        size_t pos = 0;
+        while (true)
+        {
+            while (pos < size && data[pos] != '<')
             {
-                const char *id = child->Attribute("id");
-                vector<SVGElement *> group_elements;
+                pos++;
+            }
+            if (pos >= size)
+            {
+                throw runtime_error("Unable to load " + svg_file);
+            }
+            size_t skipped = skip_markup(data, size, pos);
+            if (skipped == pos)
+            {
+                break;
+            }
+            pos = skipped;
+        }
+        size_t root_end = tag_end(data, size, pos);
 
-                XMLElement *group_child = child->FirstChildElement();
+        //! Ler width e height só da start tag da root
+        XMLDocument doc;
+        bool empty_root;
+        if (!parse_start_tag(doc, data, pos, root_end, empty_root))
+        {
+            throw runtime_error("Unable to load " + svg_file);
+        }
+        dimensions.x = doc.RootElement()->IntAttribute("width");
+        dimensions.y = doc.RootElement()->IntAttribute("height");
+        if (empty_root)
+        {
+            return;
+        }
 
-                while (group_child != nullptr)
+        //! Percorrer os filhos da root um a um, entrando nos <g>: os que não têm opacity são só uma matriz
+        //! e atributos herdados, e os seus filhos são lidos e entregues um a um como os da root (um <g> com
+        //! opacity é desenhado numa layer com todos os filhos juntos, esse é lido inteiro como os outros)
+        vector<SVGElement *> batch;
+        vector<OpenGroup> groups;
+        ReadContext ctx;
+        ctx.streaming = true;
+        size_t released = 0;
+        const size_t release_step = 1 << 20; //! libertar páginas lidas de MB em MB
+        pos = root_end;
+        while (pos < size)
+        {
+            if (data[pos] != '<')
+            {
+                pos++;
+                continue;
+            }
+            size_t skipped = skip_markup(data, size, pos);
+            if (skipped != pos)
+            {
+                pos = skipped;
+                continue;
+            }
+            if (pos + 1 < size && data[pos + 1] == '/')
+            {
+                if (groups.empty())
                 {
-                    const char *group_child_name = group_child->Name();
-
-                    if (strcmp(group_child_name, "rect") == 0)
-                    {
-                        //! Dar parse aos atributos do retângulo e criar rect
-                        int x = child->IntAttribute("x");
-                        int y = child->IntAttribute("y");
-                        int width = child->IntAttribute("width");
-                        int height = child->IntAttribute("height");
-                        string fill = child->Attribute("fill");
-                        Color color = parse_color(fill);
-                        group_elements.push_back(new rect(color, {x, y}, width, height));
-                        svg_elements.back()->rotate(transform_origin, rotate);
-                        svg_elements.back()->translate(translate);
-                        svg_elements.back()->scale(transform_origin, scale);
-                    }
-                    else if (strcmp(group_child_name, "circle") == 0)
-                    {
-                        //! Dar parse aos atributos do círculo e criar Circle
-                        int cx = child->IntAttribute("cx");
-                        int cy = child->IntAttribute("cy");
-                        int r = child->IntAttribute("r");
-                        string fill = child->Attribute("fill");
-                        Color color = parse_color(fill);
-                        group_elements.push_back(new Circle(color, {cx, cy}, {r, r}));
-                        svg_elements.back()->rotate(transform_origin, rotate);
-                        svg_elements.back()->translate(translate);
-                        svg_elements.back()->scale(transform_origin, scale);
-                    }
-                    else if (strcmp(group_child_name, "line") == 0)
-                    {
-                        //! Dar parse aos atributos da linha e criar line
-                        int x1 = child->IntAttribute("x1");
-                        int y1 = child->IntAttribute("y1");
-                        int x2 = child->IntAttribute("x2");
-                        int y2 = child->IntAttribute("y2");
-                        string stroke = child->Attribute("stroke");
-                        Color color = parse_color(stroke);
-                        group_elements.push_back(new line({x1, y1}, {x2, y2}, color));
-                        svg_elements.back()->rotate(transform_origin, rotate);
-                        svg_elements.back()->translate(translate);
-                        svg_elements.back()->scale(transform_origin, scale);
-                    }
-                    else if (strcmp(group_child_name, "ellipse") == 0)
-                    {
-                        //! Dar parse aos atributos da elipse e criar Ellipse
-                        int cx = child->IntAttribute("cx");
-                        int cy = child->IntAttribute("cy");
-                        int rx = child->IntAttribute("rx");
-                        int ry = child->IntAttribute("ry");
-                        string fill = child->Attribute("fill");
-                        Color color = parse_color(fill);
-                        group_elements.push_back(new Ellipse(color, {cx, cy}, {rx, ry}));
-                        svg_elements.back()->rotate(transform_origin, rotate);
-                        svg_elements.back()->translate(translate);
-                        svg_elements.back()->scale(transform_origin, scale);
-                    }
-
-                    else if (strcmp(group_child_name, "polyline") == 0)
-                    {
-                        //! Dar parse aos atributos do polyline e criar polyline
-                        string points_str = child->Attribute("points");
-                        vector<Point> points;
-                        istringstream iss(points_str);
-                        int x, y;
-                        char comma;
-                        while (iss >> x >> comma >> y)
-                        {
-                            Point p;
-                            p.x = x;
-                            p.y = y;
-                            points.push_back(p);
-                        }
-                        string fill = child->Attribute("fill");
-                        Color color = parse_color(fill);
-                        group_elements.push_back(new polyline(color, points));
-                        svg_elements.back()->rotate(transform_origin, rotate);
-                        svg_elements.back()->translate(translate);
-                        svg_elements.back()->scale(transform_origin, scale);
-                    }
+                    break; //! end tag da root
+                }
+                groups.pop_back(); //! end tag de um <g> em que se entrou
+                pos = tag_end(data, size, pos);
+                continue;
+            }
+            const OpenGroup *parent = groups.empty() ? nullptr : &groups.back();
 
-                    if (strcmp(group_child_name, "polygon") == 0)
-                    {
-                        //! Dar parse aos atributos do polígono e criar polygon
-                        string points_str = child->Attribute("points");
-                        vector<Point> points;
-                        istringstream iss(points_str);
-                        int x, y;
-                        char comma;
-                        while (iss >> x >> comma >> y)
-                        {
-                            Point p;
-                            p.x = x;
-                            p.y = y;
-                            points.push_back(p);
-                        }
-                        string fill = child->Attribute("fill");
-                        Color color = parse_color(fill);
-                        group_elements.push_back(new polygon(color, points));
-                        svg_elements.back()->rotate(transform_origin, rotate);
-                        svg_elements.back()->translate(translate);
-                        svg_elements.back()->scale(transform_origin, scale);
-                    }
-                    group_child = group_child->NextSiblingElement();
+            //! Só o tempo real é medido aqui, o de CPU custaria uma chamada ao sistema por elemento
+            StageTimer load(Stage::load, StageTimer::WALL);
+            if (is_group_tag(data, size, pos))
+            {
+                size_t start_end = tag_end(data, size, pos);
+                unique_ptr<XMLDocument> group_doc = make_unique<XMLDocument>();
+                bool empty;
+                if (!parse_start_tag(*group_doc, data, pos, start_end, empty))
+                {
+                    throw runtime_error("Unable to parse " + svg_file);
+                }
+                Attributes attrs(group_doc->RootElement());
+                if (parent != nullptr)
+                {
+                    attrs.inherit(parent->attrs);
+                }
+                if (!empty && read_alpha(attrs, Attr::count, ctx) == 255)
+                {
+                    Transform t = (parent != nullptr ? parent->t : Transform()) * read_transform(attrs);
+                    groups.push_back({std::move(group_doc), attrs, t});
+                    pos = start_end;
+                    continue;
                 }
-                svg_elements.push_back(new Group(group_elements, id));
-                svg_elements.back()->rotate(transform_origin, rotate);
-                svg_elements.back()->translate(translate);
-                svg_elements.back()->scale(transform_origin, scale);
             }
-            //! Avançar para o próximo child node
-            child = child->NextSiblingElement();
+            size_t end = element_end(data, size, pos);
+            doc.Clear();
+            if (doc.Parse(data + pos, end - pos) != XML_SUCCESS)
+            {
+                throw runtime_error("Unable to parse " + svg_file);
+            }
+            load.stop();
+            if (parent != nullptr)
+            {
+                read_element(doc.RootElement(), batch, ctx, parent->t, &parent->attrs);
+            }
+            else
+            {
+                read_element(doc.RootElement(), batch, ctx);
+            }
+            for (SVGElement *element : batch)
+            {
+                on_element(element);
+            }
+            batch.clear();
+
+            pos = end;
+            if (pos - released >= release_step)
+            {
+                file.release_before(pos);
+                released = pos;
+            }
         }
     }
 }
@@ -0,0 +1,208 @@
+//! svgbatch: converts many SVG files to PNG with the pipeline of Batch.hpp
+//!
+//! usage: svgbatch [options] file.svg... | @list.txt
+//!   -o DIR          write the PNGs to DIR (default: next to each SVG)
+//!   --parsers=N     threads parsing (default 1)
+//!   --renderers=N   threads drawing (default: one per core)
+//!   --encoders=N    threads encoding (default: one per core)
+//!   --queue=N       jobs that can wait between two stages (default 16)
+//!   --level=N       PNG compression level, 0 to 9 (default 6)
+//!   --sizes=A,B,... the outputs of each file, as the largest side in pixels (0: the size of the document),
+//!                   "a.svg" with --sizes=0,256 gives a.png and a-256.png from a single parse
+//!   --subpixel=N    read and draw anti-aliased with N bits below the pixel (default 0, 8 is good for thumbnails)
+//!   --stats=json    print, instead of the table of the stages, one JSON object with the time of each stage of
+//!                   the conversions and the counters of Stats.hpp, summed over all the files (the allocations
+//!                   are only counted when built with -DSVG_STATS_ALLOCATIONS=1)
+//! a list file has one SVG path per line
+#include "Batch.hpp"
+#include "SVGAttributes.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    //! the png file for svg_file: same name with .png, in out_dir if there is one
+    string png_name(const string &svg_file, const string &out_dir)
+    {
+        string name = svg_file;
+        size_t dot = name.rfind('.');
+        size_t slash = name.rfind('/');
+        if (dot != string::npos && (slash == string::npos || dot > slash))
+        {
+            name.erase(dot);
+        }
+        name += ".png";
+        if (!out_dir.empty())
+        {
+            name = out_dir + "/" + name.substr(slash == string::npos ? 0 : slash + 1);
+        }
+        return name;
+    }
+
+    //! more threads than this in one stage is certainly a typo
+    const unsigned MAX_THREADS = 1024;
+
+    //! the value of an option of the form --name=value, or nullptr if arg is not that option
+    const char *option(const string &arg, const string &name)
+    {
+        string prefix = "--" + name + "=";
+        return arg.compare(0, prefix.size(), prefix) == 0 ? arg.c_str() + prefix.size() : nullptr;
+    }
+
+    //! the thread count of --parsers, --renderers or --encoders: a whole number, below 1 becomes 1
+    //! false if value is not a number, so that "--renderers=x" is not read as some huge count
+    bool thread_count(const char *value, unsigned &count)
+    {
+        char *end;
+        errno = 0;
+        long n = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || errno == ERANGE)
+        {
+            return false;
+        }
+        count = static_cast<unsigned>(clamp(n, 1L, static_cast<long>(MAX_THREADS)));
+        return true;
+    }
+
+    void print_stage(const char *name, const svg::StageStats &s)
+    {
+        printf("%-8s %8zu jobs  %2u threads  %9.3f s busy  %10.1f jobs/s\n",
+               name, s.items, s.threads, s.busy_seconds, s.throughput());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    svg::BatchOptions options;
+    options.png.threads = 1;
+    svg::StatsCollector collector;
+    bool json = false;
+    string out_dir;
+    vector<string> inputs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        const char *value;
+        if (arg == "-o" && i + 1 < argc)
+        {
+            out_dir = argv[++i];
+        }
+        else if ((value = option(arg, "parsers")))
+        {
+            if (!thread_count(value, options.parsers))
+            {
+                cerr << "invalid thread count " << arg << endl;
+                return 2;
+            }
+        }
+        else if ((value = option(arg, "renderers")))
+        {
+            if (!thread_count(value, options.renderers))
+            {
+                cerr << "invalid thread count " << arg << endl;
+                return 2;
+            }
+        }
+        else if ((value = option(arg, "encoders")))
+        {
+            if (!thread_count(value, options.encoders))
+            {
+                cerr << "invalid thread count " << arg << endl;
+                return 2;
+            }
+        }
+        else if ((value = option(arg, "queue")))
+        {
+            options.queue_size = max(1, atoi(value));
+        }
+        else if ((value = option(arg, "level")))
+        {
+            options.png.level = atoi(value);
+        }
+        else if ((value = option(arg, "sizes")))
+        {
+            string_view list = value;
+            int size;
+            while (svg::next_int(list, size))
+            {
+                options.sizes.push_back(max(0, size));
+            }
+        }
+        else if ((value = option(arg, "subpixel")))
+        {
+            options.subpixel_bits = clamp(atoi(value), 0, 16);
+        }
+        else if ((value = option(arg, "stats")))
+        {
+            if (string(value) != "json")
+            {
+                cerr << "unknown stats format " << value << endl;
+                return 2;
+            }
+            json = true;
+            options.stats = &collector;
+        }
+        else if (!arg.empty() && arg[0] == '@')
+        {
+            ifstream list(arg.substr(1));
+            string line;
+            while (getline(list, line))
+            {
+                if (!line.empty())
+                {
+                    inputs.push_back(line);
+                }
+            }
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            cerr << "unknown option " << arg << endl;
+            return 2;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty())
+    {
+        cerr << "usage: svgbatch [-o DIR] [--parsers=N] [--renderers=N] [--encoders=N] [--queue=N] [--level=N] [--sizes=A,B,...] [--subpixel=N] [--stats=json] file.svg... | @list.txt" << endl;
+        return 2;
+    }
+
+    vector<pair<string, string>> jobs;
+    for (const string &svg_file : inputs)
+    {
+        jobs.push_back({svg_file, png_name(svg_file, out_dir)});
+    }
+
+    svg::BatchStats stats = svg::convert_batch(jobs, options);
+    if (json)
+    {
+        printf("%s\n", collector.stats().json().c_str());
+    }
+    else
+    {
+        print_stage("parse", stats.parse);
+        print_stage("render", stats.render);
+        print_stage("encode", stats.encode);
+        printf("%zu files in %.3f s (%.1f files/s), %zu images allocated, %zu failed\n",
+               jobs.size(), stats.wall_seconds, jobs.size() / stats.wall_seconds,
+               stats.images_allocated, stats.failures.size());
+    }
+    for (const auto &failure : stats.failures)
+    {
+        cerr << failure.first << ": " << failure.second << endl;
+    }
+    return stats.failures.empty() ? 0 : 1;
+}
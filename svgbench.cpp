@@ -0,0 +1,316 @@
+//! svgbench: measures how fast the library reads and draws SVG files
+//!
+//! usage: svgbench [options] MODE file.svg...
+//!   parse           reads each file with parseSVG (the text is loaded once, so the disk is not measured) and
+//!                   prints the bytes and the elements read per second, and the allocations per element (only
+//!                   counted when built with -DSVG_STATS_ALLOCATIONS=1)
+//!   compiled        draws each file with its elements (render, the virtual draw of every element) and with its
+//!                   CompiledScene, and prints both times, the time of compile() and how many times faster
+//!                   the compiled scene draws
+//!   threads         draws the CompiledScene of each file with render_parallel with 1, 2, 4... up to --threads
+//!                   threads, and prints the time and the speedup over one thread for each count
+//!   retained        moves 1% of the top level elements of each file (by one pixel) per frame for --frames
+//!                   frames, drawn by a RetainedRenderer and by redrawing the whole image, and prints the time
+//!                   of a frame both ways and the part of the image the retained renderer redrew
+//!   --repeat=N      how many times each measure is made, the fastest one is printed (default 5)
+//!   --threads=N     the most threads of the threads mode (default: one per core)
+//!   --tile=N        the tile size of render_parallel, in pixels (default 64)
+//!   --frames=N      the frames of the retained mode (default 100)
+//! every line is one file, the times are in milliseconds
+#include "CompiledScene.hpp"
+#include "Render.hpp"
+#include "Retained.hpp"
+#include "Scene.hpp"
+#include "Stats.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    struct Options
+    {
+        int repeat = 5;
+        unsigned threads = max(1u, thread::hardware_concurrency());
+        int tile_size = 64;
+        int frames = 100;
+    };
+
+    //! more threads than this is certainly a typo
+    const unsigned MAX_THREADS = 1024;
+
+    //! a whole number of at least 1 (at most MAX_THREADS), false if value is not a number
+    bool thread_count(const char *value, unsigned &count)
+    {
+        char *end;
+        errno = 0;
+        long n = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || errno == ERANGE)
+        {
+            return false;
+        }
+        count = static_cast<unsigned>(clamp(n, 1L, static_cast<long>(MAX_THREADS)));
+        return true;
+    }
+
+    //! the value of an option of the form --name=value, or nullptr if arg is not that option
+    const char *option(const string &arg, const string &name)
+    {
+        string prefix = "--" + name + "=";
+        return arg.compare(0, prefix.size(), prefix) == 0 ? arg.c_str() + prefix.size() : nullptr;
+    }
+
+    //! the whole file, or an exception if it can't be read
+    string read_file(const string &file)
+    {
+        ifstream in(file, ios::binary);
+        if (!in)
+        {
+            throw runtime_error("Unable to load " + file);
+        }
+        ostringstream text;
+        text << in.rdbuf();
+        return text.str();
+    }
+
+    //! the seconds run takes, the fastest of repeat runs
+    template <class F>
+    double fastest(int repeat, F run)
+    {
+        double best = 0;
+        for (int i = 0; i < repeat; i++)
+        {
+            auto start = chrono::steady_clock::now();
+            run();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            best = i == 0 ? seconds : min(best, seconds);
+        }
+        return best;
+    }
+
+    //! the elements readSVG created (the ones of the groups too), and the allocations of the parse
+    svg::ConvertStats parse_stats(const string &text)
+    {
+        svg::StatsCollector collector;
+        svg::StatsScope scope(&collector);
+        svg::Scene scene;
+        svg::parseSVG(text, scene);
+        return collector.stats();
+    }
+
+    void bench_parse(const string &file, const Options &options)
+    {
+        string text = read_file(file);
+        double seconds = fastest(options.repeat, [&]() {
+            svg::Scene scene;
+            svg::parseSVG(text, scene);
+        });
+        svg::ConvertStats stats = parse_stats(text);
+        uint64_t elements = 0;
+        for (const auto &type : stats.elements)
+        {
+            elements += type.second;
+        }
+        printf("%-32s %10.3f ms %9.1f MB/s %12.0f elements/s %8.2f allocations/element\n", file.c_str(),
+               seconds * 1e3, text.size() / seconds / 1e6, elements / seconds,
+               elements == 0 ? 0.0 : static_cast<double>(stats[svg::Counter::allocations]) / elements);
+    }
+
+    void bench_compiled(const string &file, const Options &options)
+    {
+        svg::Scene scene;
+        svg::readSVG(file, scene);
+        svg::PNGImage img(scene.dimensions.x, scene.dimensions.y);
+        double elements = fastest(options.repeat, [&]() {
+            svg::render(scene.elements, img);
+        });
+        svg::CompiledScene compiled;
+        double compiling = fastest(options.repeat, [&]() {
+            compiled = svg::compile(scene.elements, scene.dimensions);
+        });
+        double drawing = fastest(options.repeat, [&]() {
+            compiled.draw(img);
+        });
+        printf("%-32s %10.3f ms elements %10.3f ms compiled (+ %.3f ms compile) %6.2fx\n", file.c_str(),
+               elements * 1e3, drawing * 1e3, compiling * 1e3, elements / drawing);
+    }
+
+    void bench_threads(const string &file, const Options &options)
+    {
+        svg::Scene scene;
+        svg::readSVG(file, scene);
+        svg::CompiledScene compiled = svg::compile(scene.elements, scene.dimensions);
+        svg::PNGImage img(scene.dimensions.x, scene.dimensions.y);
+        vector<unsigned> counts;
+        for (unsigned threads = 1; threads < options.threads; threads *= 2)
+        {
+            counts.push_back(threads);
+        }
+        counts.push_back(options.threads);
+        double one = 0;
+        for (unsigned threads : counts)
+        {
+            double seconds = fastest(options.repeat, [&]() {
+                svg::render_parallel(compiled, img, threads, options.tile_size);
+            });
+            if (threads == 1)
+            {
+                one = seconds;
+            }
+            printf("%-32s %4u threads %10.3f ms %6.2fx\n", file.c_str(), threads, seconds * 1e3, one / seconds);
+        }
+    }
+
+    //! moves the elements of frame: one in a hundred, a different one every frame, by one pixel to the right
+    //! during the first hundred frames, back to the left during the next hundred, and so on
+    template <class Move>
+    void move_elements(const vector<svg::SVGElement *> &elements, int frame, Move move)
+    {
+        svg::Point dir = {(frame / 100) % 2 == 0 ? 1 : -1, 0};
+        for (size_t i = frame % 100; i < elements.size(); i += 100)
+        {
+            move(elements[i], dir);
+        }
+    }
+
+    void bench_retained(const string &file, const Options &options)
+    {
+        svg::Scene scene;
+        svg::readSVG(file, scene);
+        svg::RetainedRenderer retained(scene.elements, scene.dimensions);
+        retained.frame();
+        double area = 0;
+        double incremental = fastest(1, [&]() {
+            for (int frame = 0; frame < options.frames; frame++)
+            {
+                move_elements(scene.elements, frame, [&](svg::SVGElement *element, const svg::Point &dir) {
+                    retained.translate(element, dir);
+                });
+                retained.frame();
+                for (const svg::Box &box : retained.redrawn())
+                {
+                    area += static_cast<double>(box.x1 - box.x0) * (box.y1 - box.y0);
+                }
+            }
+        });
+
+        svg::Scene full_scene;
+        svg::readSVG(file, full_scene);
+        svg::PNGImage img(full_scene.dimensions.x, full_scene.dimensions.y);
+        double full = fastest(1, [&]() {
+            for (int frame = 0; frame < options.frames; frame++)
+            {
+                move_elements(full_scene.elements, frame, [](svg::SVGElement *element, const svg::Point &dir) {
+                    element->translate(dir);
+                });
+                svg::fill_rect(img, svg::image_box(img), {255, 255, 255}, svg::image_box(img));
+                svg::render(full_scene.elements, img);
+            }
+        });
+        double canvas = static_cast<double>(scene.dimensions.x) * scene.dimensions.y * options.frames;
+        printf("%-32s %10.3f ms/frame retained %10.3f ms/frame full %6.2fx %6.2f%% redrawn\n", file.c_str(),
+               incremental * 1e3 / options.frames, full * 1e3 / options.frames, full / incremental,
+               canvas > 0 ? 100 * area / canvas : 0.0);
+    }
+
+    //! the benchmarks, by the name of their mode
+    using Bench = void (*)(const string &file, const Options &options);
+    const pair<const char *, Bench> BENCHES[] = {
+        {"parse", bench_parse},
+        {"compiled", bench_compiled},
+        {"threads", bench_threads},
+        {"retained", bench_retained},
+    };
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    string mode;
+    vector<string> inputs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        const char *value;
+        if ((value = option(arg, "repeat")))
+        {
+            options.repeat = max(1, atoi(value));
+        }
+        else if ((value = option(arg, "threads")))
+        {
+            if (!thread_count(value, options.threads))
+            {
+                cerr << "invalid thread count " << arg << endl;
+                return 2;
+            }
+        }
+        else if ((value = option(arg, "frames")))
+        {
+            options.frames = max(1, atoi(value));
+        }
+        else if ((value = option(arg, "tile")))
+        {
+            options.tile_size = atoi(value);
+            if (options.tile_size <= 0)
+            {
+                cerr << "invalid tile size " << arg << endl;
+                return 2;
+            }
+        }
+        else if (!arg.empty() && arg[0] == '-')
+        {
+            cerr << "unknown option " << arg << endl;
+            return 2;
+        }
+        else if (mode.empty())
+        {
+            mode = arg;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+    Bench bench = nullptr;
+    for (const auto &entry : BENCHES)
+    {
+        if (mode == entry.first)
+        {
+            bench = entry.second;
+        }
+    }
+    if (bench == nullptr || inputs.empty())
+    {
+        cerr << "usage: svgbench [--repeat=N] [--threads=N] [--tile=N] [--frames=N] parse|compiled|threads|retained file.svg..."
+             << endl;
+        return 2;
+    }
+
+    int failures = 0;
+    for (const string &file : inputs)
+    {
+        try
+        {
+            bench(file, options);
+        }
+        catch (const exception &e)
+        {
+            cerr << file << ": " << e.what() << endl;
+            failures++;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,463 @@
+//! svgtest: checks that the ways of drawing a document give the same pixels
+//!
+//! usage: svgtest
+//! every document below is drawn by the elements themselves (render, what convert does) and then
+//! compiled and drawn by CompiledScene::draw and by render_parallel with several thread counts and
+//! tile sizes; any pixel that differs is a failure
+//! the anti-aliased documents are drawn by CompiledScene::draw and by render_parallel, and in square
+//! tiles where they may differ by one level
+//! the documents are also drawn by a RetainedRenderer while some of their elements move, and read
+//! with streamSVG
+//! a few pixels whose color is known are checked too, and the sizes of tiles, strips and regions that
+//! have to be refused
+//! prints one line per check and exits with 1 if one of them failed
+#include "CompiledScene.hpp"
+#include "Render.hpp"
+#include "Retained.hpp"
+#include "Scene.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace svg;
+
+namespace
+{
+    struct Document
+    {
+        const char *name;
+        const char *text;
+        int subpixel_bits = 0; //! read and drawn anti-aliased when it isn't 0
+    };
+
+    const Document DOCUMENTS[] = {
+        {"ellipses", R"X(<svg width="160" height="120">
+            <ellipse cx="40" cy="30" rx="35" ry="12" fill="#ff0000" transform="rotate(25 40 30)"/>
+            <ellipse cx="90" cy="70" rx="50" ry="30" fill="#0000ff" opacity="0.5"/>
+            <circle cx="150" cy="110" r="30" fill="#00ff00" opacity="0.7"/>
+            <ellipse cx="70" cy="60" rx="60" ry="9" fill="#ff00ff" opacity="0.4" transform="rotate(-40 70 60)"/>
+        </svg>)X"},
+        {"lines", R"X(<svg width="150" height="100">
+            <polyline points="0,0 30,60 60,20 149,99" stroke="#123456" stroke-width="4" stroke-linejoin="round"/>
+            <polyline points="10,90 70,10 140,80" stroke="#ff0000" stroke-width="7" opacity="0.5"/>
+            <line x1="0" y1="99" x2="149" y2="0" stroke="#00aa00" stroke-width="3"/>
+            <polygon points="70,10 110,20 90,60" fill="#ff00ff" opacity="0.6"/>
+            <rect x="3" y="4" width="50" height="30" fill="#ff0000" stroke="#000000" stroke-width="3"/>
+        </svg>)X"},
+        {"paths", R"X(<svg width="130" height="100">
+            <path d="M10 80 C 30 50, 60 100, 100 70 Z" fill="#ffff00" stroke="#000000" stroke-width="2" transform="rotate(3)"/>
+            <path d="M20 10 L 120 20 L 60 90 Z M 50 30 L 80 35 L 65 60 Z" fill="#0080ff" fill-rule="evenodd" opacity="0.5"/>
+        </svg>)X"},
+        {"groups", R"X(<svg width="140" height="110">
+            <rect x="0" y="0" width="140" height="110" fill="#808080"/>
+            <g opacity="0.5">
+                <circle cx="40" cy="40" r="30" fill="#00ff00"/>
+                <ellipse cx="60" cy="50" rx="35" ry="15" fill="#0000ff" transform="rotate(20 60 50)"/>
+                <g opacity="0.5">
+                    <rect x="50" y="60" width="80" height="40" fill="#ff0000"/>
+                    <circle cx="100" cy="70" r="25" fill="#ffff00"/>
+                </g>
+            </g>
+            <g opacity="0.3" transform="translate(10 5)"><polygon points="120,0 139,109 80,100" fill="#000000"/></g>
+        </svg>)X"},
+        {"uses", R"X(<svg width="150" height="120">
+            <defs>
+                <g id="s"><rect x="0" y="0" width="20" height="16" fill="#00ff00"/><circle cx="20" cy="16" r="10" fill="#0000ff"/></g>
+                <g id="h" opacity=".5"><rect x="0" y="0" width="30" height="20" fill="#ff0000"/><circle cx="15" cy="20" r="12" fill="#ff0000"/></g>
+            </defs>
+            <rect x="10" y="10" width="120" height="90" fill="#ffffff" stroke="#000000" stroke-width="2"/>
+            <use href="#s" x="80" y="60"/>
+            <use href="#s" x="95" y="30" opacity="0.5"/>
+            <use href="#s" transform="rotate(30) translate(60 10)"/>
+            <use href="#s" transform="rotate(-15) translate(10 70)" opacity="0.6"/>
+            <use href="#h" x="20" y="20"/>
+            <use href="#h" x="130" y="100"/>
+        </svg>)X"},
+        {"strokes", R"X(<svg width="140" height="100">
+            <rect x="10" y="10" width="50" height="40" fill="#ff0000" stroke="#0000ff" stroke-width="10" opacity="0.5"/>
+            <rect x="70" y="10" width="50" height="40" fill="#ff0000" stroke="#0000ff" stroke-width="6" opacity="0.5" transform="rotate(10 95 30)"/>
+            <polygon points="10,60 60,65 30,95" fill="#00ff00" stroke="#000000" stroke-width="5" opacity="0.6"/>
+            <path d="M70 60 C 90 50, 110 100, 130 70 Z" fill="#ffff00" stroke="#ff00ff" stroke-width="4" opacity="0.4"/>
+        </svg>)X"},
+        {"rotated use of a group", R"X(<svg width="120" height="100">
+            <defs><g id="h" opacity=".5"><rect x="0" y="0" width="40" height="30" fill="#ff0000"/><circle cx="40" cy="30" r="15" fill="#0000ff"/></g></defs>
+            <use href="#h" transform="rotate(20) translate(40 10)"/>
+            <use href="#h" x="10" y="55"/>
+        </svg>)X"},
+        {"use references", R"X(<svg width="100" height="80">
+            <use href="#later" x="50" y="0"/>
+            <g transform="translate(0 40)"><rect id="moved" x="0" y="0" width="20" height="20" fill="#0000ff"/></g>
+            <use href="#moved" x="60" y="0"/>
+            <g id="loop"><use href="#loop" x="5" y="5"/></g>
+            <rect id="later" x="0" y="0" width="20" height="20" fill="#00ff00"/>
+        </svg>)X"},
+        {"anti-aliased strokes", R"X(<svg width="150" height="100">
+            <polyline points="0.5,0.3 30.2,60.7 60.9,20.1 149.6,99.4" stroke="#123456" stroke-width="4.5" stroke-linejoin="round"/>
+            <polyline points="10.3,90.8 70.1,10.4 140.7,80.2" stroke="#ff0000" stroke-width="7.3" opacity="0.5"/>
+            <line x1="0" y1="99.5" x2="149.5" y2="0.2" stroke="#00aa00" stroke-width="2.7"/>
+            <polyline points="-20.4,50.3 170.2,47.9" stroke="#0000ff" stroke-width="3.1"/>
+            <rect x="3.3" y="4.6" width="50.2" height="30.7" fill="#ff0000" stroke="#000000" stroke-width="3.4" transform="rotate(7)"/>
+        </svg>)X", 8},
+        {"anti-aliased shapes", R"X(<svg width="160" height="120">
+            <ellipse cx="40.3" cy="30.6" rx="35.2" ry="12.7" fill="#ff0000" transform="rotate(25 40 30)"/>
+            <circle cx="150.5" cy="110.2" r="30.4" fill="#00ff00" opacity="0.7"/>
+            <path d="M10.2 80.7 C 30 50, 60 100, 100.4 70.3 Z" fill="#ffff00" stroke="#000000" stroke-width="2.2"/>
+            <path d="M20 10 L 120.6 20.3 L 60.2 90.9 Z M 50 30 L 80 35 L 65 60 Z" fill="#0080ff" fill-rule="evenodd" opacity="0.5"/>
+            <g opacity="0.5"><polygon points="-10.5,100.2 159.7,5.4 170,119.8" fill="#ff00ff"/></g>
+        </svg>)X", 8},
+    };
+
+    //! a pixel that a document must have, whatever way it is drawn
+    struct ExpectedPixel
+    {
+        const char *text;
+        Point at;
+        Color color;
+    };
+
+    //! the colors with opacities of 0.5 over white can round either way
+    const ExpectedPixel EXPECTED_PIXELS[] = {
+        //! the stroke covers the fill, it is blended once and not over the fill
+        {DOCUMENTS[5].text, {12, 30}, {127, 127, 255}},
+        {DOCUMENTS[5].text, {35, 30}, {255, 127, 127}},
+        //! a <use> of a <g opacity=".5">, rotated, keeps the opacity of the group
+        {DOCUMENTS[6].text, {55, 35}, {255, 127, 127}},
+        {DOCUMENTS[6].text, {20, 65}, {255, 127, 127}},
+        //! a <use> before the element it refers to
+        {DOCUMENTS[7].text, {55, 5}, {0, 255, 0}},
+        //! the element is used without the transform of the <g> it is in
+        {DOCUMENTS[7].text, {65, 5}, {0, 0, 255}},
+        {DOCUMENTS[7].text, {65, 45}, {255, 255, 255}},
+        {DOCUMENTS[7].text, {5, 45}, {0, 0, 255}},
+    };
+
+    //! the number of pixels of a and b that differ by more than tolerance levels
+    long differences(const PNGImage &a, const PNGImage &b, int tolerance = 0)
+    {
+        long count = 0;
+        for (int y = 0; y < a.height(); y++)
+        {
+            for (int x = 0; x < a.width(); x++)
+            {
+                const Color &p = a.at(x, y), &q = b.at(x, y);
+                if (abs(p.red - q.red) > tolerance || abs(p.green - q.green) > tolerance ||
+                    abs(p.blue - q.blue) > tolerance)
+                {
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+
+    //! draws document in every way, prints what differs from render and returns false if something did
+    //! (the elements don't draw anti-aliased, those documents are compared with CompiledScene::draw)
+    bool check(const Document &document)
+    {
+        Scene scene;
+        scene.subpixel_bits = document.subpixel_bits;
+        parseSVG(document.text, scene);
+        const Point &size = scene.dimensions;
+        CompiledScene compiled = compile(scene.elements, size, document.subpixel_bits);
+
+        bool ok = true;
+        PNGImage expected(size.x, size.y);
+        if (document.subpixel_bits == 0)
+        {
+            render(scene.elements, expected);
+            PNGImage serial(size.x, size.y);
+            compiled.draw(serial);
+            if (long n = differences(expected, serial))
+            {
+                cout << document.name << ": CompiledScene::draw differs on " << n << " pixels" << endl;
+                ok = false;
+            }
+        }
+        else
+        {
+            compiled.draw(expected);
+        }
+        for (unsigned threads : {1u, 2u, 3u, 8u})
+        {
+            for (int tile_size : {1, 7, 16, 64, 1000})
+            {
+                PNGImage parallel(size.x, size.y);
+                render_parallel(compiled, parallel, threads, tile_size);
+                if (long n = differences(expected, parallel))
+                {
+                    cout << document.name << ": render_parallel with " << threads << " threads and tiles of "
+                         << tile_size << " differs on " << n << " pixels" << endl;
+                    ok = false;
+                }
+            }
+        }
+        if (document.subpixel_bits != 0)
+        {
+            //! square tiles cut the edges on their sides too, where the coverage can round one level apart
+            PNGImage tiled(size.x, size.y);
+            for (int y = 0; y < size.y; y += 7)
+            {
+                for (int x = 0; x < size.x; x += 7)
+                {
+                    compiled.draw(tiled, Box{x, y, x + 7, y + 7}.intersect(image_box(tiled)));
+                }
+            }
+            if (long n = differences(expected, tiled, 1))
+            {
+                cout << document.name << ": CompiledScene::draw in tiles of 7 differs by more than one level on "
+                     << n << " pixels" << endl;
+                ok = false;
+            }
+        }
+        if (ok)
+        {
+            cout << document.name << ": ok" << endl;
+        }
+        return ok;
+    }
+
+    bool similar(const Color &a, const Color &b)
+    {
+        return abs(a.red - b.red) <= 1 && abs(a.green - b.green) <= 1 && abs(a.blue - b.blue) <= 1;
+    }
+
+    //! the pixels of EXPECTED_PIXELS, drawn by the elements and compiled
+    bool check_pixels()
+    {
+        bool ok = true;
+        for (const ExpectedPixel &expected : EXPECTED_PIXELS)
+        {
+            Scene scene;
+            parseSVG(expected.text, scene);
+            PNGImage drawn(scene.dimensions.x, scene.dimensions.y);
+            render(scene.elements, drawn);
+            PNGImage compiled(scene.dimensions.x, scene.dimensions.y);
+            compile(scene.elements, scene.dimensions).draw(compiled);
+            for (const PNGImage *img : {&drawn, &compiled})
+            {
+                const Color &c = img->at(expected.at.x, expected.at.y);
+                if (!similar(c, expected.color))
+                {
+                    cout << "pixel (" << expected.at.x << ", " << expected.at.y << ") is " << int(c.red) << " "
+                         << int(c.green) << " " << int(c.blue) << " instead of " << int(expected.color.red) << " "
+                         << int(expected.color.green) << " " << int(expected.color.blue) << endl;
+                    ok = false;
+                }
+            }
+        }
+        if (ok)
+        {
+            cout << "pixels: ok" << endl;
+        }
+        return ok;
+    }
+
+    //! moves some elements of the documents through a RetainedRenderer, over several frames and off the
+    //! image and back, and compares its image with render() of the moved elements
+    bool check_retained()
+    {
+        bool ok = true;
+        for (const Document &document : DOCUMENTS)
+        {
+            if (document.subpixel_bits != 0)
+            {
+                continue;
+            }
+            Scene scene;
+            parseSVG(document.text, scene);
+            const Point &size = scene.dimensions;
+            RetainedRenderer retained(scene.elements, size);
+            retained.frame();
+            const Point moves[] = {{17, -9}, {-3, 25}, {1000, 0}, {-1000, 0}, {-14, -16}};
+            for (const Point &move : moves)
+            {
+                for (size_t i = 0; i < scene.elements.size(); i += 2)
+                {
+                    retained.translate(scene.elements[i], move);
+                }
+                const PNGImage &frame = retained.frame();
+                PNGImage expected(size.x, size.y);
+                render(scene.elements, expected);
+                if (long n = differences(expected, frame))
+                {
+                    cout << document.name << ": RetainedRenderer differs on " << n << " pixels after moving by "
+                         << move.x << " " << move.y << endl;
+                    ok = false;
+                }
+            }
+        }
+        if (ok)
+        {
+            cout << "retained: ok" << endl;
+        }
+        return ok;
+    }
+
+    //! a document all inside one <g> (with another <g> in it, and one with opacity that is read whole)
+    const char *const WRAPPED = R"X(<svg width="120" height="100">
+        <g transform="translate(10 5)" fill="#0000ff" stroke-width="3">
+            <defs><rect id="r" x="0" y="0" width="10" height="10" fill="#ff0000"/></defs>
+            <rect x="0" y="0" width="30" height="20"/>
+            <g transform="rotate(10)" stroke="#00ff00"><circle cx="50" cy="30" r="15"/><polyline points="0,60 40,90 80,60"/></g>
+            <g opacity="0.5"><rect x="40" y="40" width="50" height="40" fill="#ff00ff"/><circle cx="90" cy="80" r="12"/></g>
+            <use href="#r" x="95" y="5"/>
+            <ellipse cx="20" cy="70" rx="18" ry="9"/>
+        </g>
+    </svg>)X";
+
+    //! streamSVG of every document (and of WRAPPED, whose children have to be handed one by one)
+    //! draws the same pixels as parseSVG; not the use references, which streamSVG can't resolve outside <defs>
+    bool check_streaming()
+    {
+        string svg_file = (filesystem::temp_directory_path() / "svgtest_stream.svg").string();
+        vector<pair<const char *, const char *>> texts = {{"wrapped in a <g>", WRAPPED}};
+        for (const Document &document : DOCUMENTS)
+        {
+            if (document.subpixel_bits == 0 && &document != &DOCUMENTS[7])
+            {
+                texts.push_back({document.name, document.text});
+            }
+        }
+        bool ok = true;
+        for (const auto &text : texts)
+        {
+            {
+                ofstream out(svg_file);
+                out << text.second;
+            }
+            Scene scene;
+            parseSVG(text.second, scene);
+            PNGImage expected(scene.dimensions.x, scene.dimensions.y);
+            render(scene.elements, expected);
+
+            Point dimensions;
+            vector<SVGElement *> elements;
+            streamSVG(svg_file, dimensions, [&](SVGElement *element) {elements.push_back(element);});
+            PNGImage streamed(dimensions.x, dimensions.y);
+            render(elements, streamed);
+            for (SVGElement *element : elements)
+            {
+                delete element;
+            }
+            if (long n = differences(expected, streamed))
+            {
+                cout << text.first << ": streamSVG differs on " << n << " pixels" << endl;
+                ok = false;
+            }
+            if (text.second == WRAPPED && elements.size() != 6)
+            {
+                cout << text.first << ": streamSVG handed " << elements.size() << " elements instead of 6" << endl;
+                ok = false;
+            }
+        }
+        filesystem::remove(svg_file);
+        if (ok)
+        {
+            cout << "streaming: ok" << endl;
+        }
+        return ok;
+    }
+
+    //! a tile size that is not positive has to be refused
+    bool check_tile_size()
+    {
+        Scene scene;
+        parseSVG(DOCUMENTS[0].text, scene);
+        CompiledScene compiled = compile(scene.elements, scene.dimensions);
+        PNGImage img(scene.dimensions.x, scene.dimensions.y);
+        for (int tile_size : {0, -16})
+        {
+            try
+            {
+                render_parallel(compiled, img, 2, tile_size);
+                cout << "tile size " << tile_size << ": accepted" << endl;
+                return false;
+            }
+            catch (const runtime_error &)
+            {
+            }
+        }
+        cout << "tile size: ok" << endl;
+        return true;
+    }
+
+    //! true if convert throws a runtime_error
+    template <class Convert>
+    bool refused(Convert convert)
+    {
+        try
+        {
+            convert();
+        }
+        catch (const runtime_error &)
+        {
+            return true;
+        }
+        return false;
+    }
+
+    //! a strip height that is not positive and an empty or inverted region have to be refused,
+    //! the file itself can be converted so only the arguments can be the reason
+    bool check_strips_and_regions()
+    {
+        filesystem::path dir = filesystem::temp_directory_path();
+        string svg_file = (dir / "svgtest.svg").string();
+        string png_file = (dir / "svgtest.png").string();
+        {
+            ofstream out(svg_file);
+            out << DOCUMENTS[0].text;
+        }
+        bool ok = true;
+        if (refused([&]() {convert_strips(svg_file, png_file, 16);}) ||
+            refused([&]() {convert_region(svg_file, png_file, {10, 20, 50, 60});}))
+        {
+            cout << "strips and regions: a valid conversion failed" << endl;
+            ok = false;
+        }
+        for (int strip_height : {0, -16})
+        {
+            if (!refused([&]() {convert_strips(svg_file, png_file, strip_height);}))
+            {
+                cout << "strip height " << strip_height << ": accepted" << endl;
+                ok = false;
+            }
+        }
+        for (const Box &region : {Box{10, 20, 10, 60}, Box{10, 20, 50, 20}, Box{50, 20, 10, 60}, Box{10, 60, 50, 20}})
+        {
+            if (!refused([&]() {convert_region(svg_file, png_file, region);}))
+            {
+                cout << "region " << region.x0 << " " << region.y0 << " " << region.x1 << " " << region.y1
+                     << ": accepted" << endl;
+                ok = false;
+            }
+        }
+        filesystem::remove(svg_file);
+        filesystem::remove(png_file);
+        if (ok)
+        {
+            cout << "strips and regions: ok" << endl;
+        }
+        return ok;
+    }
+}
+
+int main()
+{
+    bool ok = true;
+    for (const Document &document : DOCUMENTS)
+    {
+        ok = check(document) && ok;
+    }
+    ok = check_pixels() && ok;
+    ok = check_retained() && ok;
+    ok = check_streaming() && ok;
+    ok = check_tile_size() && ok;
+    ok = check_strips_and_regions() && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}